@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/message_store.hpp"
+#include "pfs/chat/sqlite3.hpp"
+#include <pfs/filesystem.hpp>
+#include <pfs/fmt.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// Compares hot chat queries (executed on cached prepared statements) with the same
+// queries parsed and planned on every call.
+
+namespace fs = pfs::filesystem;
+
+using message_store_t = chat::message_store<chat::storage::sqlite3>;
+
+static constexpr int MESSAGE_COUNT = 1000;
+static constexpr int ITERATIONS = 10000;
+
+static void measure (char const * title, std::function<void()> f)
+{
+    // Warm up
+    f();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; i++)
+        f();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%-40s: %10.1f ns/call\n", title, static_cast<double>(elapsed) / ITERATIONS);
+}
+
+int main ()
+{
+    auto message_db_path = fs::temp_directory_path() / "messages_benchmark.db";
+
+    if (fs::exists(message_db_path))
+        fs::remove_all(message_db_path);
+
+    auto db = debby::sqlite3::make(message_db_path);
+    auto message_store = message_store_t::make(chat::contact::id_generator{}.next(), db);
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+
+    message_store.transaction([& chat] {
+        for (int i = 0; i < MESSAGE_COUNT; i++) {
+            auto ed = chat.create();
+            ed.add_text(fmt::format("Message #{}", i));
+            ed.save();
+        }
+
+        return pfs::optional<std::string>{};
+    });
+
+    auto table_name = chat::storage::sqlite3::chat_table_name_prefix() + to_string(chat.id());
+    auto sf = chat::sort_flags(chat::chat_sort_flag::by_creation_time
+        , chat::chat_sort_flag::ascending_order);
+    std::size_t counter = 0;
+
+    auto consume = [& counter] (chat::message::message_credentials const &) { counter++; };
+
+    measure("for_each (page of 20, prepared)", [& chat, & consume, sf] {
+        chat.for_each(consume, sf, 20);
+    });
+
+    measure("for_each (page of 20, parsed per call)", [& db, & counter, & table_name] {
+        debby::error err;
+        auto res = db.exec(fmt::format("SELECT message_id, author_id, creation_time"
+            ", modification_time, delivered_time, read_time, content FROM \"{}\""
+            " ORDER BY creation_time ASC, rowid ASC LIMIT 20", table_name), & err);
+
+        for (; res.has_more(); res.next())
+            counter++;
+    });
+
+    // Page is not cached, so each call fetches the window
+    measure("prefetch window (prepared)", [& chat, sf] {
+        chat.message(MESSAGE_COUNT / 2, sf);
+        chat.message(0, sf);
+    });
+
+    measure("last_message (prepared)", [& chat] {
+        chat.last_message();
+    });
+
+    measure("last_message (parsed per call)", [& db, & counter, & table_name] {
+        debby::error err;
+        auto res = db.exec(fmt::format("SELECT message_id, author_id, creation_time"
+            ", modification_time, delivered_time, read_time, content FROM \"{}\""
+            " ORDER BY ROWID DESC LIMIT 1", table_name), & err);
+
+        if (res.has_more())
+            counter++;
+    });
+
+    std::printf("Messages processed: %zu\n", counter);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+//                 Frequent candidates case runs on mixed text.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/substring_matcher.hpp"
+#include <pfs/unicode/search.hpp>
+#include <pfs/unicode/utf8_iterator.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// Compares substring_matcher with code point based `pfs::unicode::search_all()`.
+
+using utf8_iterator = pfs::unicode::utf8_iterator<std::string::const_iterator>;
+
+static constexpr int ITERATIONS = 200;
+
+static void measure (char const * title, std::size_t text_size, std::function<std::size_t()> f)
+{
+    // Warm up
+    auto matches = f();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ITERATIONS; i++)
+        f();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    auto seconds = static_cast<double>(elapsed) / 1000000;
+    auto mbytes = static_cast<double>(text_size) * ITERATIONS / (1024 * 1024);
+
+    std::printf("%-45s: %8.1f MB/s (%zu matches)\n", title, mbytes / seconds, matches);
+}
+
+static void run (char const * title, std::string const & text, std::string const & pattern, bool ignore_case)
+{
+    std::printf("%s\n", title);
+
+    measure("  pfs::unicode::search_all", text.size(), [& text, & pattern, ignore_case] {
+        std::size_t count = 0;
+        auto first = utf8_iterator::begin(text.begin(), text.end());
+        auto s_first = utf8_iterator::begin(pattern.begin(), pattern.end());
+
+        pfs::unicode::search_all(first, first.end(), s_first, s_first.end(), ignore_case
+            , [& count] (pfs::unicode::match_item const &) { count++; });
+
+        return count;
+    });
+
+    chat::substring_matcher matcher {pattern, ignore_case};
+
+    measure("  substring_matcher::search_all", text.size(), [& text, & matcher] {
+        std::size_t count = 0;
+        matcher.search_all(text, [& count] (pfs::unicode::match_item const &) { count++; });
+        return count;
+    });
+}
+
+int main ()
+{
+    std::string ascii_text;
+    std::string mixed_text;
+
+    for (int i = 0; i < 20000; i++) {
+        ascii_text += "Lorem ipsum dolor sit amet, consectetur adipiscing elit. ";
+        mixed_text += "Лорем ипсум долор сит амет, lorem ipsum. ";
+    }
+
+    ascii_text += "Needle";
+    mixed_text += "Needle";
+
+    run("ASCII text, case insensitive", ascii_text, "needle", true);
+    run("ASCII text, case sensitive", ascii_text, "Needle", false);
+    run("Mixed text, case insensitive", mixed_text, "needle", true);
+    run("Mixed text, frequent candidates", mixed_text, "lorem", true);
+
+    return 0;
+}
@@ -5,11 +5,14 @@
 //
 // Changelog:
 //      2022.11.03 Initial version.
+//      2026.10.16 Added `dispatch_multicast_data`.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "pfs/chat/namespace.hpp"
 #include "pfs/chat/contact.hpp"
 #include "pfs/chat/file.hpp"
+#include "pfs/chat/shared_buffer.hpp"
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -27,6 +30,14 @@ public:
         , std::vector<char> const & /*data*/)> dispatch_data
     = [] (contact::id, std::vector<char> const &) {};
 
+    /**
+     * Called to dispatch the same data to several addressees (e.g. group members) at once.
+     * Data is shared, so it can be queued for each addressee without copying.
+     * If not set (default), @c dispatch_data is called for each addressee.
+     */
+    mutable std::function<void (std::vector<contact::id> const & /*addressees*/
+        , shared_buffer /*data*/)> dispatch_multicast_data;
+
     /**
      * Called when file/attachment request received.
      */
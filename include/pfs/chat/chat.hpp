@@ -8,6 +8,15 @@
 //      2022.02.17 Refactored to use backend.
 //      2024.11.29 Started V2.
 //                 Renamed conversation to chat.
+//      2026.10.16 Added keyset pagination (`for_each_after`, `for_each_before`).
+//                 Backend representation is shared to allow handle caching.
+//                 Added set-based marking of messages as delivered/read.
+//                 Added message column projection.
+//                 Added message filter.
+//                 `save_incoming()` accepts content view.
+//                 Added filtered `for_each_before`.
+//                 Set-based marking returns identifiers of marked messages.
+//                 `save_incoming()` accepts decoded content.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
@@ -18,12 +27,14 @@
 #include "flags.hpp"
 #include "message.hpp"
 #include <pfs/optional.hpp>
+#include <pfs/string_view.hpp>
 #include <pfs/time_point.hpp>
 #include <pfs/unicode/search.hpp>
 #include <pfs/unicode/utf8_iterator.hpp>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -39,6 +50,41 @@ enum class chat_sort_flag: int
     , descending_order = 1 << 9
 };
 
+/**
+ * Set of message columns fetched from the storage.
+ */
+enum class message_projection: int
+{
+      full    // All columns including content
+    , headers // Identifiers, timestamps and delivery state only, `contents` is not set
+};
+
+/**
+ * Filter of messages applied by the storage (translated into indexed predicates).
+ * Default constructed filter matches all messages.
+ */
+struct message_filter
+{
+    // Creation time range [since, until), unset bound is not checked
+    pfs::optional<pfs::utc_time_point> since;
+    pfs::optional<pfs::utc_time_point> until;
+
+    // Message authors, empty list means any author
+    std::vector<contact::id> authors;
+
+    // Messages with attachments only
+    bool has_attachment {false};
+
+    // Messages containing components of any of specified kinds (bitwise OR of
+    // `message::content_kind` flags), zero means any kinds
+    std::uint32_t content_kinds {0};
+
+    bool empty () const noexcept
+    {
+        return !since && !until && authors.empty() && !has_attachment && content_kinds == 0;
+    }
+};
+
 template <typename Storage>
 class chat final
 {
@@ -49,7 +95,7 @@ public:
     using editor_type = editor<Storage>;
 
 private:
-    std::unique_ptr<rep> _d;
+    std::shared_ptr<rep> _d;
 
 public:
     /**
@@ -82,6 +128,9 @@ public:
     // For internal use only
     CHAT__EXPORT chat (rep * d) noexcept;
 
+    // For internal use only (shared handle from message store cache)
+    CHAT__EXPORT chat (std::shared_ptr<rep> d) noexcept;
+
     chat (chat const & other) = delete;
     chat & operator = (chat const & other) = delete;
 
@@ -110,16 +159,16 @@ public:
     /**
      * Mark (if not already marked) message delivered by addressee.
      *
-     * @throw debby::error on storage error.
-     * @throw chat::error if message not found.
+     * @throw chat::error{errc::storage_error} on storage error.
+     * @throw chat::error{errc::message_not_found} if message not found.
      */
     CHAT__EXPORT void mark_delivered (message::id message_id, pfs::utc_time_point delivered_time);
 
     /**
      * Mark (if not already marked) message received.
      *
-     * @throw debby::error on storage error.
-     * @throw chat::error if message not found.
+     * @throw chat::error{errc::storage_error} on storage error.
+     * @throw chat::error{errc::message_not_found} if message not found.
      */
     void mark_received (message::id message_id, pfs::utc_time_point received_time)
     {
@@ -129,17 +178,51 @@ public:
     /**
      * Mark (if not already marked) message read by addressee.
      *
-     * @throw debby::error on storage error.
-     * @throw chat::error if message not found.
+     * @throw chat::error{errc::storage_error} on storage error.
+     * @throw chat::error{errc::message_not_found} if message not found.
      */
     CHAT__EXPORT void mark_read (message::id message_id, pfs::utc_time_point read_time);
 
+    /**
+     * Mark (if not already marked) messages @a message_ids delivered by addressee.
+     * Unknown messages are ignored.
+     *
+     * @return Identifiers of marked messages.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT std::vector<message::id> mark_delivered (std::vector<message::id> const & message_ids
+        , pfs::utc_time_point delivered_time);
+
+    /**
+     * Mark (if not already marked) messages @a message_ids read. Unknown messages are ignored.
+     *
+     * @return Identifiers of marked messages.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT std::vector<message::id> mark_read (std::vector<message::id> const & message_ids
+        , pfs::utc_time_point read_time);
+
+    /**
+     * Mark unread messages up to @a message_id (inclusive, in creation order) read.
+     *
+     * @param outgoing Mark own messages if @c true (read notification received from
+     *        opponent) or incoming messages otherwise.
+     *
+     * @return Identifiers of marked messages.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT std::vector<message::id> mark_read_up_to (message::id message_id
+        , pfs::utc_time_point read_time, bool outgoing);
+
     /**
      * Creates editor for new outgoing message.
      *
      * @return Editor instance.
      *
-     * @throw debby::error on storage error.
+     * @throw chat::error if chat is invalid.
      */
     CHAT__EXPORT editor_type create ();
 
@@ -157,27 +240,42 @@ public:
      *
      * If message already exists content will be updated if different from
      * original.
+     *
+     * @param content Binary or JSON encoded content (see message::content), stored in
+     *        binary encoding. Binary content of the current encoding version is
+     *        stored as is without intermediate copies (e.g. directly from the
+     *        received packet, see protocol::regular_message_view).
+     *
+     * @throw chat::error if @a content is invalid.
      */
     CHAT__EXPORT void save_incoming (message::id message_id, contact::id author_id
-        , pfs::utc_time_point const & creation_time, std::string const & content);
+        , pfs::utc_time_point const & creation_time, pfs::string_view content);
+
+    /**
+     * Save incoming message (see save_incoming() above) with @a content already decoded
+     * by caller into @a decoded (see message::content::decode_view()), so it is not
+     * decoded again.
+     */
+    CHAT__EXPORT void save_incoming (message::id message_id, contact::id author_id
+        , pfs::utc_time_point const & creation_time, pfs::string_view content
+        , message::content && decoded);
 
     /**
      * Get message credentials by @a message_id.
      *
+     * Content is not fetched if @a projection is @c message_projection::headers.
+     *
      * @return Message credentials or @c nullopt if message not found.
      *
      * @throw chat::error{errc::storage_error} on storage error.
-     * @throw chat::error{} if message content is invalid (i.e. bad JSON source).
      */
-    CHAT__EXPORT pfs::optional<message::message_credentials> message (message::id message_id) const;
+    CHAT__EXPORT pfs::optional<message::message_credentials> message (message::id message_id
+        , message_projection projection = message_projection::full) const;
 
     /**
      * Get message credentials by @a offset.
      *
-     * @return Message credentials or @c nullopt if message not found.
-     *
-     * @throw debby::error on storage error.
-     * @throw chat::error if message content is invalid (i.e. bad JSON source).
+     * @return Message credentials or @c nullopt if message not found or on storage error.
      *
      * @note By default, messages are sorted by sequential identifier. Thus the
      *       messages can be displayed in the order in which they were saved.
@@ -195,13 +293,27 @@ public:
 
     /**
      * Fetch all chat messages in order specified by @a sort_flag
-     * (see @c conversation_sort_flag).
+     * (see @c conversation_sort_flag). Content is not fetched if @a projection is
+     * @c message_projection::headers, so headers can be streamed cheaply (e.g. for chat
+     * list or receipts processing).
      *
-     * @throw debby::error on storage error.
-     * @throw chat::error if message content is invalid (i.e. bad JSON source).
+     * @note Query is executed on a cached prepared statement, so @a f must not call
+     *       for_each() with the same arguments for this chat recursively.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
      */
     CHAT__EXPORT void for_each (std::function<void(message::message_credentials const &)> f
-        , int sort_flags, int max_count) const;
+        , int sort_flags, int max_count, message_projection projection = message_projection::full) const;
+
+    /**
+     * Fetch up to @a max_count messages matching @a filter in order specified by
+     * @a sort_flags (see for_each() above).
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void for_each (std::function<void(message::message_credentials const &)> f
+        , message_filter const & filter, int sort_flags, int max_count
+        , message_projection projection = message_projection::full) const;
 
     /**
      * Convenient function for fetch all chat messages in order
@@ -216,6 +328,53 @@ public:
         for_each(f, sf, max_count);
     }
 
+    /**
+     * Fetch up to @a max_count messages following the message @a anchor_id in order
+     * specified by @a sort_flags (see @c chat_sort_flag). If @a anchor_id is nil
+     * fetching starts from the first message.
+     *
+     * @details Unlike offset-based access the page is located by index seek, so
+     *          fetching time does not depend on the anchor position in the chat.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void for_each_after (message::id anchor_id
+        , std::function<void(message::message_credentials const &)> f
+        , int sort_flags, int max_count) const;
+
+    /**
+     * Fetch up to @a max_count messages matching @a filter following the message
+     * @a anchor_id (see for_each_after() above). Anchor is not required to match the filter.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void for_each_after (message::id anchor_id
+        , std::function<void(message::message_credentials const &)> f
+        , message_filter const & filter, int sort_flags, int max_count) const;
+
+    /**
+     * Fetch up to @a max_count messages preceding the message @a anchor_id in order
+     * specified by @a sort_flags (see @c chat_sort_flag). If @a anchor_id is nil
+     * the last @a max_count messages are fetched.
+     *
+     * @note Messages are passed to @a f in @a sort_flags order too.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void for_each_before (message::id anchor_id
+        , std::function<void(message::message_credentials const &)> f
+        , int sort_flags, int max_count) const;
+
+    /**
+     * Fetch up to @a max_count messages matching @a filter preceding the message
+     * @a anchor_id (see for_each_before() above). Anchor is not required to match the filter.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void for_each_before (message::id anchor_id
+        , std::function<void(message::message_credentials const &)> f
+        , message_filter const & filter, int sort_flags, int max_count) const;
+
     /**
      * Erases all messages for chat.
      *
@@ -0,0 +1,543 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+//                 Added envelope support.
+//                 Contact credentials contain supported packet formats.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include "contact.hpp"
+#include "error.hpp"
+#include "message.hpp"
+#include "primal_serializer.hpp"
+#include "protocol.hpp"
+#include <pfs/endian.hpp>
+#include <pfs/i18n.hpp>
+#include <pfs/string_view.hpp>
+#include <pfs/binary_istream.hpp>
+#include <pfs/binary_ostream.hpp>
+#include <pfs/universal_id_pack.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+CHAT__NAMESPACE_BEGIN
+
+//
+// Compact packet layout:
+//
+// +---------------+------+--------+-----+
+// | 0x80|version  | type | field  | ... |
+// +---------------+------+--------+-----+
+//         1           1
+//
+// Fields:
+//      - integers (lengths, counts, enumerations) are unsigned LEB128 varints;
+//      - strings are varint length followed by characters;
+//      - identifiers are dictionary coded: varint 0 followed by 16 bytes of the identifier
+//        (identifier is appended to the dictionary) or varint N > 0 referencing the
+//        N-th identifier of the dictionary;
+//      - time points are zigzag varint deltas (in milliseconds) from the previous time point
+//        (from zero for the first one).
+//
+// Packets of `primal_serializer` start with the packet type (less than 0x80), so
+// decoder accepts both formats and packets of both formats can be mixed in the same channel.
+// Peers of previous versions decode primal packets only, so compact packets are sent to
+// peers that announced support of compact format (see `protocol::packet_format`).
+//
+template <pfs::endian Endianess = pfs::endian::network>
+struct compact_serializer
+{
+    static constexpr std::uint8_t version = 1;
+    static constexpr std::uint8_t header = 0x80 | version;
+    static constexpr protocol::packet_format format = protocol::packet_format::compact;
+
+    // Maximum number of identifiers in the dictionary, other identifiers are always
+    // written as is
+    static constexpr std::size_t max_dictionary_size = 256;
+
+    using output_archive_type = std::vector<char>;
+    using input_archive_type  = pfs::string_view;
+    using ostream_type = pfs::binary_ostream<Endianess>;
+    using primal_type  = primal_serializer<Endianess>;
+
+    // Envelope format is independent of the packets format
+    using envelope_decoder = typename primal_type::envelope_decoder;
+
+    /**
+     * Identifier dictionary and time base. By default each packet is encoded with its own
+     * (initially empty) session, so packets are independent (messenger always encodes and
+     * decodes packets this way). Session shared by several packets (see pack() and
+     * istream_type) makes repeated identifiers cheaper but requires decoding packets in the
+     * encoding order without losses, so it is intended for transport implementations that
+     * pack packets themselves (e.g. over a reliable connection); both sides must reset their
+     * sessions simultaneously.
+     */
+    class session
+    {
+        friend struct compact_serializer;
+
+        std::vector<pfs::universal_id> _ids;
+        std::int64_t _time_base {0};
+
+    public:
+        void reset ()
+        {
+            _ids.clear();
+            _time_base = 0;
+        }
+
+        std::size_t size () const noexcept
+        {
+            return _ids.size();
+        }
+    };
+
+    class istream_type
+    {
+        friend struct compact_serializer;
+
+        pfs::binary_istream<Endianess> _in;
+        session _own_session;
+        session * _session {nullptr};
+        bool _compact {false};
+
+    public:
+        istream_type (char const * data, std::size_t size)
+            : _in(data, size)
+            , _session(& _own_session)
+        {}
+
+        istream_type (char const * data, std::size_t size, session & s)
+            : _in(data, size)
+            , _session(& s)
+        {}
+
+        istream_type (istream_type const &) = delete;
+        istream_type & operator = (istream_type const &) = delete;
+
+    public:
+        /**
+         * Checks if the packet is encoded in compact format (valid after packet type is read).
+         */
+        bool compact () const noexcept
+        {
+            return _compact;
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Serialization
+    ////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Serializes packet @a pkt into @a buffer replacing its content.
+     */
+    template <typename Packet>
+    static void pack (output_archive_type & buffer, Packet const & pkt)
+    {
+        session s;
+        pack(buffer, pkt, s);
+    }
+
+    /**
+     * Serializes packet @a pkt into @a buffer replacing its content using (and updating)
+     * session @a s.
+     */
+    template <typename Packet>
+    static void pack (output_archive_type & buffer, Packet const & pkt, session & s)
+    {
+        buffer.clear();
+
+        // Compact packet never exceeds primal one by more than a byte per field
+        buffer.reserve(primal_type::packed_size(pkt) + 16);
+
+        ostream_type out {buffer};
+        out << header;
+        pack_fields(out, s, pkt);
+    }
+
+    /**
+     * Serializes envelope @a env (see primal_serializer) into @a buffer replacing its content.
+     */
+    static void pack (output_archive_type & buffer, protocol::envelope const & env)
+    {
+        primal_type::pack(buffer, env);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Deserialization
+    ////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Reads packet type detecting packet format.
+     *
+     * @throw chat::error{errc::bad_packet_type} if packet is encoded by unsupported version.
+     */
+    static void unpack (istream_type & in, protocol::packet_enum & target)
+    {
+        std::uint8_t b = 0;
+        in._in >> b;
+
+        if ((b & 0x80) == 0) {
+            in._compact = false;
+            target = static_cast<protocol::packet_enum>(b);
+            return;
+        }
+
+        if (b != header) {
+            throw error {errc::bad_packet_type
+                , tr::f_("unsupported compact packet version: {}", static_cast<int>(b & 0x7F))};
+        }
+
+        in._compact = true;
+        in._in >> b;
+        target = static_cast<protocol::packet_enum>(b);
+    }
+
+    template <typename Packet>
+    static void unpack (istream_type & in, Packet & target)
+    {
+        if (in._compact)
+            unpack_fields(in._in, *in._session, target);
+        else
+            primal_type::unpack(in._in, target);
+    }
+
+private:
+    ////////////////////////////////////////////////////////////////////////////////
+    // Packet fields
+    ////////////////////////////////////////////////////////////////////////////////
+    static void pack_fields (ostream_type & out, session & s, protocol::contact_credentials const & pkt)
+    {
+        put_type(out, protocol::packet_enum::contact_credentials);
+        put_id(out, s, pkt.contact.contact_id);
+        put_id(out, s, pkt.contact.creator_id);
+        put_string(out, pkt.contact.alias);
+        put_string(out, pkt.contact.avatar);
+        put_string(out, pkt.contact.description);
+        put_string(out, pkt.contact.extra);
+        put_varint(out, static_cast<std::uint64_t>(pkt.contact.type));
+        put_varint(out, pkt.formats);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::contact_credentials & target)
+    {
+        target.contact.contact_id = get_id(in, s);
+        target.contact.creator_id = get_id(in, s);
+        get_string(in, target.contact.alias);
+        get_string(in, target.contact.avatar);
+        get_string(in, target.contact.description);
+        get_string(in, target.contact.extra);
+        target.contact.type = static_cast<chat_enum>(get_varint(in));
+        target.formats = in.available() > 0 ? static_cast<std::uint8_t>(get_varint(in)) : 0;
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::group_members const & pkt)
+    {
+        put_type(out, protocol::packet_enum::group_members);
+        put_id(out, s, pkt.group_id);
+        put_ids(out, s, pkt.members);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::group_members & target)
+    {
+        target.group_id = get_id(in, s);
+        get_ids(in, s, target.members);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::regular_message const & pkt)
+    {
+        put_type(out, protocol::packet_enum::regular_message);
+        put_id(out, s, pkt.message_id);
+        put_id(out, s, pkt.author_id);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.mod_time);
+        put_string(out, pkt.content);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::regular_message & target)
+    {
+        target.message_id = get_id(in, s);
+        target.author_id = get_id(in, s);
+        target.chat_id = get_id(in, s);
+        target.mod_time = get_time(in, s);
+        get_string(in, target.content);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::regular_message_view & target)
+    {
+        target.message_id = get_id(in, s);
+        target.author_id = get_id(in, s);
+        target.chat_id = get_id(in, s);
+        target.mod_time = get_time(in, s);
+        target.content = get_view(in);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::delivery_notification const & pkt)
+    {
+        put_type(out, protocol::packet_enum::delivery_notification);
+        put_id(out, s, pkt.message_id);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.delivered_time);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::delivery_notification & target)
+    {
+        target.message_id = get_id(in, s);
+        target.chat_id = get_id(in, s);
+        target.delivered_time = get_time(in, s);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::read_notification const & pkt)
+    {
+        put_type(out, protocol::packet_enum::read_notification);
+        put_id(out, s, pkt.message_id);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.read_time);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::read_notification & target)
+    {
+        target.message_id = get_id(in, s);
+        target.chat_id = get_id(in, s);
+        target.read_time = get_time(in, s);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::bulk_delivery_notification const & pkt)
+    {
+        put_type(out, protocol::packet_enum::bulk_delivery_notification);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.delivered_time);
+        put_ids(out, s, pkt.message_ids);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::bulk_delivery_notification & target)
+    {
+        target.chat_id = get_id(in, s);
+        target.delivered_time = get_time(in, s);
+        get_ids(in, s, target.message_ids);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::bulk_read_notification const & pkt)
+    {
+        put_type(out, protocol::packet_enum::bulk_read_notification);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.read_time);
+        put_ids(out, s, pkt.message_ids);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::bulk_read_notification & target)
+    {
+        target.chat_id = get_id(in, s);
+        target.read_time = get_time(in, s);
+        get_ids(in, s, target.message_ids);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::read_up_to_notification const & pkt)
+    {
+        put_type(out, protocol::packet_enum::read_up_to_notification);
+        put_id(out, s, pkt.message_id);
+        put_id(out, s, pkt.chat_id);
+        put_time(out, s, pkt.read_time);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::read_up_to_notification & target)
+    {
+        target.message_id = get_id(in, s);
+        target.chat_id = get_id(in, s);
+        target.read_time = get_time(in, s);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::file_request const & pkt)
+    {
+        put_type(out, protocol::packet_enum::file_request);
+        put_id(out, s, pkt.file_id);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::file_request & target)
+    {
+        target.file_id = get_id(in, s);
+    }
+
+    static void pack_fields (ostream_type & out, session & s, protocol::file_error const & pkt)
+    {
+        put_type(out, protocol::packet_enum::file_error);
+        put_id(out, s, pkt.file_id);
+    }
+
+    template <typename IStream>
+    static void unpack_fields (IStream & in, session & s, protocol::file_error & target)
+    {
+        target.file_id = get_id(in, s);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Primitives
+    ////////////////////////////////////////////////////////////////////////////////
+    static void put_type (ostream_type & out, protocol::packet_enum type)
+    {
+        out << static_cast<std::uint8_t>(type);
+    }
+
+    static void put_varint (ostream_type & out, std::uint64_t value)
+    {
+        while (value >= 0x80) {
+            out << static_cast<std::uint8_t>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+
+        out << static_cast<std::uint8_t>(value);
+    }
+
+    template <typename IStream>
+    static std::uint64_t get_varint (IStream & in)
+    {
+        std::uint64_t result = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            std::uint8_t b = 0;
+            in >> b;
+            result |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+
+            if ((b & 0x80) == 0)
+                return result;
+        }
+
+        throw error {errc::bad_content, tr::_("bad varint")};
+    }
+
+    static void put_string (ostream_type & out, std::string const & s)
+    {
+        put_varint(out, s.size());
+        out.write(s.data(), s.size());
+    }
+
+    template <typename IStream>
+    static pfs::string_view get_view (IStream & in)
+    {
+        auto sz = get_varint(in);
+
+        if (sz > in.available())
+            throw error {errc::bad_content, tr::_("unexpected end of packet")};
+
+        pfs::string_view result {in.begin(), static_cast<std::size_t>(sz)};
+        in.skip(static_cast<std::size_t>(sz));
+        return result;
+    }
+
+    template <typename IStream>
+    static void get_string (IStream & in, std::string & target)
+    {
+        auto view = get_view(in);
+        target.assign(view.data(), view.size());
+    }
+
+    static void put_id (ostream_type & out, session & s, pfs::universal_id const & id)
+    {
+        auto pos = std::find(s._ids.begin(), s._ids.end(), id);
+
+        if (pos != s._ids.end()) {
+            put_varint(out, static_cast<std::uint64_t>(pos - s._ids.begin()) + 1);
+        } else {
+            put_varint(out, 0);
+            out << id;
+
+            if (s._ids.size() < max_dictionary_size)
+                s._ids.push_back(id);
+        }
+    }
+
+    template <typename IStream>
+    static pfs::universal_id get_id (IStream & in, session & s)
+    {
+        auto tag = get_varint(in);
+
+        if (tag == 0) {
+            pfs::universal_id id;
+            in >> id;
+
+            if (s._ids.size() < max_dictionary_size)
+                s._ids.push_back(id);
+
+            return id;
+        }
+
+        if (tag > s._ids.size())
+            throw error {errc::bad_content, tr::_("bad identifier reference")};
+
+        return s._ids[static_cast<std::size_t>(tag - 1)];
+    }
+
+    static void put_ids (ostream_type & out, session & s, std::vector<pfs::universal_id> const & ids)
+    {
+        put_varint(out, ids.size());
+
+        for (auto const & x: ids)
+            put_id(out, s, x);
+    }
+
+    template <typename IStream>
+    static void get_ids (IStream & in, session & s, std::vector<pfs::universal_id> & ids)
+    {
+        auto sz = get_varint(in);
+
+        // Each identifier occupies at least one byte
+        if (sz > in.available())
+            throw error {errc::bad_content, tr::_("bad identifiers count")};
+
+        ids.reserve(static_cast<std::size_t>(sz));
+
+        for (std::uint64_t i = 0; i < sz; i++)
+            ids.push_back(get_id(in, s));
+    }
+
+    static void put_time (ostream_type & out, session & s, pfs::utc_time_point const & t)
+    {
+        auto millis = static_cast<std::int64_t>(t.to_millis().count());
+        auto delta = static_cast<std::uint64_t>(millis) - static_cast<std::uint64_t>(s._time_base);
+
+        // Zigzag encoding of the signed delta
+        put_varint(out, (delta << 1) ^ (0 - (delta >> 63)));
+        s._time_base = millis;
+    }
+
+    template <typename IStream>
+    static pfs::utc_time_point get_time (IStream & in, session & s)
+    {
+        auto z = get_varint(in);
+        auto delta = (z >> 1) ^ (0 - (z & 1));
+        auto millis = static_cast<std::int64_t>(static_cast<std::uint64_t>(s._time_base) + delta);
+
+        s._time_base = millis;
+        return pfs::utc_time_point{std::chrono::milliseconds{millis}};
+    }
+};
+
+template <pfs::endian Endianess>
+constexpr std::uint8_t compact_serializer<Endianess>::version;
+
+template <pfs::endian Endianess>
+constexpr std::uint8_t compact_serializer<Endianess>::header;
+
+template <pfs::endian Endianess>
+constexpr protocol::packet_format compact_serializer<Endianess>::format;
+
+template <pfs::endian Endianess>
+constexpr std::size_t compact_serializer<Endianess>::max_dictionary_size;
+
+CHAT__NAMESPACE_END
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include "contact.hpp"
+#include "exports.hpp"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+CHAT__NAMESPACE_BEGIN
+
+/**
+ * In-memory trigram index over contact alias and description. Used by `contacts_searcher`
+ * to select candidate contacts instead of scanning whole contact list.
+ *
+ * @details Trigrams are byte trigrams of UTF-8 text with ASCII letters folded to lower case,
+ *          so index serves both case sensitive and case insensitive (for ASCII pattern)
+ *          search. Candidates are a superset of matching contacts and must be verified.
+ *          Index is not synchronized with the contact storage automatically: it must be
+ *          updated on each contact addition, modification and removal (see `messenger`).
+ */
+class contact_trigram_index
+{
+public:
+    struct entry
+    {
+        contact::id contact_id;
+        std::string alias;
+        std::string description;
+    };
+
+private:
+    std::vector<entry> _entries;             // Slots, removed entries have nil contact ID
+    std::vector<std::uint32_t> _free_slots;
+    std::map<contact::id, std::uint32_t> _slots;
+
+    // Trigram key -> sorted slots
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> _postings;
+
+public:
+    contact_trigram_index () = default;
+
+public:
+    /**
+     * Rebuilds index from contacts of @a cl (`contact_list` or `contact_manager`).
+     */
+    template <typename ContactList>
+    void build (ContactList const & cl)
+    {
+        clear();
+
+        cl.for_each([this] (contact::contact const & c) {
+            add(c.contact_id, c.alias, c.description);
+        });
+    }
+
+    /**
+     * Adds contact to the index.
+     *
+     * @return @c false if contact is already indexed.
+     */
+    CHAT__EXPORT bool add (contact::id contact_id, std::string const & alias
+        , std::string const & description);
+
+    /**
+     * Replaces indexed alias and description of the contact (adds contact if it is not indexed).
+     */
+    CHAT__EXPORT void update (contact::id contact_id, std::string const & alias
+        , std::string const & description);
+
+    /**
+     * Removes contact from the index.
+     *
+     * @return @c false if contact is not indexed.
+     */
+    CHAT__EXPORT bool remove (contact::id contact_id);
+
+    CHAT__EXPORT void clear ();
+
+    std::size_t count () const noexcept
+    {
+        return _slots.size();
+    }
+
+    /**
+     * Calls @a f for each indexed contact which alias (if @a alias is @c true) or
+     * description (if @a description is @c true) may contain @a pattern.
+     * Contacts are passed in index order.
+     *
+     * @return @c false if candidates can not be selected by the index (pattern is shorter
+     *         than three bytes or case insensitive pattern contains non-ASCII characters),
+     *         @a f is not called in this case.
+     */
+    CHAT__EXPORT bool for_each_candidate (std::string const & pattern, bool ignore_case
+        , bool alias, bool description, std::function<void(entry const &)> f) const;
+
+private:
+    void index_text (std::uint32_t slot, std::string const & text, std::uint32_t field);
+    void unindex_text (std::uint32_t slot, std::string const & text, std::uint32_t field);
+    std::vector<std::uint32_t> candidates (std::string const & pattern, std::uint32_t field) const;
+};
+
+CHAT__NAMESPACE_END
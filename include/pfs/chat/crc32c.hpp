@@ -0,0 +1,26 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include "exports.hpp"
+#include <cstddef>
+#include <cstdint>
+
+CHAT__NAMESPACE_BEGIN
+
+/**
+ * Calculates CRC-32C (Castagnoli) checksum of @a size bytes of @a data. Checksum of
+ * data split into parts is calculated by passing checksum of previous parts as @a crc.
+ *
+ * @details SSE4.2 instruction is used if enabled at build time, table driven
+ *          implementation otherwise.
+ */
+CHAT__EXPORT std::uint32_t crc32c (char const * data, std::size_t size, std::uint32_t crc = 0);
+
+CHAT__NAMESPACE_END
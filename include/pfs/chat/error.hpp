@@ -5,6 +5,7 @@
 //
 // Changelog:
 //      2022.01.05 Initial version.
+//      2026.10.16 Added `errc::bad_content`.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
@@ -38,6 +39,7 @@ enum class errc
     , filesystem_error
     , storage_error      // Any error of underlying storage subsystem
     , json_error         // Any error of JSON backend
+    , bad_content        // Bad/corrupted binary encoded message content
 };
 
 class error_category : public std::error_category
@@ -5,17 +5,47 @@
 //
 // Changelog:
 //      2022.07.23 Initial version.
+//      2026.10.16 Added `transaction()`.
+//                 Added attachment search (`search_files()`).
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
 #include "contact.hpp"
 #include "file.hpp"
 #include <pfs/filesystem.hpp>
+#include <pfs/optional.hpp>
 #include <pfs/universal_id.hpp>
+#include <functional>
+#include <string>
 #include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
+/**
+ * Attachment search criteria. Empty (default) criterion matches any file.
+ */
+struct attachment_filter
+{
+    // Substring of the file name, case insensitive for ASCII characters
+    std::string name_pattern;
+
+    // Acceptable MIME types
+    std::vector<mime::mime_enum> mimes;
+
+    pfs::optional<file::filesize_t> min_size;
+    pfs::optional<file::filesize_t> max_size;
+
+    // Chat and author identifiers (nil - any)
+    contact::id chat_id;
+    contact::id author_id;
+
+    bool incoming {true};
+    bool outgoing {true};
+
+    // Maximum number of files in the result (negative - unlimited)
+    int limit {-1};
+};
+
 template <typename Storage>
 class file_cache final
 {
@@ -110,6 +140,16 @@ public:
      */
     CHAT__EXPORT std::vector<file::credentials> outgoing_files (contact::id chat_id) const;
 
+    /**
+     * Searches incoming and/or outgoing files (attachments) matching @a filter using
+     * file cache tables only (message contents are not loaded and decoded).
+     * Result credentials contain chat, author and message identifiers and the attachment
+     * index, files are ordered by modification time (newest first).
+     *
+     * @throws error @c errc::storage_error on storage error.
+     */
+    CHAT__EXPORT std::vector<file::credentials> search_files (attachment_filter const & filter) const;
+
     /**
      * Removes broken outgoing and incoming file credentials (when there is no
      * file in file system)
@@ -125,6 +165,15 @@ public:
      */
     CHAT__EXPORT void clear ();
 
+    /**
+     * Execute transaction (batch execution). Transactions can be nested (e.g. inside another
+     * transaction on the same database), changes are rolled back if @a op returns
+     * error description or throws.
+     *
+     * @return @c nullopt on success or @c std::string containing an error description otherwise.
+     */
+    CHAT__EXPORT pfs::optional<std::string> transaction (std::function<pfs::optional<std::string>()> op);
+
 private:
     /**
      * Removes outgoing file credentials from cache by specified unique identifier
@@ -5,6 +5,13 @@
 //
 // Changelog:
 //      2021.11.20 Initial version.
+//      2026.10.16 Content is stored as components, added binary encoding.
+//                 Content is decoded lazily.
+//                 Added plain text projection of HTML components.
+//                 Added content kinds.
+//                 Added `content::decode_view()`.
+//                 `content::empty()` can throw decoding error.
+//                 HTML projection is not stored in binary encoding.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
@@ -16,10 +23,14 @@
 #include "pfs/filesystem.hpp"
 #include "pfs/mime.hpp"
 #include "pfs/optional.hpp"
+#include "pfs/string_view.hpp"
 #include "pfs/time_point.hpp"
 #include "pfs/universal_id.hpp"
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -76,19 +87,81 @@ struct live_video_credentials
                              // Live Video has stopped
 };
 
+// Kinds of content components (bit flags, see content::kinds())
+namespace content_kind {
+
+enum : std::uint32_t {
+      text       = 1 << 0 // Plain text
+    , html       = 1 << 1 // HTML text
+    , attachment = 1 << 2 // Any attachment
+    , audio_wav  = 1 << 3 // Audio WAV attachment
+    , live_video = 1 << 4 // Live video (SDP description)
+};
+
+} // namespace content_kind
+
+// Run of the plain text projection copied from the source text as is
+// (see content::plain_text()).
+struct text_segment
+{
+    std::uint32_t plain_cu;  // Position in plain text (code units)
+    std::uint32_t plain_cp;  // Position in plain text (code points)
+    std::uint32_t source_cu; // Position in source text (code units)
+    std::uint32_t source_cp; // Position in source text (code points)
+};
+
+/**
+ * Message content: list of components (texts, attachments etc).
+ *
+ * @note Content is decoded lazily: the first access through any (including const) accessor
+ *       replaces the source by decoded components. So content must not be accessed from
+ *       different threads concurrently unless decoded before (see decode()).
+ */
 class content
 {
-    json _d;
+    struct component
+    {
+        bool is_attachment {false};
+        mime::mime_enum mime {mime::mime_enum::unknown};
+        std::string text;
+        file::id file_id;         // For attachments only
+        file::filesize_t size {0}; // For attachments only
+        pfs::optional<audio_wav_credentials> wav;
+
+        // Plain text projection of HTML text (tags are stripped) and its mapping to the text.
+        // Both are empty if text contains no tags.
+        std::string plain;
+        std::vector<text_segment> segments;
+    };
+
+    // Components are decoded from the source on first access
+    mutable std::vector<component> _d;
+    mutable std::string _source;
+    bool _initialized {false};
+
+public:
+    // Binary encoding version
+    static constexpr std::uint8_t binary_version = 1;
 
 public:
     CHAT__EXPORT content ();
 
     /**
-     * Construct content from JSON source.
+     * Construct content from binary (see to_binary()) or JSON (see to_string()) source.
      *
-     * @throw chat::error @c errc::json_error on JSON parse error.
+     * @details Source is decoded on first access to the content (lazily), so decoding
+     *          errors are reported by accessors (see decode()).
      */
     CHAT__EXPORT content (std::string const & source);
+    CHAT__EXPORT content (std::string && source);
+
+    /**
+     * Constructs content decoding @a source immediately. Binary source is decoded in place,
+     * so the referenced data need not outlive the result (unlike JSON source it is not copied).
+     *
+     * @throw chat::error Same as decode().
+     */
+    CHAT__EXPORT static content decode_view (pfs::string_view source);
 
     CHAT__EXPORT content (content const & other);
     CHAT__EXPORT content (content && other);
@@ -101,23 +174,58 @@ public:
      */
     operator bool () const
     {
-        return !!_d;
+        return _initialized;
     }
 
-    bool empty () const noexcept
+    /**
+     * Checks if content has no components.
+     *
+     * @throw chat::error Same as decode().
+     */
+    bool empty () const
     {
         return count() == 0;
     }
 
+    /**
+     * Decodes source if not decoded yet. Called implicitly by any accessor or modifier.
+     *
+     * @throw chat::error @c errc::json_error on JSON parse error.
+     * @throw chat::error @c errc::bad_content on binary decoding error.
+     */
+    CHAT__EXPORT void decode () const;
+
     /**
      * Number of content components.
      */
-    CHAT__EXPORT std::size_t count () const noexcept;
+    CHAT__EXPORT std::size_t count () const;
+
+    /**
+     * Kinds of content components as a bitwise OR of `content_kind` flags.
+     */
+    CHAT__EXPORT std::uint32_t kinds () const;
 
     /**
-     * Encode content to string representation
+     * Encode content to string (JSON) representation
      */
-    CHAT__EXPORT std::string to_string () const noexcept;
+    CHAT__EXPORT std::string to_string () const;
+
+    /**
+     * Encode content to compact binary representation. Used as storage and wire format.
+     *
+     * @details Binary representation starts with zero byte (that never starts JSON)
+     *          followed by encoding version. Binary source of the current version is
+     *          returned as is without decoding.
+     */
+    CHAT__EXPORT std::string to_binary () const;
+
+    /**
+     * Checks if @a source is a binary encoded content.
+     */
+    static bool is_binary (std::string const & source) noexcept
+    {
+        return !source.empty() && source[0] == '\0';
+    }
 
     /**
      * Returns content credentials of the component specified by @a index.
@@ -147,6 +255,23 @@ public:
      */
     CHAT__EXPORT live_video_credentials live_video (std::size_t index) const;
 
+    /**
+     * Returns text of the component specified by @a index suitable for search: plain text
+     * projection (tags are stripped) for HTML component and the text itself otherwise.
+     * Projection is made once when HTML component is added or decoded, it is not stored
+     * in binary encoding.
+     */
+    CHAT__EXPORT std::string const & plain_text (std::size_t index) const;
+
+    /**
+     * Maps position (code unit @a cu and code point @a cp) in the plain text of the
+     * component specified by @a index (see plain_text()) to the position in the component text.
+     *
+     * @return Code unit and code point positions in the component text.
+     */
+    CHAT__EXPORT std::pair<std::size_t, std::size_t> source_position (std::size_t index
+        , std::size_t cu, std::size_t cp) const;
+
     /**
      * Add plain text.
      */
@@ -179,6 +304,11 @@ public:
      * Clear content (delete all content components).
      */
     CHAT__EXPORT void clear ();
+
+private:
+    static void project_html (component & c);
+    static std::vector<component> decode_json (std::string const & source);
+    static std::vector<component> decode_binary (char const * data, std::size_t size);
 };
 
 inline std::string to_string (content const & c)
@@ -207,6 +337,8 @@ struct message_credentials
     // Message read time (UTC)
     pfs::optional<pfs::utc_time_point> read_time;
 
+    // Message content, decoded on first access. Not set if content is empty
+    // or not fetched (see chat::message_projection).
     pfs::optional<content> contents;
 };
 
@@ -7,13 +7,26 @@
 //      2021.12.27 Initial version.
 //      2022.02.17 Refactored to use backend.
 //      2024.11.30 Started V2.
+//      2026.10.16 Added unread message counters.
+//                 Chat handles are cached.
+//                 Added `transaction()`.
+//                 Added `migrate_content()`.
+//                 Added full-text index.
+//                 Added `indexable()`.
+//                 Added `find_chat()`.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
 #include "chat.hpp"
 #include "exports.hpp"
 #include "message.hpp"
+#include "search.hpp"
+#include <pfs/optional.hpp>
+#include <functional>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -50,14 +63,109 @@ public:
      *
      * @brief This method initializes/opens data storage for conversation messages
      *        associated with specified contact.
+     *
+     * @details Recently opened chats are cached (see `Storage::chat_handle_cache_size`),
+     *          so chats returned for the same @a chat_id share the state (e.g. message
+     *          window cache).
      */
     CHAT__EXPORT chat_type open_chat (contact::id chat_id) const;
 
+    /**
+     * Opens existing conversation by @a chat_id. Unlike open_chat() the data storage is not
+     * created (and not modified) for the unknown chat.
+     *
+     * @return Invalid chat if conversation storage does not exist.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT chat_type find_chat (contact::id chat_id) const;
+
     /**
      * Clear all chats.
      */
     CHAT__EXPORT void clear () noexcept;
 
+    /**
+     * Total unread messages count in all chats. Constant time operation: counters are
+     * maintained by chats on each modification.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT std::size_t unread_message_count () const;
+
+    /**
+     * Checks materialized counters against chat contents.
+     *
+     * @return @c false if any counter is inconsistent.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT bool verify_counters () const;
+
+    /**
+     * Recalculates materialized counters for all chats.
+     * Can be called within transaction().
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void rebuild_counters ();
+
+    /**
+     * Converts message contents stored in JSON encoding, in binary encoding of version 2
+     * (with encoded HTML projection) or as text (by previous versions) into current binary
+     * encoding stored as BLOB. Such contents remain readable without conversion.
+     * Can be called within transaction().
+     *
+     * @return Number of converted messages.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     * @throw chat::error{errc::json_error} if stored content is invalid.
+     */
+    CHAT__EXPORT std::size_t migrate_content ();
+
+    /**
+     * Checks if full-text index of message contents is available (e.g. SQLite is built with FTS5).
+     * The index is maintained by chats on each modification.
+     */
+    CHAT__EXPORT bool full_text_index_enabled () const noexcept;
+
+    /**
+     * Rebuilds full-text index from scratch. Index is built automatically when created for
+     * the existing database, so this call is only required to repair the index.
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT void rebuild_full_text_index ();
+
+    /**
+     * Checks if @a pattern can be searched using full-text index: index is enabled and
+     * pattern contains at least three characters.
+     */
+    CHAT__EXPORT bool indexable (std::string const & pattern) const;
+
+    /**
+     * Searches full-text index for messages containing @a pattern as a substring in the fields
+     * specified by @a sf (search_flags::text_content and/or search_flags::attachment_name).
+     * Search is always case insensitive.
+     *
+     * @return Chat and message identifiers of up to @a limit (negative value means no limit)
+     *         found messages starting from @a offset, ordered by relevance. Result is empty if
+     *         @a pattern is not indexable (see indexable()).
+     *
+     * @throw chat::error{errc::storage_error} on storage error.
+     */
+    CHAT__EXPORT std::vector<std::pair<contact::id, message::id>>
+    search_index (std::string const & pattern, search_flags sf, int offset = 0, int limit = -1) const;
+
+    /**
+     * Execute transaction (batch execution). Transactions can be nested (e.g. inside another
+     * transaction on the same database), changes are rolled back if @a op returns
+     * error description or throws. Caches of the chat handles are invalidated on rollback.
+     *
+     * @return @c nullopt on success or @c std::string containing an error description otherwise.
+     */
+    CHAT__EXPORT pfs::optional<std::string> transaction (std::function<pfs::optional<std::string>()> op);
+
 public:
     template <typename ...Args>
     static message_store make (Args &&... args)
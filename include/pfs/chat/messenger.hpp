@@ -6,17 +6,39 @@
 // Changelog:
 //      2021.11.17 Initial version.
 //      2024.12.02 Started V2.
+//      2026.10.16 `unread_message_count()` reads materialized counters.
+//                 Added batch processing of incoming data.
+//                 Added bulk delivery/read notifications.
+//                 Message content is dispatched in binary encoding.
+//                 Added indexed contact search.
+//                 Added attachment search.
+//                 Incoming regular messages are decoded without copying content.
+//                 Multicast data is serialized once and shared by addressees.
+//                 Outgoing packets are serialized into pooled buffers.
+//                 Incoming packets are decoded by the serializer (see `compact_serializer`).
+//                 Added multi-packet envelopes processing.
+//                 Only actually marked messages are reported by bulk notifications.
+//                 Incoming message content is decoded once.
+//                 Packet format is negotiated with peers (primal format by default).
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
 #include "activity_manager.hpp"
+#include "compact_serializer.hpp"
 #include "contact.hpp"
 #include "contact_manager.hpp"
+#include "contact_trigram_index.hpp"
 #include "error.hpp"
 #include "file_cache.hpp"
 #include "message_store.hpp"
+#include "output_buffer_pool.hpp"
 #include "primal_serializer.hpp"
+#include "search.hpp"
+#include "shared_buffer.hpp"
 #include "callback_traits/function.hpp"
+#include <algorithm>
+#include <map>
+#include <utility>
 #include <vector>
 
 CHAT__NAMESPACE_BEGIN
@@ -126,6 +148,20 @@ CHAT__NAMESPACE_BEGIN
  */
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * Received data reference for batch processing (see messenger::process_incoming_batch()).
+ */
+struct incoming_packet
+{
+    contact::id addresser_id;
+    char const * data {nullptr};
+    std::size_t size {0};
+};
+
+// `Serializer` is `primal_serializer` or `compact_serializer` (smaller packets, decodes
+// packets of both formats). Supported format is announced in contact credentials (see
+// dispatch_contact()), packets are encoded by `Serializer` for peers that announced support
+// of its format and by `primal_serializer` otherwise. Each packet is encoded independently.
 template <typename ContactManagerStorage
     , typename MessageStoreStorage = ContactManagerStorage
     , typename ActivityManagerStorage = ContactManagerStorage
@@ -153,6 +189,17 @@ private:
     contact::id_generator _contact_id_generator;
     message::id_generator _message_id_generator;
 
+    // Built on first contact search, then maintained incrementally
+    mutable contact_trigram_index _contact_index;
+    mutable bool _contact_index_ready {false};
+
+    // Reusable buffers for outgoing packets
+    mutable output_buffer_pool _output_pool;
+
+    // Optional packet formats announced by peers in their contact credentials
+    // (see protocol::packet_format)
+    std::map<contact::id, std::uint8_t> _peer_formats;
+
 public:
     messenger (contact_manager_type && contact_manager
         , message_store_type && message_store
@@ -318,8 +365,12 @@ public:
             c.contact_id = _contact_id_generator.next();
 
         auto contact_id = c.contact_id;
+        auto indexed = index_entry(c);
 
         if (_contact_manager.add(std::move(c))) {
+            if (_contact_index_ready)
+                _contact_index.add(contact_id, indexed.alias, indexed.description);
+
             this->contact_added(contact_id);
             return contact_id;
         }
@@ -338,8 +389,12 @@ public:
     update (ConcreteContactType && c)
     {
         auto contact_id = c.contact_id;
+        auto indexed = index_entry(c);
 
         if (_contact_manager.update(std::move(c))) {
+            if (_contact_index_ready)
+                _contact_index.update(contact_id, indexed.alias, indexed.description);
+
             this->contact_updated(contact_id);
             return true;
         }
@@ -385,6 +440,7 @@ public:
     void remove (contact::id id)
     {
         _contact_manager.remove(id);
+        _contact_index.remove(id);
         clear_chat(id);
         this->contact_removed(id);
     }
@@ -439,16 +495,7 @@ public:
      */
     std::size_t unread_message_count ()
     {
-        std::size_t result = 0;
-
-        _contact_manager.for_each([this, & result] (contact::contact const & c) {
-            auto cht = open_chat(c.contact_id);
-
-            if (cht)
-                result += cht.unread_message_count();
-        });
-
-        return result;
+        return _message_store.unread_message_count();
     }
 
 //     // FIXME DEPRECATED
@@ -479,11 +526,11 @@ public:
         m.author_id  = msg->author_id;
         m.chat_id = contact::is_person(addressee) ? msg->author_id : cht.id();
         m.mod_time   = msg->modification_time;
-        m.content    = msg->contents.has_value() ? to_string(*msg->contents) : std::string{};
+        m.content    = msg->contents.has_value() ? msg->contents->to_binary() : std::string{};
 
-        typename serializer_type::ostream_type out;
-        out << m;
-        dispatch_multicast(addressee, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(addressee), out.buffer(), m);
+        dispatch_multicast(addressee, std::move(out));
     }
 
     /**
@@ -528,13 +575,98 @@ public:
         m.chat_id = contact::is_person(chat_contact) ? my_contact().contact_id : chat_id;
         m.read_time = read_time;
 
-        typename serializer_type::ostream_type out;
-        out << m;
-        this->dispatch_data(chat_contact.contact_id, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(chat_contact), out.buffer(), m);
+        this->dispatch_data(chat_contact.contact_id, out.buffer());
+    }
+
+    /**
+     * Mark received messages @a message_ids as read and dispatch single read notification
+     * to message author or members of chat group.
+     *
+     * @throw chat::error{errc::chat_not_found} if conversation not found specified by @a chat_id.
+     */
+    void dispatch_read_notification (contact::id chat_id, std::vector<message::id> const & message_ids
+        , pfs::utc_time_point read_time)
+    {
+        if (message_ids.empty())
+            return;
+
+        auto cht = this->open_chat(chat_id);
+
+        if (!cht)
+            throw error {errc::chat_not_found, to_string(chat_id)};
+
+        auto chat_contact = _contact_manager.get(cht.id());
+
+        if (!is_valid(chat_contact))
+            throw error{errc::contact_not_found, to_string(chat_id)};
+
+        // Unknown and already read messages are not reported
+        auto marked_ids = cht.mark_read(message_ids, read_time);
+
+        if (marked_ids.empty())
+            return;
+
+        for (auto const & message_id: marked_ids)
+            this->message_read(cht.id(), message_id, read_time);
+
+        protocol::bulk_read_notification m;
+        m.chat_id = contact::is_person(chat_contact) ? my_contact().contact_id : chat_id;
+        m.read_time = read_time;
+        m.message_ids = std::move(marked_ids);
+
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(chat_contact), out.buffer(), m);
+        this->dispatch_data(chat_contact.contact_id, out.buffer());
+    }
+
+    /**
+     * Mark all received messages up to @a message_id (inclusive, in creation order) as read
+     * and dispatch single read notification to message author or members of chat group.
+     *
+     * @throw chat::error{errc::chat_not_found} if conversation not found specified by @a chat_id.
+     */
+    void dispatch_read_up_to_notification (contact::id chat_id, message::id message_id
+        , pfs::utc_time_point read_time)
+    {
+        auto cht = this->open_chat(chat_id);
+
+        if (!cht)
+            throw error {errc::chat_not_found, to_string(chat_id)};
+
+        auto message_ids = cht.mark_read_up_to(message_id, read_time, false);
+
+        for (auto const & id: message_ids)
+            this->message_read(cht.id(), id, read_time);
+
+        auto chat_contact = _contact_manager.get(cht.id());
+
+        protocol::read_up_to_notification m;
+        m.message_id = message_id;
+        m.chat_id = contact::is_person(chat_contact) ? my_contact().contact_id : chat_id;
+        m.read_time = read_time;
+
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(chat_contact), out.buffer(), m);
+        this->dispatch_data(chat_contact.contact_id, out.buffer());
+    }
+
+    /**
+     * Optional packet formats (see protocol::packet_format) announced by the peer
+     * @a contact_id in its contact credentials, zero if peer is unknown or supports
+     * primal format only.
+     */
+    std::uint8_t peer_formats (contact::id contact_id) const
+    {
+        auto pos = _peer_formats.find(contact_id);
+        return pos != _peer_formats.end() ? pos->second : std::uint8_t{0};
     }
 
     /**
-     * Dispatch contact credentials.
+     * Dispatch contact credentials announcing packet format supported by the serializer.
+     * Packets are encoded in primal format until peer announces supported formats by its
+     * contact credentials.
      */
     void dispatch_contact (contact::id addressee_id) const
     {
@@ -548,11 +680,11 @@ public:
             , me.extra
             , me.contact_id
             , chat_enum::person
-        }};
+        }, static_cast<std::uint8_t>(serializer_type::format)};
 
-        typename serializer_type::ostream_type out;
-        out << c;
-        this->dispatch_data(addressee_id, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(peer_formats(addressee_id), out.buffer(), c);
+        this->dispatch_data(addressee_id, out.buffer());
     }
 
     /**
@@ -585,9 +717,9 @@ public:
         }};
 
         {
-            typename serializer_type::ostream_type out;
-            out << c;
-            this->dispatch_data(addressee_id, out.take());
+            auto out = _output_pool.acquire();
+            pack_for(peer_formats(addressee_id), out.buffer(), c);
+            this->dispatch_data(addressee_id, out.buffer());
         }
 
         // Send group members
@@ -601,9 +733,9 @@ public:
             gm.members.push_back(c.contact_id);
 
         {
-            typename serializer_type::ostream_type out;
-            out << gm;
-            this->dispatch_data(addressee_id, out.take());
+            auto out = _output_pool.acquire();
+            pack_for(peer_formats(addressee_id), out.buffer(), gm);
+            this->dispatch_data(addressee_id, out.buffer());
         }
     }
 
@@ -620,9 +752,9 @@ public:
         protocol::group_members gm;
         gm.group_id = group_id;
 
-        typename serializer_type::ostream_type out;
-        out << gm;
-        this->dispatch_data(addressee_id, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(peer_formats(addressee_id), out.buffer(), gm);
+        this->dispatch_data(addressee_id, out.buffer());
     }
 
     /**
@@ -653,9 +785,9 @@ public:
         if (addressee_id == my_contact().contact_id)
             return;
 
-        typename serializer_type::ostream_type out;
-        out << protocol::file_request{file_id};
-        this->dispatch_data(addressee_id, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(peer_formats(addressee_id), out.buffer(), protocol::file_request{file_id});
+        this->dispatch_data(addressee_id, out.buffer());
     }
 
     void dispatch_file_error (contact::id addressee_id, file::id file_id)
@@ -667,9 +799,9 @@ public:
         protocol::file_error m;
         m.file_id = file_id;
 
-        typename serializer_type::ostream_type out;
-        out << m;
-        this->dispatch_data(addressee_id, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(peer_formats(addressee_id), out.buffer(), m);
+        this->dispatch_data(addressee_id, out.buffer());
     }
 
     /**
@@ -677,7 +809,8 @@ public:
      * process incomming data.
      *
      * @param addresser_id Data sender.
-     * @param data Data received.
+     * @param data Data received: single packet or envelope of packets (see protocol::envelope).
+     *        Packets of unknown types are skipped within envelope.
      *
      * @throw chat::error{errc::bad_conversation_type} Unsupported conversation type.
      * @throw chat::error{errc::group_not_found} Received conversation group
@@ -689,15 +822,19 @@ public:
     {
         typename serializer_type::istream_type in {data, size};
         protocol::packet_enum packet_type;
-        in >> packet_type;
+        serializer_type::unpack(in, packet_type);
 
         switch (packet_type) {
             case protocol::packet_enum::contact_credentials: {
                 protocol::contact_credentials cc;
-                in >> cc;
+                serializer_type::unpack(in, cc);
 
                 switch (cc.contact.type) {
                     case chat_enum::person: {
+                        // Sender's own credentials
+                        if (cc.contact.contact_id == addresser_id)
+                            _peer_formats[addresser_id] = cc.formats;
+
                         contact::person p;
                         p.contact_id = cc.contact.contact_id;
                         p.alias = std::move(cc.contact.alias);
@@ -736,7 +873,7 @@ public:
 
             case protocol::packet_enum::group_members: {
                 protocol::group_members gm;
-                in >> gm;
+                serializer_type::unpack(in, gm);
 
                 if (gm.members.empty()) {
                     // Group removed or contact has been removed from group.
@@ -758,40 +895,74 @@ public:
             }
 
             case protocol::packet_enum::regular_message: {
-                protocol::regular_message m;
-                in >> m;
+                // Content references `data`
+                protocol::regular_message_view m;
+                serializer_type::unpack(in, m);
                 process_regular_message(m);
                 break;
             }
 
             case protocol::packet_enum::delivery_notification: {
                 protocol::delivery_notification m;
-                in >> m;
+                serializer_type::unpack(in, m);
                 process_delivered_notification(m);
                 break;
             }
 
             case protocol::packet_enum::read_notification: {
                 protocol::read_notification m;
-                in >> m;
+                serializer_type::unpack(in, m);
+                process_read_notification(m);
+                break;
+            }
+
+            case protocol::packet_enum::bulk_delivery_notification: {
+                protocol::bulk_delivery_notification m;
+                serializer_type::unpack(in, m);
+                process_delivered_notification(m);
+                break;
+            }
+
+            case protocol::packet_enum::bulk_read_notification: {
+                protocol::bulk_read_notification m;
+                serializer_type::unpack(in, m);
+                process_read_notification(m);
+                break;
+            }
+
+            case protocol::packet_enum::read_up_to_notification: {
+                protocol::read_up_to_notification m;
+                serializer_type::unpack(in, m);
                 process_read_notification(m);
                 break;
             }
 
             case protocol::packet_enum::file_request: {
                 protocol::file_request m;
-                in >> m;
+                serializer_type::unpack(in, m);
                 process_file_request(addresser_id, m);
                 break;
             }
 
             case protocol::packet_enum::file_error: {
                 protocol::file_error m;
-                in >> m;
+                serializer_type::unpack(in, m);
                 process_file_error(addresser_id, m);
                 break;
             }
 
+            case protocol::packet_enum::envelope: {
+                typename serializer_type::envelope_decoder envelope {data, size};
+                pfs::string_view packet;
+
+                while (envelope.next(packet)) {
+                    if (is_known_packet(packet))
+                        process_incoming_data(addresser_id, packet.data(), packet.size());
+                }
+
+                break;
+            }
+
             default:
                 // Bad message received
                 throw error{errc::bad_packet_type};
@@ -799,6 +970,39 @@ public:
         }
     }
 
+    /**
+     * Process received data in batch. Must be called by messenger implementer to
+     * process bulk of incomming data (e.g. queued messages flushed on reconnection).
+     *
+     * @details Consecutive regular messages and delivery/read notifications are grouped
+     *          by chat and stored within single transaction; other packets are processed
+     *          as by process_incoming_data() between such runs. Generated delivery
+     *          notifications are coalesced per addressee and dispatched with callbacks
+     *          after the run is committed.
+     *          If processing of a packet fails, changes of the current run are rolled back
+     *          and exception is propagated, runs processed before stay committed.
+     *
+     * @param packets Received data.
+     * @param count Number of elements in @a packets.
+     *
+     * @throw Same as process_incoming_data().
+     * @throw chat::error{errc::storage_error} if transaction failed.
+     */
+    void process_incoming_batch (incoming_packet const * packets, std::size_t count)
+    {
+        incoming_run run;
+
+        for (std::size_t i = 0; i < count; i++)
+            batch_packet(run, packets[i].addresser_id, packets[i].data, packets[i].size);
+
+        commit_incoming_run(run);
+    }
+
+    inline void process_incoming_batch (std::vector<incoming_packet> const & packets)
+    {
+        process_incoming_batch(packets.data(), packets.size());
+    }
+
     /**
      * Cache incoming attachment/file in file cache.
      *
@@ -836,12 +1040,39 @@ public:
         return _file_cache.outgoing_files(chat_id);
     }
 
+    /**
+     * Searches attachments by metadata stored in the file cache (see `file_cache::search_files()`).
+     */
+    std::vector<file::credentials> search_files (attachment_filter const & filter) const
+    {
+        return _file_cache.search_files(filter);
+    }
+
+    /**
+     * Searches contacts for @a pattern using trigram index of contact aliases and
+     * descriptions. The index is built on first call and is maintained by add(), update()
+     * and remove() later.
+     */
+    typename contacts_searcher<contact_manager_type>::search_result
+    search_contacts (std::string const & pattern
+        , search_flags sf = search_flags::ignore_case | search_flags::alias_field) const
+    {
+        if (!_contact_index_ready) {
+            _contact_index.build(_contact_manager);
+            _contact_index_ready = true;
+        }
+
+        contacts_searcher<contact_manager_type> searcher {_contact_manager, _contact_index};
+        return searcher.search_all(pattern, sf);
+    }
+
     /**
      * Erases all person contacts, groups and channels.
      */
     void clear_contacts ()
     {
         _contact_manager.clear();
+        _contact_index.clear();
     }
 
     /**
@@ -866,6 +1097,7 @@ public:
     void clear_all ()
     {
         _contact_manager.clear();
+        _contact_index.clear();
         _message_store.clear();
         _activity_manager.clear();
         _file_cache.clear();
@@ -887,22 +1119,276 @@ public:
     }
 
 private:
+    /**
+     * Optional packet formats supported by all recipients of data addressed to @a addressee
+     * (person or group members).
+     */
+    std::uint8_t addressee_formats (contact::contact const & addressee) const
+    {
+        if (addressee.type != chat_enum::group)
+            return peer_formats(addressee.contact_id);
+
+        auto group_ref = _contact_manager.gref(addressee.contact_id);
+
+        if (!group_ref)
+            return 0;
+
+        auto my_contact_id = my_contact().contact_id;
+        std::uint8_t result = 0xFF;
+
+        for (auto const & id: group_ref.member_ids()) {
+            if (id != my_contact_id)
+                result &= peer_formats(id);
+        }
+
+        return result;
+    }
+
+    /**
+     * Serializes packet @a pkt into @a buffer by `serializer_type` if its format is supported
+     * by recipients (see @a formats) or by primal serializer otherwise.
+     */
+    template <typename Packet>
+    static void pack_for (std::uint8_t formats, typename serializer_type::output_archive_type & buffer
+        , Packet const & pkt)
+    {
+        auto required = static_cast<std::uint8_t>(serializer_type::format);
+
+        if ((formats & required) == required)
+            serializer_type::pack(buffer, pkt);
+        else
+            serializer_type::primal_type::pack(buffer, pkt);
+    }
+
+    /**
+     * Checks if serialized packet @a packet has known type and format.
+     */
+    static bool is_known_packet (pfs::string_view packet)
+    {
+        if (packet.empty())
+            return false;
+
+        try {
+            typename serializer_type::istream_type in {packet.data(), packet.size()};
+            protocol::packet_enum packet_type;
+            serializer_type::unpack(in, packet_type);
+            return protocol::is_known(packet_type);
+        } catch (error const &) {
+            // Unsupported packet format version
+            return false;
+        }
+    }
+
+    // Copy of the contact fields to index, made before the contact is moved to storage
+    // (nothing is copied if the index is not built yet)
+    template <typename ConcreteContactType>
+    contact_trigram_index::entry index_entry (ConcreteContactType const & c) const
+    {
+        if (!_contact_index_ready)
+            return contact_trigram_index::entry{};
+
+        return contact_trigram_index::entry{c.contact_id, c.alias, c.description};
+    }
+
+    // Packets stored within single transaction by `process_incoming_batch()`
+    struct incoming_run
+    {
+        std::vector<protocol::regular_message_view> messages;
+        std::vector<protocol::delivery_notification> deliveries;
+        std::vector<protocol::read_notification> reads;
+
+        bool empty () const noexcept
+        {
+            return messages.empty() && deliveries.empty() && reads.empty();
+        }
+
+        void clear ()
+        {
+            messages.clear();
+            deliveries.clear();
+            reads.clear();
+        }
+    };
+
+    /**
+     * Adds packet to the run of `process_incoming_batch()` or processes it immediately.
+     */
+    void batch_packet (incoming_run & run, contact::id addresser_id, char const * data
+        , std::size_t size)
+    {
+        typename serializer_type::istream_type in {data, size};
+        protocol::packet_enum packet_type;
+        serializer_type::unpack(in, packet_type);
+
+        switch (packet_type) {
+            case protocol::packet_enum::regular_message: {
+                // Content references packet data which is alive until the run is committed
+                protocol::regular_message_view m;
+                serializer_type::unpack(in, m);
+                run.messages.push_back(m);
+                break;
+            }
+
+            case protocol::packet_enum::delivery_notification: {
+                protocol::delivery_notification m;
+                serializer_type::unpack(in, m);
+                run.deliveries.push_back(std::move(m));
+                break;
+            }
+
+            case protocol::packet_enum::read_notification: {
+                protocol::read_notification m;
+                serializer_type::unpack(in, m);
+                run.reads.push_back(std::move(m));
+                break;
+            }
+
+            case protocol::packet_enum::bulk_delivery_notification:
+            case protocol::packet_enum::bulk_read_notification:
+            case protocol::packet_enum::read_up_to_notification:
+                // Set-based already, but can refer to the pending messages
+                commit_incoming_run(run);
+                process_incoming_data(addresser_id, data, size);
+                break;
+
+            case protocol::packet_enum::envelope: {
+                // Packets of envelope are processed as separate packets of the batch
+                typename serializer_type::envelope_decoder envelope {data, size};
+                pfs::string_view packet;
+
+                while (envelope.next(packet)) {
+                    if (is_known_packet(packet))
+                        batch_packet(run, addresser_id, packet.data(), packet.size());
+                }
+
+                break;
+            }
+
+            default:
+                // Packets like contact or group updates can affect following messages
+                commit_incoming_run(run);
+                process_incoming_data(addresser_id, data, size);
+                break;
+        }
+    }
+
+    // Received messages to acknowledge: (author ID, chat ID) -> message IDs
+    using receipt_map = std::map<std::pair<contact::id, contact::id>, std::vector<message::id>>;
+
+    template <typename Packet>
+    static void sort_by_chat (std::vector<Packet> & packets)
+    {
+        // Order of packets within the chat is preserved
+        std::stable_sort(packets.begin(), packets.end(), [] (Packet const & a, Packet const & b) {
+            return a.chat_id < b.chat_id;
+        });
+    }
+
+    void commit_incoming_run (incoming_run & run)
+    {
+        if (run.empty())
+            return;
+
+        sort_by_chat(run.messages);
+        sort_by_chat(run.deliveries);
+        sort_by_chat(run.reads);
+
+        // Chats are opened before the transaction starts: opening a chat may create
+        // (or upgrade) its table, it must not be rolled back with the run while the
+        // chat handle stays cached by the message store.
+        std::map<contact::id, chat_type> chats;
+
+        auto open_run_chat = [this, & chats] (contact::id chat_id) {
+            if (chats.find(chat_id) != chats.end())
+                return;
+
+            auto cht = this->open_chat(chat_id);
+
+            if (!cht)
+                throw error {errc::chat_not_found, to_string(chat_id)};
+
+            chats.emplace(chat_id, std::move(cht));
+        };
+
+        for (auto const & m: run.messages)
+            open_run_chat(m.chat_id);
+
+        for (auto const & m: run.deliveries)
+            open_run_chat(m.chat_id);
+
+        for (auto const & m: run.reads)
+            open_run_chat(m.chat_id);
+
+        receipt_map receipts;
+        auto received_time = pfs::current_utc_time_point();
+
+        auto failure = _message_store.transaction([this, & run, & chats, & receipts, & received_time] {
+            return _file_cache.transaction([this, & run, & chats, & receipts, & received_time] {
+                for (auto const & m: run.messages) {
+                    auto & cht = chats.at(m.chat_id);
+                    store_regular_message(cht, m, received_time);
+
+                    auto & ids = receipts[std::make_pair(m.author_id, cht.id())];
+
+                    if (std::find(ids.begin(), ids.end(), m.message_id) == ids.end())
+                        ids.push_back(m.message_id);
+                }
+
+                for (auto const & m: run.deliveries)
+                    chats.at(m.chat_id).mark_delivered(m.message_id, m.delivered_time);
+
+                for (auto const & m: run.reads)
+                    chats.at(m.chat_id).mark_read(m.message_id, m.read_time);
+
+                return pfs::optional<std::string>{};
+            });
+        });
+
+        if (failure)
+            throw error {errc::storage_error, *failure};
+
+        for (auto const & r: receipts)
+            dispatch_delivery_notification(r.first.first, r.first.second, r.second, received_time);
+
+        for (auto const & m: run.messages)
+            this->message_received(m.author_id, m.chat_id, m.message_id);
+
+        for (auto const & m: run.deliveries)
+            this->message_delivered(m.chat_id, m.message_id, m.delivered_time);
+
+        for (auto const & m: run.reads)
+            this->message_read(m.chat_id, m.message_id, m.read_time);
+
+        run.clear();
+    }
+
     // Can be considered that `dispatch_data` is analog to `dispatch_unicast`.
-    void dispatch_multicast (contact::contact const & addressee
-        , typename serializer_type::output_archive_type const & data)
+    // Data is serialized once and shared by all addressees.
+    void dispatch_multicast (contact::contact const & addressee, output_buffer_pool::lease && data)
     {
         switch (addressee.type) {
             case chat_enum::person:
-                this->dispatch_data(addressee.contact_id, data);
+                this->dispatch_data(addressee.contact_id, data.buffer());
                 break;
 
             case chat_enum::group: {
                 auto group_ref = _contact_manager.gref(addressee.contact_id);
                 auto member_ids = group_ref.member_ids();
 
-                for (auto const & member_id: member_ids) {
-                    if (member_id != my_contact().contact_id)
-                        this->dispatch_data(member_id, data);
+                member_ids.erase(std::remove(member_ids.begin(), member_ids.end()
+                    , my_contact().contact_id), member_ids.end());
+
+                if (member_ids.empty())
+                    break;
+
+                // Buffer is detached from the pool since it can be queued by addressees
+                shared_buffer buffer {data.take()};
+
+                if (this->dispatch_multicast_data) {
+                    this->dispatch_multicast_data(member_ids, buffer);
+                } else {
+                    for (auto const & member_id: member_ids)
+                        this->dispatch_data(member_id, buffer.vector());
                 }
 
                 break;
@@ -922,15 +1408,31 @@ private:
      * @throw chat::error{errc::chat_not_found} if specified in message
      *        @a m conversation not found.
      */
-    void process_regular_message (protocol::regular_message const & m)
+    void process_regular_message (protocol::regular_message_view const & m)
     {
         auto cht = this->open_chat(m.chat_id);
 
         if (!cht)
             throw error {errc::chat_not_found, to_string(m.chat_id)};
 
+        auto received_time = pfs::current_utc_time_point();
+        store_regular_message(cht, m, received_time);
+
+        // Send notification
+        dispatch_delivery_notification(m.author_id, cht.id(), m.message_id, received_time);
+
+        // Notify message received
+        this->message_received(m.author_id, m.chat_id, m.message_id);
+    }
+
+    /**
+     * Stores incoming message @a m with attachments credentials and marks it as received.
+     */
+    void store_regular_message (chat_type & cht, protocol::regular_message_view const & m
+        , pfs::utc_time_point received_time)
+    {
         // Can throw when bad/corrupted content in incoming message
-        message::content content{m.content};
+        auto content = message::content::decode_view(m.content);
 
         // Search content for attachments and cache their credentials in the
         // `file_cache`
@@ -946,16 +1448,10 @@ private:
             }
         }
 
-        cht.save_incoming(m.message_id, m.author_id, m.mod_time, to_string(content));
-
-        auto received_time = pfs::current_utc_time_point();
+        // Content is passed as is to avoid copying (it is re-encoded by chat if necessary)
+        // along with decoded one to avoid decoding it again
+        cht.save_incoming(m.message_id, m.author_id, m.mod_time, m.content, std::move(content));
         cht.mark_received(m.message_id, received_time);
-
-        // Send notification
-        dispatch_delivery_notification(m.author_id, cht.id(), m.message_id, received_time);
-
-        // Notify message received
-        this->message_received(m.author_id, m.chat_id, m.message_id);
     }
 
     /**
@@ -979,9 +1475,41 @@ private:
         m.chat_id = contact::is_person(chat_contact) ? my_contact().contact_id : chat_id;
         m.delivered_time  = received_time;
 
-        typename serializer_type::ostream_type out;
-        out << m;
-        dispatch_multicast(addressee, out.take());
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(addressee), out.buffer(), m);
+        dispatch_multicast(addressee, std::move(out));
+    }
+
+    /**
+     * Dispatch delivery notification for messages @a message_ids of the same author
+     * and chat as single packet.
+     */
+    void dispatch_delivery_notification (contact::id author_id, contact::id chat_id
+        , std::vector<message::id> const & message_ids, pfs::utc_time_point received_time)
+    {
+        if (message_ids.size() == 1) {
+            dispatch_delivery_notification(author_id, chat_id, message_ids.front(), received_time);
+            return;
+        }
+
+        auto chat_contact = _contact_manager.get(chat_id);
+
+        if (!is_valid(chat_contact))
+            throw error{errc::contact_not_found, to_string(chat_id)};
+
+        auto addressee = _contact_manager.get(author_id);
+
+        if (!is_valid(addressee))
+            throw error{errc::contact_not_found, to_string(author_id)};
+
+        protocol::bulk_delivery_notification m;
+        m.chat_id = contact::is_person(chat_contact) ? my_contact().contact_id : chat_id;
+        m.delivered_time = received_time;
+        m.message_ids = message_ids;
+
+        auto out = _output_pool.acquire();
+        pack_for(addressee_formats(addressee), out.buffer(), m);
+        dispatch_multicast(addressee, std::move(out));
     }
 
     /**
@@ -1001,6 +1529,25 @@ private:
         this->message_delivered(m.chat_id, m.message_id, m.delivered_time);
     }
 
+    /**
+     * Process bulk notification of messages delivered to addressee (receiver).
+     *
+     * @throw chat::error{errc::chat_not_found} if specified in
+     *        notification @a m conversation not found.
+     */
+    void process_delivered_notification (protocol::bulk_delivery_notification const & m)
+    {
+        auto cht = open_chat(m.chat_id);
+
+        if (!cht)
+            throw error {errc::chat_not_found, to_string(m.chat_id)};
+
+        auto marked_ids = cht.mark_delivered(m.message_ids, m.delivered_time);
+
+        for (auto const & message_id: marked_ids)
+            this->message_delivered(m.chat_id, message_id, m.delivered_time);
+    }
+
     inline void process_read_notification (chat_type & cht, message::id message_id
         , pfs::utc_time read_time)
     {
@@ -1025,6 +1572,44 @@ private:
         process_read_notification(cht, m.message_id, m.read_time);
     }
 
+    /**
+     * Process bulk notification of messages read by addressee (receiver).
+     *
+     * @throw chat::error{errc::chat_not_found} if specified in
+     *        notification @a m conversation not found.
+     */
+    void process_read_notification (protocol::bulk_read_notification const & m)
+    {
+        auto cht = open_chat(m.chat_id);
+
+        if (!cht)
+            throw error {errc::chat_not_found, to_string(m.chat_id)};
+
+        auto marked_ids = cht.mark_read(m.message_ids, m.read_time);
+
+        for (auto const & message_id: marked_ids)
+            this->message_read(m.chat_id, message_id, m.read_time);
+    }
+
+    /**
+     * Process notification of all own messages up to specified one read by addressee (receiver).
+     *
+     * @throw chat::error{errc::chat_not_found} if specified in
+     *        notification @a m conversation not found.
+     */
+    void process_read_notification (protocol::read_up_to_notification const & m)
+    {
+        auto cht = open_chat(m.chat_id);
+
+        if (!cht)
+            throw error {errc::chat_not_found, to_string(m.chat_id)};
+
+        auto message_ids = cht.mark_read_up_to(m.message_id, m.read_time, true);
+
+        for (auto const & message_id: message_ids)
+            this->message_read(m.chat_id, message_id, m.read_time);
+    }
+
     /**
      * Process file request.
      */
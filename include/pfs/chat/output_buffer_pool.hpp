@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+CHAT__NAMESPACE_BEGIN
+
+/**
+ * Pool of output buffers reused for serialization of outgoing packets. Buffers keep
+ * their capacity between uses, so serialization of packets in steady state does not
+ * allocate memory.
+ *
+ * @note Pool is not thread safe, use separate pool for each thread (e.g. per messenger).
+ */
+class output_buffer_pool
+{
+public:
+    /**
+     * Buffer acquired from the pool, returned back to the pool on destruction.
+     */
+    class lease
+    {
+        friend class output_buffer_pool;
+
+        output_buffer_pool * _pool {nullptr};
+        std::vector<char> _buffer;
+
+    private:
+        lease (output_buffer_pool * pool, std::vector<char> && buffer)
+            : _pool(pool)
+            , _buffer(std::move(buffer))
+        {}
+
+    public:
+        lease (lease && other) noexcept
+            : _pool(other._pool)
+            , _buffer(std::move(other._buffer))
+        {
+            other._pool = nullptr;
+        }
+
+        lease (lease const & other) = delete;
+        lease & operator = (lease const & other) = delete;
+        lease & operator = (lease && other) = delete;
+
+        ~lease ()
+        {
+            if (_pool != nullptr)
+                _pool->release(std::move(_buffer));
+        }
+
+    public:
+        std::vector<char> & buffer () noexcept
+        {
+            return _buffer;
+        }
+
+        /**
+         * Detaches buffer from the pool (e.g. when data must outlive the lease).
+         */
+        std::vector<char> take ()
+        {
+            _pool = nullptr;
+            return std::move(_buffer);
+        }
+    };
+
+private:
+    std::vector<std::vector<char>> _free;
+    std::size_t _max_count {8};
+    std::size_t _max_capacity {64 * 1024};
+
+public:
+    /**
+     * @param max_count Maximum number of free buffers kept in the pool.
+     * @param max_capacity Buffers of greater capacity (e.g. used for large messages)
+     *        are released instead of returning to the pool.
+     */
+    output_buffer_pool (std::size_t max_count = 8, std::size_t max_capacity = 64 * 1024)
+        : _max_count(max_count)
+        , _max_capacity(max_capacity)
+    {}
+
+    output_buffer_pool (output_buffer_pool && other) = default;
+    output_buffer_pool & operator = (output_buffer_pool && other) = default;
+
+    // Leases refer to the pool
+    output_buffer_pool (output_buffer_pool const & other) = delete;
+    output_buffer_pool & operator = (output_buffer_pool const & other) = delete;
+
+public:
+    /**
+     * Acquires empty buffer from the pool (or new one if the pool is empty).
+     */
+    lease acquire ()
+    {
+        if (_free.empty())
+            return lease{this, std::vector<char>{}};
+
+        auto buffer = std::move(_free.back());
+        _free.pop_back();
+        return lease{this, std::move(buffer)};
+    }
+
+    /**
+     * Number of free buffers in the pool.
+     */
+    std::size_t free_count () const noexcept
+    {
+        return _free.size();
+    }
+
+private:
+    void release (std::vector<char> && buffer)
+    {
+        if (_free.size() >= _max_count || buffer.capacity() > _max_capacity)
+            return;
+
+        buffer.clear();
+        _free.push_back(std::move(buffer));
+    }
+};
+
+CHAT__NAMESPACE_END
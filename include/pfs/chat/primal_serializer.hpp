@@ -5,13 +5,24 @@
 //
 // Changelog:
 //      2024.04.23 Initial version.
+//      2026.10.16 Added bulk delivery/read notifications.
+//                 Content is serialized in binary encoding.
+//                 Added zero-copy decoding of regular message.
+//                 Added serialization into caller provided storage.
+//                 Added multi-packet envelope.
+//                 Count of identifiers in bulk notifications is validated.
+//                 Contact credentials contain supported packet formats.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
 #include "contact.hpp"
+#include "crc32c.hpp"
+#include "error.hpp"
 #include "message.hpp"
 #include "protocol.hpp"
 #include <pfs/endian.hpp>
+#include <pfs/i18n.hpp>
+#include <pfs/string_view.hpp>
 #include <pfs/binary_istream.hpp>
 #include <pfs/binary_ostream.hpp>
 #include <pfs/numeric_cast.hpp>
@@ -23,6 +34,9 @@ CHAT__NAMESPACE_BEGIN
 template <pfs::endian Endianess = pfs::endian::network>
 struct primal_serializer
 {
+    static constexpr protocol::packet_format format = protocol::packet_format::primal;
+
+    using primal_type = primal_serializer;
     using output_archive_type = std::vector<char>;
     using input_archive_type  = pfs::string_view;
     using ostream_type = pfs::binary_ostream<Endianess>;
@@ -33,7 +47,7 @@ struct primal_serializer
     ////////////////////////////////////////////////////////////////////////////////
     static void pack (ostream_type & out, message::content const & content)
     {
-        out << to_string(content);
+        out << content.to_binary();
     }
 
     static void unpack (istream_type & in, message::content & content)
@@ -63,7 +77,8 @@ struct primal_serializer
             << payload.contact.avatar
             << payload.contact.description
             << payload.contact.extra
-            << payload.contact.type;
+            << payload.contact.type
+            << payload.formats;
     }
 
     static void unpack (istream_type & in, protocol::contact_credentials & target)
@@ -76,6 +91,12 @@ struct primal_serializer
             >> target.contact.description
             >> target.contact.extra
             >> target.contact.type;
+
+        // Absent in packets of previous versions
+        target.formats = 0;
+
+        if (in.available() > 0)
+            in >> target.formats;
     }
 
     ////////////////////////////////////////////////////////////////////////////////
@@ -132,6 +153,21 @@ struct primal_serializer
             >> target.content;
     }
 
+    /**
+     * Decodes regular message without copying the content: @a target references the data
+     * of the input stream.
+     */
+    static void unpack (istream_type & in, protocol::regular_message_view & target)
+    {
+        // Note: packet type must be read before
+        in  >> target.message_id
+            >> target.author_id
+            >> target.chat_id
+            >> target.mod_time;
+
+        unpack_view(in, target.content);
+    }
+
     ////////////////////////////////////////////////////////////////////////////////
     // delivery_notification serializer/deserializer
     ////////////////////////////////////////////////////////////////////////////////
@@ -170,6 +206,67 @@ struct primal_serializer
             >> target.read_time;
     }
 
+    ////////////////////////////////////////////////////////////////////////////////
+    // bulk_delivery_notification serializer/deserializer
+    ////////////////////////////////////////////////////////////////////////////////
+    static void pack (ostream_type & out, protocol::bulk_delivery_notification const & payload)
+    {
+        out << protocol::packet_enum::bulk_delivery_notification
+            << payload.chat_id
+            << payload.delivered_time;
+
+        pack_ids(out, payload.message_ids);
+    }
+
+    static void unpack (istream_type & in, protocol::bulk_delivery_notification & target)
+    {
+        // Note: packet type must be read before
+        in  >> target.chat_id
+            >> target.delivered_time;
+
+        unpack_ids(in, target.message_ids);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // bulk_read_notification serializer/deserializer
+    ////////////////////////////////////////////////////////////////////////////////
+    static void pack (ostream_type & out, protocol::bulk_read_notification const & payload)
+    {
+        out << protocol::packet_enum::bulk_read_notification
+            << payload.chat_id
+            << payload.read_time;
+
+        pack_ids(out, payload.message_ids);
+    }
+
+    static void unpack (istream_type & in, protocol::bulk_read_notification & target)
+    {
+        // Note: packet type must be read before
+        in  >> target.chat_id
+            >> target.read_time;
+
+        unpack_ids(in, target.message_ids);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // read_up_to_notification serializer/deserializer
+    ////////////////////////////////////////////////////////////////////////////////
+    static void pack (ostream_type & out, protocol::read_up_to_notification const & payload)
+    {
+        out << protocol::packet_enum::read_up_to_notification
+            << payload.message_id
+            << payload.chat_id
+            << payload.read_time;
+    }
+
+    static void unpack (istream_type & in, protocol::read_up_to_notification & target)
+    {
+        // Note: packet type must be read before
+        in  >> target.message_id
+            >> target.chat_id
+            >> target.read_time;
+    }
+
     ////////////////////////////////////////////////////////////////////////////////
     // file_request serializer/deserializer
     ////////////////////////////////////////////////////////////////////////////////
@@ -197,8 +294,281 @@ struct primal_serializer
         // Note: packet type must be read before
         in >> target.file_id;
     }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // Serialization into caller provided storage
+    ////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Serializes packet @a pkt into @a buffer replacing its content. Buffer capacity is
+     * reserved in advance (see packed_size()), so reused buffer (see output_buffer_pool)
+     * is not reallocated in steady state.
+     */
+    template <typename Packet>
+    static void pack (output_archive_type & buffer, Packet const & pkt)
+    {
+        buffer.clear();
+        buffer.reserve(packed_size(pkt));
+
+        ostream_type out {buffer};
+        pack(out, pkt);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    // envelope
+    ////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Serializes envelope @a env into @a buffer replacing its content.
+     */
+    static void pack (output_archive_type & buffer, protocol::envelope const & env)
+    {
+        buffer.clear();
+        buffer.reserve(packed_size(env));
+
+        ostream_type out {buffer};
+
+        out << protocol::packet_enum::envelope
+            << static_cast<std::uint8_t>(protocol::envelope::version)
+            << static_cast<std::uint8_t>(env.checksum ? protocol::envelope::checksum_flag : 0)
+            << pfs::numeric_cast<std::uint32_t>(env.packets.size());
+
+        for (auto const & pkt: env.packets) {
+            out << pfs::numeric_cast<std::uint32_t>(pkt.size());
+            out.write(pkt.data(), pkt.size());
+        }
+
+        if (env.checksum)
+            out << crc32c(buffer.data(), buffer.size());
+    }
+
+    /**
+     * Streaming envelope decoder: checks envelope header and checksum and walks packets
+     * without copying them.
+     */
+    class envelope_decoder
+    {
+        istream_type _in;
+        std::uint32_t _count {0};
+        std::uint32_t _remain {0};
+
+    public:
+        /**
+         * @param data Envelope data starting with the envelope packet type.
+         *
+         * @throw chat::error{errc::bad_packet_type} if data is not an envelope or envelope
+         *        version is unsupported.
+         * @throw chat::error{errc::bad_content} on checksum mismatch or corrupted header.
+         */
+        envelope_decoder (char const * data, std::size_t size)
+            : _in(data, validate(data, size))
+        {
+            protocol::packet_enum packet_type;
+            std::uint8_t version = 0;
+            std::uint8_t flags = 0;
+
+            _in >> packet_type >> version >> flags >> _count;
+            _remain = _count;
+        }
+
+    private:
+        // Checks envelope header and checksum, returns envelope size without checksum
+        static std::size_t validate (char const * data, std::size_t size)
+        {
+            if (size < ENVELOPE_HEADER_SIZE)
+                throw error {errc::bad_content, tr::_("unexpected end of envelope")};
+
+            auto packet_type = static_cast<protocol::packet_enum>(data[0]);
+            auto version = static_cast<std::uint8_t>(data[1]);
+            auto flags = static_cast<std::uint8_t>(data[2]);
+
+            if (packet_type != protocol::packet_enum::envelope)
+                throw error {errc::bad_packet_type, tr::_("envelope expected")};
+
+            if (version != protocol::envelope::version) {
+                throw error {errc::bad_packet_type
+                    , tr::f_("unsupported envelope version: {}", static_cast<int>(version))};
+            }
+
+            if (flags & protocol::envelope::checksum_flag) {
+                if (size < ENVELOPE_HEADER_SIZE + sizeof(std::uint32_t))
+                    throw error {errc::bad_content, tr::_("unexpected end of envelope")};
+
+                size -= sizeof(std::uint32_t);
+
+                std::uint32_t expected = 0;
+                istream_type tail {data + size, sizeof(std::uint32_t)};
+                tail >> expected;
+
+                if (crc32c(data, size) != expected)
+                    throw error {errc::bad_content, tr::_("envelope checksum mismatch")};
+            }
+
+            return size;
+        }
+
+    public:
+        /**
+         * Number of packets in the envelope.
+         */
+        std::size_t count () const noexcept
+        {
+            return _count;
+        }
+
+        /**
+         * Fetches next packet.
+         *
+         * @return @c false if there are no more packets.
+         *
+         * @throw chat::error{errc::bad_content} if envelope is truncated.
+         */
+        bool next (pfs::string_view & packet)
+        {
+            if (_remain == 0)
+                return false;
+
+            if (_in.available() < sizeof(std::uint32_t))
+                throw error {errc::bad_content, tr::_("unexpected end of envelope")};
+
+            std::uint32_t sz = 0;
+            _in >> sz;
+
+            if (sz > _in.available())
+                throw error {errc::bad_content, tr::_("unexpected end of envelope")};
+
+            packet = pfs::string_view{_in.begin(), sz};
+            _in.skip(sz);
+            _remain--;
+
+            return true;
+        }
+    };
+
+    static std::size_t packed_size (protocol::envelope const & env)
+    {
+        std::size_t result = ENVELOPE_HEADER_SIZE + (env.checksum ? sizeof(std::uint32_t) : 0);
+
+        for (auto const & pkt: env.packets)
+            result += sizeof(std::uint32_t) + pkt.size();
+
+        return result;
+    }
+
+    static std::size_t packed_size (protocol::contact_credentials const & pkt)
+    {
+        return TYPE_SIZE + 2 * ID_SIZE
+            + string_size(pkt.contact.alias)
+            + string_size(pkt.contact.avatar)
+            + string_size(pkt.contact.description)
+            + string_size(pkt.contact.extra)
+            + sizeof(pkt.contact.type)
+            + sizeof(pkt.formats);
+    }
+
+    static std::size_t packed_size (protocol::group_members const & pkt)
+    {
+        return TYPE_SIZE + ID_SIZE + SIZE_SIZE + pkt.members.size() * ID_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::regular_message const & pkt)
+    {
+        return TYPE_SIZE + 3 * ID_SIZE + TIME_SIZE + string_size(pkt.content);
+    }
+
+    static std::size_t packed_size (protocol::delivery_notification const &)
+    {
+        return TYPE_SIZE + 2 * ID_SIZE + TIME_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::read_notification const &)
+    {
+        return TYPE_SIZE + 2 * ID_SIZE + TIME_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::bulk_delivery_notification const & pkt)
+    {
+        return TYPE_SIZE + ID_SIZE + TIME_SIZE + SIZE_SIZE + pkt.message_ids.size() * ID_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::bulk_read_notification const & pkt)
+    {
+        return TYPE_SIZE + ID_SIZE + TIME_SIZE + SIZE_SIZE + pkt.message_ids.size() * ID_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::read_up_to_notification const &)
+    {
+        return TYPE_SIZE + 2 * ID_SIZE + TIME_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::file_request const &)
+    {
+        return TYPE_SIZE + ID_SIZE;
+    }
+
+    static std::size_t packed_size (protocol::file_error const &)
+    {
+        return TYPE_SIZE + ID_SIZE;
+    }
+
+private:
+    // Sizes of the serialized fields
+    static constexpr std::size_t TYPE_SIZE = sizeof(protocol::packet_enum);
+    static constexpr std::size_t ID_SIZE   = 16; // universal_id
+    static constexpr std::size_t TIME_SIZE = sizeof(std::int64_t); // time point (milliseconds)
+    static constexpr std::size_t SIZE_SIZE = sizeof(typename ostream_type::size_type);
+
+    // Packet type, version, flags and packets count
+    static constexpr std::size_t ENVELOPE_HEADER_SIZE = 3 + sizeof(std::uint32_t);
+
+    static std::size_t string_size (std::string const & s)
+    {
+        return SIZE_SIZE + s.size();
+    }
+
+    // String layout is the same as for `std::string`: size followed by characters
+    static void unpack_view (istream_type & in, pfs::string_view & target)
+    {
+        typename istream_type::size_type sz = 0;
+        in >> sz;
+
+        if (sz > in.available())
+            throw error {errc::bad_content, tr::_("unexpected end of packet")};
+
+        target = pfs::string_view{in.begin(), sz};
+        in.skip(sz);
+    }
+
+    static void pack_ids (ostream_type & out, std::vector<message::id> const & ids)
+    {
+        out << pfs::numeric_cast<typename ostream_type::size_type>(ids.size());
+
+        for (auto const & x: ids)
+            out << x;
+    }
+
+    static void unpack_ids (istream_type & in, std::vector<message::id> & ids)
+    {
+        typename ostream_type::size_type sz = 0;
+        in >> sz;
+
+        // Count is not trusted: avoid huge allocation for malformed packet
+        if (sz > in.available() / static_cast<std::size_t>(ID_SIZE))
+            throw error {errc::bad_content, tr::_("unexpected end of packet")};
+
+        if (sz > 0) {
+            ids.reserve(sz);
+            message::id x;
+
+            for (typename ostream_type::size_type i = 0; i < sz; i++) {
+                in >> x;
+                ids.push_back(x);
+            }
+        }
+    }
 };
 
+template <pfs::endian Endianess>
+constexpr protocol::packet_format primal_serializer<Endianess>::format;
+
 namespace message {
 
 template <typename Packet, pfs::endian Endianess>
@@ -5,12 +5,19 @@
 //
 // Changelog:
 //      2022.02.21 Initial version.
+//      2026.10.16 Added bulk delivery/read notifications.
+//                 Added `regular_message_view`.
+//                 Added multi-packet envelope.
+//                 Contact credentials announce supported packet formats.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
 #include "contact.hpp"
 #include "file.hpp"
 #include "message.hpp"
+#include <pfs/string_view.hpp>
+#include <cstdint>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -25,11 +32,38 @@ enum class packet_enum: std::int8_t {
     , read_notification     = 5
     , file_request          = 6
     , file_error            = 7
+    , bulk_delivery_notification = 8
+    , bulk_read_notification     = 9
+    , read_up_to_notification    = 10
+
+    , envelope = 0x7F // Several packets (see `envelope`)
+};
+
+/**
+ * Checks if packet of type @a type can be processed (packet types unknown to this version
+ * are skipped when received within envelope).
+ */
+inline bool is_known (packet_enum type) noexcept
+{
+    return type >= packet_enum::contact_credentials
+        && type <= packet_enum::read_up_to_notification;
+}
+
+// Packet format produced by serializer. Primal format is supported by any peer, optional
+// formats supported by peer are announced in its contact credentials (bitwise OR of
+// format values, see `contact_credentials::formats`).
+enum class packet_format: std::uint8_t {
+      primal  = 0
+    , compact = 1 << 0 // See `compact_serializer`
 };
 
 struct contact_credentials
 {
     contact::contact contact;
+
+    // Optional packet formats supported by the sender (see `packet_format`), zero if sender
+    // supports primal format only (e.g. sender of previous version)
+    std::uint8_t formats {0};
 };
 
 struct group_members
@@ -48,6 +82,17 @@ struct regular_message
     std::string content;
 };
 
+// Same as `regular_message` but content references the buffer the packet is decoded from,
+// so the packet is valid while the buffer is alive.
+struct regular_message_view
+{
+    message::id message_id;
+    contact::id author_id;
+    contact::id chat_id;
+    pfs::utc_time_point mod_time;
+    pfs::string_view content;
+};
+
 struct delivery_notification
 {
     message::id message_id;
@@ -62,6 +107,52 @@ struct read_notification
     pfs::utc_time_point read_time;
 };
 
+struct bulk_delivery_notification
+{
+    contact::id chat_id;
+    pfs::utc_time_point delivered_time;
+    std::vector<message::id> message_ids;
+};
+
+struct bulk_read_notification
+{
+    contact::id chat_id;
+    pfs::utc_time_point read_time;
+    std::vector<message::id> message_ids;
+};
+
+// All unread messages of the chat authored by notification receiver up to
+// `message_id` (inclusive, in creation order) are read.
+struct read_up_to_notification
+{
+    message::id message_id;
+    contact::id chat_id;
+    pfs::utc_time_point read_time;
+};
+
+// Envelope layout (see primal_serializer::envelope_decoder), numbers are in network byte order:
+//
+// +------+---------+-------+-------+--------+--------+-----+----------+
+// | 0x7F | version | flags | count | length | packet | ... | CRC32C   |
+// +------+---------+-------+-------+--------+--------+-----+----------+
+//    1        1        1       4       4     length          4
+//                                    \_______________/     (optional)
+//                                        count times
+//
+// CRC32C (present if flags has `envelope::checksum_flag`) is calculated over all preceding
+// bytes. Packets are serialized as is (by any serializer), so envelope can aggregate
+// packets of different formats.
+struct envelope
+{
+    static constexpr std::uint8_t version = 1;
+    static constexpr std::uint8_t checksum_flag = 1 << 0;
+
+    bool checksum {false};
+
+    // Serialized packets, referenced data must be alive while envelope is serialized
+    std::vector<pfs::string_view> packets;
+};
+
 struct file_request
 {
     file::id file_id;
@@ -5,15 +5,44 @@
 //
 // Changelog:
 //      2023.05.10 Initial version.
+//      2026.10.16 Added indexed search of messages.
+//                 Added parallel search of messages.
+//                 Added streaming search of messages.
+//                 Searchers use substring_matcher.
+//                 HTML content is searched by its plain text projection.
+//                 contacts_searcher can use contact trigram index.
+//                 Added ranking and top-K selection of search results.
+//                 Added message filter to searchers.
+//                 Added search session with result refinement.
+//                 Indexed search applies offset and limit to verified messages.
+//                 Parallel search does not create chats.
+//                 Streaming search continues from deleted cursor message.
+//                 Search session keeps identifiers of matched messages only.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
+#include "chat.hpp"
 #include "contact.hpp"
+#include "contact_trigram_index.hpp"
+#include "error.hpp"
 #include "message.hpp"
+#include "substring_matcher.hpp"
+#include <pfs/i18n.hpp>
 #include <pfs/numeric_cast.hpp>
+#include <pfs/time_point.hpp>
 #include <pfs/unicode/search.hpp>
-#include <pfs/unicode/utf8_iterator.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 CHAT__NAMESPACE_BEGIN
@@ -42,11 +71,107 @@ public:
     search_flags & operator = (search_flags && other) = default;
 };
 
+/**
+ * Weights of the search result ranking factors. Each factor is normalized to [0, 1],
+ * so the score of a hit is in range [0, sum of applicable weights].
+ */
+struct rank_weights
+{
+    // Messages: recency of the creation time (halved each `recency_half_life`)
+    double recency {1.0};
+    std::chrono::hours recency_half_life {24 * 7};
+
+    // Number of matches, saturated at `match_count_saturation` matches
+    double match_count {0.5};
+    std::size_t match_count_saturation {5};
+
+    // Field that matches: share of matches in the field
+    double alias_field {1.0};
+    double desc_field {0.5};
+    double text_field {0.5};
+    double attachment_field {0.25};
+
+    // Messages: number of messages in chat, saturated at `chat_activity_saturation` messages
+    double chat_activity {0.25};
+    std::size_t chat_activity_saturation {1000};
+};
+
+/**
+ * Keeps up to @c K items with the highest scores (bounded min-heap). Items with equal
+ * scores are preferred in the order of insertion.
+ */
+template <typename T>
+class top_k_selector
+{
+public:
+    struct item
+    {
+        double score;
+        std::size_t seq;
+        T value;
+    };
+
+private:
+    std::size_t _k {0};
+    std::size_t _seq {0};
+    std::vector<item> _heap; // The worst item on top
+
+private:
+    static bool better (item const & a, item const & b)
+    {
+        return a.score > b.score || (a.score == b.score && a.seq < b.seq);
+    }
+
+public:
+    explicit top_k_selector (std::size_t k) : _k(k)
+    {
+        _heap.reserve(k);
+    }
+
+    bool full () const noexcept
+    {
+        return _heap.size() >= _k;
+    }
+
+    /**
+     * Checks if item with @a score would be kept. Useful to skip preparing the item.
+     */
+    bool accepts (double score) const noexcept
+    {
+        return _k > 0 && (!full() || score > _heap.front().score);
+    }
+
+    void push (double score, T && value)
+    {
+        if (!accepts(score)) {
+            _seq++;
+            return;
+        }
+
+        if (full()) {
+            std::pop_heap(_heap.begin(), _heap.end(), better);
+            _heap.pop_back();
+        }
+
+        _heap.push_back(item{score, _seq++, std::move(value)});
+        std::push_heap(_heap.begin(), _heap.end(), better);
+    }
+
+    /**
+     * Extracts selected items ordered by score (the highest first).
+     */
+    std::vector<item> take ()
+    {
+        std::sort(_heap.begin(), _heap.end(), better);
+        std::vector<item> result;
+        result.swap(_heap);
+        return result;
+    }
+};
+
 template <typename ContactList>
 class contacts_searcher
 {
-    using utf8_iterator = pfs::unicode::utf8_iterator<std::string::const_iterator>;
-
 public:
     struct match_spec
     {
@@ -70,68 +195,157 @@ public:
 
 private:
     ContactList const * _pcl {nullptr};
+    contact_trigram_index const * _pindex {nullptr};
 
 public:
     contacts_searcher (ContactList const & cl) : _pcl(& cl) {}
 
+    /**
+     * Constructs searcher that selects candidate contacts using trigram @a index
+     * (it must be in sync with @a cl). Contact list is scanned only if the index
+     * can not be used for the pattern.
+     */
+    contacts_searcher (ContactList const & cl, contact_trigram_index const & index)
+        : _pcl(& cl), _pindex(& index)
+    {}
+
 private:
-    static void search_all_helper (std::string const & s, std::string const & pattern
-        , bool ignore_case, std::function<void(pfs::unicode::match_item const &)> && f)
+    static void search_contact (search_result & sr, substring_matcher const & matcher
+        , search_flags sf, contact::id contact_id, std::string const & alias
+        , std::string const & description)
     {
-        auto first = utf8_iterator::begin(s.begin(), s.end());
-        auto s_first = utf8_iterator::begin(pattern.begin(), pattern.end());
+        auto on_match = [& sr, contact_id] (search_flags::flag field, pfs::unicode::match_item const & m) {
+            sr.m.emplace_back(match_item{contact_id, field, m});
 
-        pfs::unicode::search_all(first, first.end(), s_first, s_first.end()
-            , ignore_case, std::move(f));
+            if (sr.sp.empty() || sr.sp.back().contact_id != contact_id) {
+                sr.sp.emplace_back(match_spec{contact_id, sr.m.size() - 1, 1});
+            } else {
+                sr.sp.back().count++;
+            }
+        };
+
+        if (sf.value & search_flags::alias_field) {
+            matcher.search_all(alias, [& on_match] (pfs::unicode::match_item const & m) {
+                on_match(search_flags::alias_field, m);
+            });
+        }
+
+        if (sf.value & search_flags::desc_field) {
+            matcher.search_all(description, [& on_match] (pfs::unicode::match_item const & m) {
+                on_match(search_flags::desc_field, m);
+            });
+        }
+    }
+
+    // Calls f for contacts (candidates if index is used) to search
+    template <typename F>
+    void visit (std::string const & pattern, search_flags sf, F && f) const
+    {
+        if (_pindex != nullptr) {
+            auto indexed = _pindex->for_each_candidate(pattern
+                , (sf.value & search_flags::ignore_case) != 0
+                , (sf.value & search_flags::alias_field) != 0
+                , (sf.value & search_flags::desc_field) != 0
+                , [& f] (contact_trigram_index::entry const & e) {
+                    f(e.contact_id, e.alias, e.description);
+                });
+
+            if (indexed)
+                return;
+        }
+
+        _pcl->for_each([& f] (contact::contact const & c) {
+            f(c.contact_id, c.alias, c.description);
+        });
     }
 
 public:
     /**
      * Searches contact list for specified @a pattern.
+     *
+     * @details If trigram index is used, contacts are reported in index order.
      */
     search_result search_all (std::string const & pattern
         , search_flags sf = search_flags::ignore_case | search_flags::alias_field) const
     {
         search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
 
-        _pcl->for_each([& sr, & pattern, sf] (contact::contact const & c) {
-            contact::contact const * pc = & c;
+        visit(pattern, sf, [& sr, & matcher, sf] (contact::id contact_id
+                , std::string const & alias, std::string const & description) {
+            search_contact(sr, matcher, sf, contact_id, alias, description);
+        });
 
-            if (sf.value & search_flags::alias_field) {
-                search_all_helper(c.alias, pattern, sf.value & search_flags::ignore_case
-                    , [& sr, pc] (pfs::unicode::match_item const & m) {
-                        sr.m.emplace_back(match_item{pc->contact_id, search_flags::alias_field, m});
+        return sr;
+    }
 
-                        if (sr.sp.empty() || sr.sp.back().contact_id != pc->contact_id) {
-                            sr.sp.emplace_back(match_spec{pc->contact_id, sr.m.size() - 1, 1});
-                        } else {
-                            sr.sp.back().count++;
-                        }
-                    });
-            }
+    struct ranked_contact
+    {
+        double score;
+        contact::id contact_id;
+        std::vector<match_item> m;
+    };
 
-            if (sf.value & search_flags::desc_field) {
-                search_all_helper(c.description, pattern, sf.value & search_flags::ignore_case
-                    , [& sr, pc] (pfs::unicode::match_item const & m) {
-                        sr.m.emplace_back(match_item{pc->contact_id, search_flags::desc_field, m});
+    /**
+     * Scores contact by number of matches @a m (must be non-empty) and matched field
+     * (see rank_weights).
+     */
+    static double score (std::vector<match_item> const & m, rank_weights const & w)
+    {
+        std::size_t alias_matches = 0;
 
-                        if (sr.sp.empty() || sr.sp.back().contact_id != pc->contact_id) {
-                            sr.sp.emplace_back(match_spec{pc->contact_id, sr.m.size() - 1, 1});
-                        } else {
-                            sr.sp.back().count++;
-                        }
-                    });
-            }
-        });
+        for (auto const & x: m) {
+            if (x.field == search_flags::alias_field)
+                alias_matches++;
+        }
 
-        return sr;
+        auto saturation = (std::max)(w.match_count_saturation, std::size_t{1});
+        auto matches = static_cast<double>((std::min)(m.size(), saturation)) / saturation;
+        auto alias_share = static_cast<double>(alias_matches) / m.size();
+
+        return w.match_count * matches
+            + w.alias_field * alias_share
+            + w.desc_field * (1.0 - alias_share);
+    }
+
+    /**
+     * Searches contact list for specified @a pattern and returns up to @a k best matched
+     * contacts ordered by score (see score()). Memory usage is bounded by @a k.
+     */
+    std::vector<ranked_contact> search_top (std::string const & pattern, std::size_t k
+        , search_flags sf = search_flags::ignore_case | search_flags::alias_field
+        , rank_weights const & w = rank_weights{}) const
+    {
+        top_k_selector<ranked_contact> top {k};
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+
+        if (k > 0) {
+            visit(pattern, sf, [& top, & matcher, sf, & w] (contact::id contact_id
+                    , std::string const & alias, std::string const & description) {
+                search_result sr;
+                search_contact(sr, matcher, sf, contact_id, alias, description);
+
+                if (sr.m.empty())
+                    return;
+
+                auto s = score(sr.m, w);
+
+                if (top.accepts(s))
+                    top.push(s, ranked_contact{s, contact_id, std::move(sr.m)});
+            });
+        }
+
+        std::vector<ranked_contact> result;
+
+        for (auto & x: top.take())
+            result.push_back(std::move(x.value));
+
+        return result;
     }
 };
 
 class message_searcher
 {
-    using utf8_iterator = pfs::unicode::utf8_iterator<std::string::const_iterator>;
-
 public:
     struct match_item
     {
@@ -156,9 +370,8 @@ public:
     {}
 
 private:
-    void search_helper (search_result & sr, std::string const & pattern
-        , bool first_match_only
-        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+    void search_helper (search_result & sr, substring_matcher const & matcher
+        , bool first_match_only, search_flags sf) const
     {
         if (_pmc->contents) {
             for (int i = 0, count = pfs::numeric_cast<int>(_pmc->contents->count()); i < count; i++) {
@@ -171,78 +384,136 @@ private:
                     ? (sf.value & search_flags::text_content)
                     : (sf.value & search_flags::attachment_name);
 
-                auto first = utf8_iterator::begin(cc.text.begin(), cc.text.end());
-                auto s_first = utf8_iterator::begin(pattern.begin(), pattern.end());
-
-                if (content_search_requested) {
-                    if (cc.mime == mime::mime_enum::text__html) {
-                        if (first_match_only) {
-                            auto m = pfs::unicode::search_first(first, first.end(), s_first, s_first.end()
-                                , sf.value & search_flags::ignore_case, '<', '>');
-
-                            if (m.cp_first >= 0) {
-                                sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, m});
-                                break;
-                            };
-                        } else {
-                            pfs::unicode::search_all(first, first.end(), s_first, s_first.end()
-                                , sf.value & search_flags::ignore_case, '<', '>'
-                                , [this, & sr, i] (pfs::unicode::match_item const & m) {
-                                    sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, m});
-                                });
-                        }
-                    } else {
-                        if (first_match_only) {
-                            auto m = pfs::unicode::search_first(first, first.end(), s_first, s_first.end()
-                                , sf.value & search_flags::ignore_case);
-
-                            if (m.cp_first >= 0) {
-                                sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, m});
-                                break;
-                            }
-                        } else {
-                            pfs::unicode::search_all(first, first.end(), s_first, s_first.end()
-                                , sf.value & search_flags::ignore_case
-                                , [this, & sr, i] (pfs::unicode::match_item const & m) {
-                                    sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, m});
-                                });
-                        }
+                if (!content_search_requested)
+                    continue;
+
+                // HTML tags are not searched: plain text projection is searched and matches
+                // are mapped back to the positions in the source text.
+                bool is_html = cc.mime == mime::mime_enum::text__html;
+                auto const * contents = & *_pmc->contents;
+                auto const & text = is_html ? contents->plain_text(i) : cc.text;
+
+                auto to_source = [contents, is_html, i] (pfs::unicode::match_item m) {
+                    if (is_html) {
+                        auto first = contents->source_position(i, m.cu_first, m.cp_first);
+                        auto last = contents->source_position(i, m.cu_last - 1, m.cp_last - 1);
+
+                        m.cu_first = static_cast<decltype(m.cu_first)>(first.first);
+                        m.cp_first = static_cast<decltype(m.cp_first)>(first.second);
+                        m.cu_last  = static_cast<decltype(m.cu_last)>(last.first + 1);
+                        m.cp_last  = static_cast<decltype(m.cp_last)>(last.second + 1);
                     }
+
+                    return m;
+                };
+
+                if (first_match_only) {
+                    auto m = matcher.search_first(text);
+
+                    if (m.cp_first >= 0) {
+                        sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, to_source(m)});
+                        break;
+                    }
+                } else {
+                    matcher.search_all(text, [this, & sr, & to_source, i] (pfs::unicode::match_item const & m) {
+                        sr.m.emplace_back(match_item{_contact_id, _pmc->message_id, i, to_source(m)});
+                    });
                 }
             }
         }
     }
 
+    static substring_matcher make_matcher (std::string const & pattern, search_flags sf)
+    {
+        return substring_matcher{pattern, (sf.value & search_flags::ignore_case) != 0};
+    }
+
 public:
+    /**
+     * Searches message contents using prepared @a matcher (case sensitivity is specified by
+     * the matcher). Useful to search many messages for the same pattern.
+     */
+    void search_all (search_result & sr, substring_matcher const & matcher
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+    {
+        search_helper(sr, matcher, false, sf);
+    }
+
+    void search_first (search_result & sr, substring_matcher const & matcher
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+    {
+        search_helper(sr, matcher, true, sf);
+    }
+
     void search_all (search_result & sr, std::string const & pattern
         , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
     {
-        search_helper(sr, pattern, false, sf);
+        search_helper(sr, make_matcher(pattern, sf), false, sf);
     }
 
     search_result search_all (std::string const & pattern
         , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
     {
         search_result sr;
-        search_helper(sr, pattern, false, sf);
+        search_helper(sr, make_matcher(pattern, sf), false, sf);
         return sr;
     }
 
     void search_first (search_result & sr, std::string const & pattern
         , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
     {
-        search_helper(sr, pattern, true, sf);
+        search_helper(sr, make_matcher(pattern, sf), true, sf);
     }
 
     search_result search_first (std::string const & pattern
         , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
     {
         search_result sr;
-        search_helper(sr, pattern, true, sf);
+        search_helper(sr, make_matcher(pattern, sf), true, sf);
         return sr;
     }
 };
 
+/**
+ * Receives matches of a single message. Returns @c false to stop the search.
+ */
+using search_stream_callback = std::function<bool (message_searcher::search_result &&)>;
+
+struct search_stream_options
+{
+    // Search is stopped as soon as possible if the flag is set (e.g. pattern is changed)
+    std::atomic<bool> const * stop {nullptr};
+
+    // Maximum number of matched messages passed to callback, negative value means no limit
+    int max_results {-1};
+
+    // Only the first message content that matches the pattern matters
+    bool first_match_only {false};
+
+    // Only messages matching the filter are searched
+    message_filter filter;
+};
+
+/**
+ * Position of the streaming search. Search can be continued from the cursor returned
+ * by previous (stopped) search.
+ */
+struct search_cursor
+{
+    // Chat to continue search from, nil value means the first chat
+    contact::id chat_id;
+
+    // Last processed message in chat, nil value means the chat is not processed yet
+    message::id message_id;
+
+    // Creation time of the last processed message, search is continued from this time
+    // if the message is deleted
+    pfs::utc_time_point creation_time;
+
+    // All messages are processed
+    bool at_end {false};
+};
+
 template <typename Chat>
 class chat_searcher
 {
@@ -266,47 +537,127 @@ public:
 
 public:
     /**
-     * Searches all contents of all conversion messages for specified @a pattern.
+     * Searches all contents of all conversion messages (matching @a filter) for specified @a pattern.
      */
     search_result search_all (std::string const & pattern
-        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{}) const
     {
         search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
         sr.total_found = 0;
 
-        _pcv->for_each([this, & sr, & pattern, sf] (message::message_credentials const & mc) {
+        _pcv->for_each([this, & sr, & matcher, sf] (message::message_credentials const & mc) {
             message_searcher::search_result msr;
-            message_searcher{_pcv->id(), mc}.search_all(msr, pattern, sf);
+            message_searcher{_pcv->id(), mc}.search_all(msr, matcher, sf);
 
             if (!msr.m.empty()) {
                 sr.total_found += msr.m.size();
                 sr.m.push_back(std::move(msr));
                 sr.indices.emplace(mc.message_id, sr.m.size() - 1);
             }
-        });
+        }, filter, sort, -1);
 
         return sr;
     }
 
     search_result search_first (std::string const & pattern
-        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{}) const
     {
         search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
         sr.total_found = 0;
 
-        _pcv->for_each([this, & sr, & pattern, sf] (message::message_credentials const & mc) {
+        _pcv->for_each([this, & sr, & matcher, sf] (message::message_credentials const & mc) {
             message_searcher::search_result msr;
-            message_searcher{_pcv->id(), mc}.search_first(msr, pattern, sf);
+            message_searcher{_pcv->id(), mc}.search_first(msr, matcher, sf);
 
             if (!msr.m.empty()) {
                 sr.total_found += msr.m.size();
                 sr.m.push_back(std::move(msr));
                 sr.indices.emplace(mc.message_id, sr.m.size() - 1);
             }
-        });
+        }, filter, sort, -1);
 
         return sr;
     }
+
+    /**
+     * Searches chat messages following the cursor message @a after (nil message identifier
+     * means from the first message) for specified @a pattern in creation time order. Matches
+     * are passed to @a f as soon as message is processed, nothing is accumulated.
+     *
+     * @details If the cursor message is deleted the search continues from the messages created
+     *          at the same time or later, so messages created at the same time as the deleted
+     *          one may be passed to @a f again.
+     *
+     * @return Cursor pointing to the last processed message, `at_end` is @c false if search
+     *         stopped by @a f, stop flag or results limit (see search_stream_options).
+     */
+    search_cursor search_stream (std::string const & pattern, search_stream_callback f
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , search_stream_options const & opts = search_stream_options{}
+        , search_cursor const & after = search_cursor{}) const
+    {
+        // Messages are fetched by pages to check stop conditions
+        static constexpr int PAGE_SIZE = 256;
+
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        search_cursor cursor {_pcv->id(), after.message_id, after.creation_time, false};
+        auto filter = opts.filter;
+        int found = 0;
+        bool stopped = false;
+        int count = PAGE_SIZE;
+
+        // Anchor does not exist, continue by creation time
+        if (cursor.message_id != message::id{} && !_pcv->message(cursor.message_id, message_projection::headers)) {
+            cursor.message_id = message::id{};
+
+            if (!filter.since || *filter.since < after.creation_time)
+                filter.since = after.creation_time;
+        }
+
+        while (!stopped && count == PAGE_SIZE) {
+            count = 0;
+
+            _pcv->for_each_after(cursor.message_id, [&] (message::message_credentials const & mc) {
+                if (stopped)
+                    return;
+
+                if ((opts.stop != nullptr && opts.stop->load(std::memory_order_relaxed))
+                        || (opts.max_results >= 0 && found >= opts.max_results)) {
+                    stopped = true;
+                    return;
+                }
+
+                count++;
+
+                message_searcher::search_result msr;
+
+                if (opts.first_match_only)
+                    message_searcher{_pcv->id(), mc}.search_first(msr, matcher, sf);
+                else
+                    message_searcher{_pcv->id(), mc}.search_all(msr, matcher, sf);
+
+                cursor.message_id = mc.message_id;
+                cursor.creation_time = mc.creation_time;
+
+                if (!msr.m.empty()) {
+                    found++;
+
+                    if (!f(std::move(msr)))
+                        stopped = true;
+                }
+            }, filter, sort, PAGE_SIZE);
+        }
+
+        cursor.at_end = !stopped;
+        return cursor;
+    }
 };
 
 template <typename MessageStore, typename ContactList>
@@ -319,6 +670,32 @@ public:
     using match_item    = message_searcher::match_item;
     using search_result = message_searcher::search_result;
 
+    /**
+     * Creates message store instance used by a parallel search worker. Each worker must have
+     * its own instance with its own connection to the same database (WAL journal mode is
+     * recommended, so readers do not block the writer). Returned pointer owns the instance
+     * and its connection.
+     */
+    using message_store_factory = std::function<std::shared_ptr<MessageStore const> ()>;
+
+    struct parallel_options
+    {
+        // Number of worker threads, 0 means std::thread::hardware_concurrency()
+        std::size_t thread_count {0};
+
+        // Maximum number of matched messages, negative value means no limit
+        int limit {-1};
+
+        // Search is stopped as soon as possible if the flag is set (result is incomplete)
+        std::atomic<bool> const * cancelled {nullptr};
+
+        // Only the first message content that matches the pattern matters (see search_first())
+        bool first_match_only {false};
+
+        // Only messages matching the filter are searched
+        message_filter filter;
+    };
+
 private:
     MessageStore const * _pms {nullptr};
     ContactList const *  _pcl {nullptr};
@@ -331,22 +708,25 @@ public:
 
 public:
     /**
-     * Searches all messages for specified @a pattern.
+     * Searches all messages (matching @a filter) for specified @a pattern.
      */
     search_result search_all (std::string const & pattern
-        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{}) const
     {
         search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
 
-        _pcl->for_each([this, & sr, & pattern, sf] (contact::contact const & c) {
-            auto cv = _pms->conversation(c.contact_id);
+        _pcl->for_each([this, & sr, & matcher, sf, & filter, sort] (contact::contact const & c) {
+            auto cv = _pms->open_chat(c.contact_id);
 
             if (!cv)
                 return;
 
-            cv.for_each([& sr, & c, & pattern, sf] (message::message_credentials const & mc) {
-                message_searcher{c.contact_id, mc}.search_all(sr, pattern, sf);
-            });
+            cv.for_each([& sr, & c, & matcher, sf] (message::message_credentials const & mc) {
+                message_searcher{c.contact_id, mc}.search_all(sr, matcher, sf);
+            }, filter, sort, -1);
         });
 
         return sr;
@@ -357,23 +737,709 @@ public:
      * Only the first message content that matches the @a pattern matters.
      */
     search_result search_first (std::string const & pattern
-        , search_flags sf = search_flags::ignore_case | search_flags::text_content) const
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{}) const
     {
         search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
+
+        _pcl->for_each([this, & sr, & matcher, sf, & filter, sort] (contact::contact const & c) {
+            auto cv = _pms->open_chat(c.contact_id);
+
+            if (!cv)
+                return;
+
+            cv.for_each([& sr, & c, & matcher, sf] (message::message_credentials const & mc) {
+                message_searcher{c.contact_id, mc}.search_first(sr, matcher, sf);
+            }, filter, sort, -1);
+        });
+
+        return sr;
+    }
+
+    /**
+     * Searches messages of chats in contact list order (see chat_searcher::search_stream())
+     * starting from @a cursor. Matches are passed to @a f as soon as message is processed.
+     *
+     * @details Chats without messages storage are skipped, deleted cursor message is handled
+     *          as described for chat_searcher::search_stream().
+     *
+     * @return Cursor to continue the search from, `at_end` is @c true if all messages
+     *         are processed.
+     *
+     * @throw chat::error{errc::chat_not_found} if cursor chat is not in the contact list.
+     */
+    search_cursor search_stream (std::string const & pattern, search_stream_callback f
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , search_stream_options const & opts = search_stream_options{}
+        , search_cursor const & cursor = search_cursor{}) const
+    {
+        search_cursor result;
+        result.at_end = true;
+
+        if (cursor.at_end)
+            return result;
+
+        bool skip = cursor.chat_id != contact::id{};
+        bool done = false;
+        int remaining = opts.max_results;
+
+        _pcl->for_each([&] (contact::contact const & c) {
+            if (done)
+                return;
 
-        _pcl->for_each([this, & sr, & pattern, sf] (contact::contact const & c) {
-            auto cv = _pms->conversation(c.contact_id);
+            search_cursor after;
+
+            if (skip) {
+                if (c.contact_id != cursor.chat_id)
+                    return;
+
+                skip = false;
+                after = cursor;
+            }
+
+            auto cv = _pms->find_chat(c.contact_id);
 
             if (!cv)
                 return;
 
-            cv.for_each([& sr, & c, & pattern, sf] (message::message_credentials const & mc) {
-                message_searcher{c.contact_id, mc}.search_first(sr, pattern, sf);
+            auto chat_opts = opts;
+            chat_opts.max_results = remaining;
+            int matched = 0;
+
+            auto r = chat_searcher_type{cv}.search_stream(pattern
+                , [& f, & matched] (message_searcher::search_result && msr) {
+                    matched++;
+                    return f(std::move(msr));
+                }, sf, chat_opts, after);
+
+            if (remaining > 0)
+                remaining -= matched;
+
+            if (!r.at_end) {
+                result = r;
+                done = true;
+            }
+        });
+
+        if (skip)
+            throw error {errc::chat_not_found, tr::_("search cursor refers to unknown chat")};
+
+        return result;
+    }
+
+    struct ranked_message
+    {
+        double score;
+        search_result result; // Matches of the message
+    };
+
+    /**
+     * Recency factor of the message created at @a creation_time (see rank_weights).
+     */
+    static double recency (pfs::utc_time_point creation_time, pfs::utc_time_point now
+        , rank_weights const & w)
+    {
+        auto age = static_cast<double>((now.to_millis() - creation_time.to_millis()).count());
+        auto half_life = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(w.recency_half_life).count());
+
+        if (age <= 0 || half_life <= 0)
+            return 1.0;
+
+        return std::pow(0.5, age / half_life);
+    }
+
+    /**
+     * Activity factor of the chat containing @a message_count messages (see rank_weights).
+     */
+    static double activity (std::size_t message_count, rank_weights const & w)
+    {
+        auto saturation = (std::max)(w.chat_activity_saturation, std::size_t{1});
+        return static_cast<double>((std::min)(message_count, saturation)) / saturation;
+    }
+
+    /**
+     * Scores message @a mc with matches @a msr (must be non-empty) by recency, number of
+     * matches, matched field and activity of the chat (see rank_weights).
+     */
+    static double score (message::message_credentials const & mc, search_result const & msr
+        , std::size_t chat_message_count, pfs::utc_time_point now, rank_weights const & w)
+    {
+        std::size_t text_matches = 0;
+
+        for (auto const & x: msr.m) {
+            auto mime = mc.contents->at(x.content_index).mime;
+
+            if (mime == mime::mime_enum::text__plain || mime == mime::mime_enum::text__html)
+                text_matches++;
+        }
+
+        auto saturation = (std::max)(w.match_count_saturation, std::size_t{1});
+        auto matches = static_cast<double>((std::min)(msr.m.size(), saturation)) / saturation;
+        auto text_share = static_cast<double>(text_matches) / msr.m.size();
+
+        return w.recency * recency(mc.creation_time, now, w)
+            + w.match_count * matches
+            + w.text_field * text_share
+            + w.attachment_field * (1.0 - text_share)
+            + w.chat_activity * activity(chat_message_count, w);
+    }
+
+    /**
+     * Searches all messages for specified @a pattern and returns up to @a k best matched
+     * messages ordered by score (see score()). Memory usage is bounded by @a k.
+     *
+     * @details Messages of each chat are scanned from the newest one. Scanning of the chat
+     *          stops as soon as older messages can not get into the selection even with
+     *          the maximum score for the other factors.
+     */
+    std::vector<ranked_message> search_top (std::string const & pattern, std::size_t k
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{}
+        , rank_weights const & w = rank_weights{}
+        , pfs::utc_time_point now = pfs::current_utc_time_point()) const
+    {
+        // Messages are fetched by pages to stop early
+        static constexpr int PAGE_SIZE = 256;
+
+        top_k_selector<ranked_message> top {k};
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+        auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::descending_order);
+
+        // Maximum score except recency and chat activity
+        auto max_rest = w.match_count + (std::max)(w.text_field, w.attachment_field);
+
+        if (k > 0) {
+            _pcl->for_each([&] (contact::contact const & c) {
+                auto cv = _pms->find_chat(c.contact_id);
+
+                if (!cv)
+                    return;
+
+                auto chat_message_count = cv.count();
+                auto activity_score = w.chat_activity * activity(chat_message_count, w);
+                message::id anchor;
+                bool stopped = false;
+                int count = PAGE_SIZE;
+
+                while (!stopped && count == PAGE_SIZE) {
+                    count = 0;
+
+                    cv.for_each_after(anchor, [&] (message::message_credentials const & mc) {
+                        if (stopped)
+                            return;
+
+                        count++;
+                        anchor = mc.message_id;
+
+                        auto upper_bound = w.recency * recency(mc.creation_time, now, w)
+                            + max_rest + activity_score;
+
+                        if (!top.accepts(upper_bound)) {
+                            stopped = true;
+                            return;
+                        }
+
+                        search_result msr;
+                        message_searcher{c.contact_id, mc}.search_all(msr, matcher, sf);
+
+                        if (msr.m.empty())
+                            return;
+
+                        auto s = score(mc, msr, chat_message_count, now, w);
+
+                        if (top.accepts(s))
+                            top.push(s, ranked_message{s, std::move(msr)});
+                    }, filter, sort, PAGE_SIZE);
+                }
             });
+        }
+
+        std::vector<ranked_message> result;
+
+        for (auto & x: top.take())
+            result.push_back(std::move(x.value));
+
+        return result;
+    }
+
+    /**
+     * Searches messages for specified @a pattern using full-text index of the message store.
+     * Index candidates are verified by message_searcher, so found messages are the same as
+     * for search_all(). Messages are ordered by relevance, up to @a limit (negative value means
+     * no limit) found messages are returned starting from @a offset.
+     *
+     * @details If full-text index is not available or @a pattern is too short for it
+     *          (see message_store::indexable()) the messages are scanned (ordered by chats
+     *          and creation time).
+     */
+    search_result search_indexed (std::string const & pattern
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , int offset = 0, int limit = -1) const
+    {
+        search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+
+        int skip = offset;
+
+        if (!_pms->indexable(pattern)) {
+
+            _pcl->for_each([this, & sr, & matcher, sf, & skip, & limit] (contact::contact const & c) {
+                if (limit == 0)
+                    return;
+
+                auto cv = _pms->find_chat(c.contact_id);
+
+                if (!cv)
+                    return;
+
+                cv.for_each([& sr, & c, & matcher, sf, & skip, & limit] (message::message_credentials const & mc) {
+                    if (limit == 0)
+                        return;
+
+                    message_searcher::search_result msr;
+                    message_searcher{c.contact_id, mc}.search_all(msr, matcher, sf);
+
+                    if (msr.m.empty())
+                        return;
+
+                    if (skip > 0) {
+                        skip--;
+                        return;
+                    }
+
+                    sr.m.insert(sr.m.end(), msr.m.begin(), msr.m.end());
+
+                    if (limit > 0)
+                        limit--;
+                });
+            });
+
+            return sr;
+        }
+
+        // Index candidates may be rejected by verification (e.g. case sensitive search), so
+        // offset and limit are applied to verified messages while paging through candidates.
+        static constexpr int PAGE_SIZE = 256;
+        int page_offset = 0;
+
+        while (limit != 0) {
+            auto hits = _pms->search_index(pattern, sf, page_offset, PAGE_SIZE);
+
+            for (auto const & hit: hits) {
+                if (limit == 0)
+                    break;
+
+                auto cv = _pms->find_chat(hit.first);
+
+                if (!cv)
+                    continue;
+
+                auto mc = cv.message(hit.second);
+
+                if (!mc)
+                    continue;
+
+                message_searcher::search_result msr;
+                message_searcher{hit.first, *mc}.search_all(msr, matcher, sf);
+
+                if (msr.m.empty())
+                    continue;
+
+                if (skip > 0) {
+                    skip--;
+                    continue;
+                }
+
+                sr.m.insert(sr.m.end(), msr.m.begin(), msr.m.end());
+
+                if (limit > 0)
+                    limit--;
+            }
+
+            if (hits.size() < static_cast<std::size_t>(PAGE_SIZE))
+                break;
+
+            page_offset += PAGE_SIZE;
+        }
+
+        return sr;
+    }
+
+    /**
+     * Searches all messages for specified @a pattern splitting chats across worker threads.
+     * Each worker uses its own message store created by @a factory. Results are the same
+     * as for search_all() (or search_first()): chats are ordered as in contact list, messages
+     * in chat are ordered by creation time, regardless of threads number.
+     *
+     * @throw chat::error or any other exception thrown by a worker.
+     */
+    search_result search_parallel (std::string const & pattern, message_store_factory factory
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , parallel_options const & opts = parallel_options{}) const
+    {
+        // Messages are fetched by pages to check cancellation and limit
+        static constexpr int PAGE_SIZE = 256;
+
+        std::vector<contact::id> chat_ids;
+
+        _pcl->for_each([& chat_ids] (contact::contact const & c) {
+            chat_ids.push_back(c.contact_id);
         });
 
+        search_result sr;
+        substring_matcher matcher {pattern, (sf.value & search_flags::ignore_case) != 0};
+
+        if (chat_ids.empty() || opts.limit == 0)
+            return sr;
+
+        auto cancelled = [& opts] {
+            return opts.cancelled != nullptr && opts.cancelled->load(std::memory_order_relaxed);
+        };
+
+        std::vector<search_result> chat_results(chat_ids.size());
+        std::vector<int> chat_found(chat_ids.size(), -1); // -1 - chat is not processed yet
+        std::size_t next_chat = 0;
+        std::size_t completed = 0; // Number of processed chats at the beginning of list
+        int completed_found = 0;   // Number of matched messages in these chats
+        std::exception_ptr failure;
+        std::mutex mtx;
+
+        auto worker = [&] {
+            try {
+                auto pms = factory();
+
+                if (!pms || !*pms) {
+                    throw error {errc::storage_error
+                        , tr::_("message store is not available for search worker")};
+                }
+
+                auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
+
+                while (!cancelled()) {
+                    std::size_t index = 0;
+
+                    {
+                        std::lock_guard<std::mutex> locker{mtx};
+
+                        // Chats are taken in order, so messages found in the processed
+                        // chats at the beginning of list are enough.
+                        if (failure || next_chat == chat_ids.size()
+                                || (opts.limit > 0 && completed_found >= opts.limit)) {
+                            break;
+                        }
+
+                        index = next_chat++;
+                    }
+
+                    auto chat_id = chat_ids[index];
+                    auto & csr = chat_results[index];
+                    // Workers must not create (or upgrade) chat tables concurrently
+                    auto cv = pms->find_chat(chat_id);
+                    int found = 0;
+
+                    if (cv) {
+                        message::id anchor_id;
+                        int count = PAGE_SIZE;
+
+                        while (count == PAGE_SIZE && !cancelled()
+                                && (opts.limit < 0 || found < opts.limit)) {
+                            count = 0;
+
+                            cv.for_each_after(anchor_id, [&] (message::message_credentials const & mc) {
+                                count++;
+                                anchor_id = mc.message_id;
+
+                                if (opts.limit >= 0 && found >= opts.limit)
+                                    return;
+
+                                auto size = csr.m.size();
+
+                                if (opts.first_match_only)
+                                    message_searcher{chat_id, mc}.search_first(csr, matcher, sf);
+                                else
+                                    message_searcher{chat_id, mc}.search_all(csr, matcher, sf);
+
+                                if (csr.m.size() > size)
+                                    found++;
+                            }, opts.filter, sort, PAGE_SIZE);
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> locker{mtx};
+                    chat_found[index] = found;
+
+                    while (completed < chat_found.size() && chat_found[completed] >= 0)
+                        completed_found += chat_found[completed++];
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> locker{mtx};
+
+                if (!failure)
+                    failure = std::current_exception();
+            }
+        };
+
+        auto thread_count = opts.thread_count > 0
+            ? opts.thread_count
+            : static_cast<std::size_t>(std::thread::hardware_concurrency());
+
+        thread_count = (std::max)(std::size_t{1}, (std::min)(thread_count, chat_ids.size()));
+
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count);
+
+        try {
+            for (std::size_t i = 0; i < thread_count; i++)
+                threads.emplace_back(worker);
+        } catch (...) {
+            // Thread creation failure: stop and join already started workers
+            {
+                std::lock_guard<std::mutex> locker{mtx};
+                next_chat = chat_ids.size();
+            }
+
+            for (auto & t: threads)
+                t.join();
+
+            throw;
+        }
+
+        for (auto & t: threads)
+            t.join();
+
+        if (failure)
+            std::rethrow_exception(failure);
+
+        // Merge in chats order
+        int messages_count = 0;
+
+        for (auto & csr: chat_results) {
+            for (auto & m: csr.m) {
+                if (sr.m.empty() || sr.m.back().message_id != m.message_id) {
+                    if (opts.limit >= 0 && messages_count == opts.limit)
+                        return sr;
+
+                    messages_count++;
+                }
+
+                sr.m.push_back(std::move(m));
+            }
+        }
+
         return sr;
     }
 };
 
+/**
+ * Stateful search of messages for search-as-you-type. If the new pattern contains the
+ * previous one, only the messages matched by the previous pattern are re-checked (session
+ * keeps their identifiers and fetches them again), otherwise the search scope is scanned again.
+ *
+ * @note Session does not track new messages, reset() must be called (or new session created)
+ *       when messages are added.
+ */
+class search_session
+{
+public:
+    using message_visitor = std::function<void (contact::id /*chat_id*/
+        , message::message_credentials const &)>;
+
+    /**
+     * Passes all messages of the search scope to the visitor.
+     */
+    using scanner = std::function<void (message_visitor)>;
+
+    /**
+     * Fetches message by chat and message identifiers, returns nothing if message is deleted.
+     */
+    using fetcher = std::function<pfs::optional<message::message_credentials> (contact::id /*chat_id*/
+        , message::id /*message_id*/)>;
+
+private:
+    struct hit
+    {
+        contact::id chat_id;
+        message::id message_id;
+    };
+
+private:
+    scanner _scan;
+    fetcher _fetch;
+    search_flags _sf;
+    std::string _pattern;
+    std::vector<hit> _hits;
+    message_searcher::search_result _result;
+    bool _refined {false};
+
+public:
+    search_session (scanner scan, fetcher fetch
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content)
+        : _scan(std::move(scan))
+        , _fetch(std::move(fetch))
+        , _sf(sf)
+    {}
+
+    /**
+     * Creates session searching messages of chat @a cv matching @a filter.
+     * Chat must outlive the session.
+     */
+    template <typename Chat>
+    static search_session for_chat (Chat const & cv
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{})
+    {
+        auto pcv = & cv;
+
+        return search_session{[pcv, filter] (message_visitor f) {
+            auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
+
+            pcv->for_each([pcv, & f] (message::message_credentials const & mc) {
+                f(pcv->id(), mc);
+            }, filter, sort, -1);
+        }, [pcv] (contact::id, message::id message_id) {
+            return pcv->message(message_id);
+        }, sf};
+    }
+
+    /**
+     * Creates session searching messages of all chats of contact list @a cl (in contact
+     * list order) matching @a filter. Message store and contact list must outlive the session.
+     */
+    template <typename MessageStore, typename ContactList>
+    static search_session for_message_store (MessageStore const & ms, ContactList const & cl
+        , search_flags sf = search_flags::ignore_case | search_flags::text_content
+        , message_filter const & filter = message_filter{})
+    {
+        auto pms = & ms;
+        auto pcl = & cl;
+
+        return search_session{[pms, pcl, filter] (message_visitor f) {
+            auto sort = sort_flags(chat_sort_flag::by_creation_time, chat_sort_flag::ascending_order);
+
+            pcl->for_each([pms, & f, & filter, sort] (contact::contact const & c) {
+                auto cv = pms->find_chat(c.contact_id);
+
+                if (!cv)
+                    return;
+
+                cv.for_each([& f, & c] (message::message_credentials const & mc) {
+                    f(c.contact_id, mc);
+                }, filter, sort, -1);
+            });
+        }, [pms] (contact::id chat_id, message::id message_id) {
+            auto cv = pms->find_chat(chat_id);
+            return cv ? cv.message(message_id) : pfs::optional<message::message_credentials>{};
+        }, sf};
+    }
+
+private:
+    static std::string fold (std::string s)
+    {
+        for (auto & ch: s) {
+            if (ch >= 'A' && ch <= 'Z')
+                ch = static_cast<char>(ch - 'A' + 'a');
+        }
+
+        return s;
+    }
+
+    // Any text matching the new pattern matches the previous one too
+    bool extends (std::string const & pattern) const
+    {
+        if (_pattern.empty())
+            return false;
+
+        if (_sf.value & search_flags::ignore_case)
+            return fold(pattern).find(fold(_pattern)) != std::string::npos;
+
+        return pattern.find(_pattern) != std::string::npos;
+    }
+
+public:
+    /**
+     * Searches messages for @a pattern refining the previous result if possible.
+     *
+     * @return Matches ordered as by message_store_searcher::search_all()
+     *         (or chat_searcher::search_all()).
+     */
+    message_searcher::search_result const & update (std::string const & pattern)
+    {
+        if (pattern == _pattern)
+            return _result;
+
+        substring_matcher matcher {pattern, (_sf.value & search_flags::ignore_case) != 0};
+        std::vector<hit> hits;
+        message_searcher::search_result result;
+
+        auto check = [this, & matcher, & hits, & result] (contact::id chat_id
+                , message::message_credentials const & mc) {
+            auto size = result.m.size();
+            message_searcher{chat_id, mc}.search_all(result, matcher, _sf);
+
+            if (result.m.size() > size)
+                hits.push_back(hit{chat_id, mc.message_id});
+        };
+
+        _refined = extends(pattern);
+
+        if (_refined) {
+            for (auto const & h: _hits) {
+                auto mc = _fetch(h.chat_id, h.message_id);
+
+                // Deleted message
+                if (mc)
+                    check(h.chat_id, *mc);
+            }
+        } else if (!pattern.empty()) {
+            _scan(check);
+        }
+
+        _pattern = pattern;
+        _hits = std::move(hits);
+        _result = std::move(result);
+
+        return _result;
+    }
+
+    /**
+     * Forgets previous pattern and results, so next update() scans the search scope.
+     */
+    void reset ()
+    {
+        _pattern.clear();
+        _hits.clear();
+        _result.m.clear();
+        _refined = false;
+    }
+
+    std::string const & pattern () const noexcept
+    {
+        return _pattern;
+    }
+
+    message_searcher::search_result const & result () const noexcept
+    {
+        return _result;
+    }
+
+    /**
+     * Number of messages matched by the current pattern.
+     */
+    std::size_t matched_count () const noexcept
+    {
+        return _hits.size();
+    }
+
+    /**
+     * Checks if the last update() refined the previous result instead of scanning.
+     */
+    bool refined () const noexcept
+    {
+        return _refined;
+    }
+};
+
 CHAT__NAMESPACE_END
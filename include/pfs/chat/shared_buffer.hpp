@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+CHAT__NAMESPACE_BEGIN
+
+/**
+ * Immutable reference counted data buffer. Copying the buffer shares the data, so the
+ * same serialized packet can be queued for any number of addressees without copying.
+ */
+class shared_buffer
+{
+    std::shared_ptr<std::vector<char> const> _d;
+
+public:
+    shared_buffer ()
+        : _d(std::make_shared<std::vector<char> const>())
+    {}
+
+    explicit shared_buffer (std::vector<char> && data)
+        : _d(std::make_shared<std::vector<char> const>(std::move(data)))
+    {}
+
+    // No move operations: moved-from buffer would have no data
+    shared_buffer (shared_buffer const & other) = default;
+    shared_buffer & operator = (shared_buffer const & other) = default;
+    ~shared_buffer () = default;
+
+public:
+    char const * data () const noexcept
+    {
+        return _d->data();
+    }
+
+    std::size_t size () const noexcept
+    {
+        return _d->size();
+    }
+
+    bool empty () const noexcept
+    {
+        return _d->empty();
+    }
+
+    /**
+     * Underlying data, valid while any copy of the buffer is alive.
+     */
+    std::vector<char> const & vector () const noexcept
+    {
+        return *_d;
+    }
+
+    /**
+     * Number of buffer copies sharing the data.
+     */
+    long use_count () const noexcept
+    {
+        return _d.use_count();
+    }
+};
+
+CHAT__NAMESPACE_END
@@ -5,6 +5,9 @@
 //
 // Changelog:
 //      2024.11.23 Initial version.
+//      2026.10.16 Added `chat_counters_table_name`.
+//                 Added `chat_handle_cache_size`.
+//                 Added `message_index_table_name`.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "namespace.hpp"
@@ -39,6 +42,16 @@ struct sqlite3
     // Default is 100
     static std::function<std::size_t ()> cache_window_size;
 
+    // Default is "chat_counters"
+    static std::function<std::string ()> chat_counters_table_name;
+
+    // Maximum number of chat handles cached by message store, default is 16 (0 disables caching)
+    static std::function<std::size_t ()> chat_handle_cache_size;
+
+    // Full-text index of message contents (FTS5 virtual table), default is "message_index".
+    // Index is disabled if SQLite is built without FTS5.
+    static std::function<std::string ()> message_index_table_name;
+
     // Default is "activity_log"
     static std::function<std::string ()> activity_log_table_name;
 
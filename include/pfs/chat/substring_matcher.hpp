@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "namespace.hpp"
+#include "exports.hpp"
+#include <pfs/unicode/search.hpp>
+#include <functional>
+#include <string>
+
+CHAT__NAMESPACE_BEGIN
+
+/**
+ * UTF-8 substring matcher used by searchers. Pattern is prepared once and applied to many
+ * texts. Candidate positions are located by vectorized scan for the first pattern byte
+ * (AVX2/SSE2 if enabled at build time, scalar otherwise), code point positions are
+ * calculated for found matches only.
+ *
+ * @details Case insensitive search of a pattern containing non-ASCII characters is delegated
+ *          to `pfs::unicode::search_all()`/`pfs::unicode::search_first()` since case folding
+ *          of these characters depends on the Unicode support of the platform.
+ */
+class substring_matcher
+{
+    std::string _pattern;      // Pattern, lower case if search is case insensitive
+    std::size_t _cp_count {0}; // Number of code points in pattern
+    bool _ignore_case {false};
+    bool _fallback {false};    // Use code point comparator
+
+public:
+    CHAT__EXPORT substring_matcher (std::string const & pattern, bool ignore_case);
+
+public:
+    /**
+     * Calls @a f for each (non-overlapping) occurrence of the pattern in @a text.
+     * If @a skip_begin is not zero, text between @a skip_begin and @a skip_end characters
+     * (e.g. HTML tags) is not searched.
+     */
+    CHAT__EXPORT void search_all (std::string const & text
+        , std::function<void(pfs::unicode::match_item const &)> f
+        , char skip_begin = '\0', char skip_end = '\0') const;
+
+    /**
+     * Searches for the first occurrence of the pattern in @a text.
+     *
+     * @return Match with negative @c cp_first if not found.
+     */
+    CHAT__EXPORT pfs::unicode::match_item search_first (std::string const & text
+        , char skip_begin = '\0', char skip_end = '\0') const;
+
+    std::string const & pattern () const noexcept
+    {
+        return _pattern;
+    }
+
+    bool ignore_case () const noexcept
+    {
+        return _ignore_case;
+    }
+
+private:
+    // Calls f for matches while f returns true
+    void search (std::string const & text, char skip_begin, char skip_end
+        , std::function<bool(pfs::unicode::match_item const &)> f) const;
+};
+
+CHAT__NAMESPACE_END
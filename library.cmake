@@ -11,12 +11,18 @@
 #       2023.02.10 Separated static and shared builds.
 #       2024.05.18 Replaced the sequence of two target configurations with a foreach statement.
 #       2024.11.23 Removed `portable_target` dependency.
+#       2026.10.16 Added binary content encoding.
+#                  Added dependency on threads library (parallel search).
+#                  Added substring matcher.
+#                  Added contact trigram index.
+#                  Added CRC-32C checksum.
 ################################################################################
 cmake_minimum_required (VERSION 3.19)
 project(chat LANGUAGES C CXX)
 
 option(CHAT__BUILD_SHARED "Enable build shared library" OFF)
 option(CHAT__ENABLE_SQLITE3_BACKEND "Enable sqlite3 storge" ON)
+option(CHAT__ENABLE_AVX2 "Enable AVX2 instructions for substring matcher (SSE2 is used by default on x86-64)" OFF)
 
 if (CHAT__BUILD_SHARED)
     add_library(chat SHARED)
@@ -31,11 +37,15 @@ add_library(pfs::chat ALIAS chat)
 list(APPEND _chat__sources
     # FIXME
     ${CMAKE_CURRENT_LIST_DIR}/src/chat_enum.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/contact_trigram_index.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/crc32c.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/emoji_db.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/error.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/file.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/member_difference.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/substring_matcher.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/in_memory/contact_list.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/binary/content.cpp
     ${CMAKE_CURRENT_LIST_DIR}/src/json/content.cpp)
 
 if (CHAT__ENABLE_SQLITE3_BACKEND)
@@ -81,9 +91,23 @@ if (NOT TARGET pfs::debby)
     FetchContent_MakeAvailable(debby)
 endif()
 
+if (CHAT__ENABLE_AVX2)
+    if (MSVC)
+        set_source_files_properties(${CMAKE_CURRENT_LIST_DIR}/src/substring_matcher.cpp
+            ${CMAKE_CURRENT_LIST_DIR}/src/crc32c.cpp
+            PROPERTIES COMPILE_OPTIONS "/arch:AVX2")
+    else()
+        set_source_files_properties(${CMAKE_CURRENT_LIST_DIR}/src/substring_matcher.cpp
+            ${CMAKE_CURRENT_LIST_DIR}/src/crc32c.cpp
+            PROPERTIES COMPILE_OPTIONS "-mavx2")
+    endif()
+endif()
+
+find_package(Threads REQUIRED)
+
 list(REMOVE_DUPLICATES _chat__sources)
 
 target_sources(chat PRIVATE ${_chat__sources})
 target_include_directories(chat PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include
     PRIVATE ${CMAKE_CURRENT_LIST_DIR}/include/pfs)
-target_link_libraries(chat PUBLIC pfs::common pfs::debby pfs::jeyson pfs::mime pfs::ionik)
+target_link_libraries(chat PUBLIC pfs::common pfs::debby pfs::jeyson pfs::mime pfs::ionik Threads::Threads)
@@ -0,0 +1,209 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+//                 Version 2: plain text projection of HTML components is stored.
+//                 Binary source is decoded in place (without copying).
+//                 HTML projection is not encoded, projection of version 2 is ignored.
+//                 Audio WAV frames count is checked against the data size.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/error.hpp"
+#include "pfs/chat/message.hpp"
+#include <pfs/binary_istream.hpp>
+#include <pfs/binary_ostream.hpp>
+#include <pfs/i18n.hpp>
+#include <pfs/numeric_cast.hpp>
+#include <pfs/universal_id_pack.hpp>
+#include <cstdint>
+
+CHAT__NAMESPACE_BEGIN
+
+namespace message {
+
+//
+// Binary content layout (version 1), all numbers are in network byte order:
+//
+// +------+---------+-------+-----------+-----------+
+// | 0x00 | version | count | component | ...       |
+// +------+---------+-------+-----------+-----------+
+//    1        1        4
+//
+// Component:
+//      flags (1 byte): bit 0 - attachment, bit 1 - audio WAV credentials follow
+//      mime (4 bytes)
+//      text (length prefixed)
+//      [attachment] file ID, size (4 bytes)
+//      [audio WAV] number of channels (1 byte), duration (4 bytes),
+//                  min frame, max frame (2 x float each),
+//                  frames count (4 bytes), frames (number of channels x float each)
+//
+// Version 2 (obsolete) additionally contains HTML projection if flags bit 2 is set:
+// plain text (length prefixed), segments count (4 bytes), segments (4 x 4 bytes each).
+// It follows the text and is skipped while decoding: projection is not trusted and is
+// always calculated from the text.
+//
+
+constexpr std::uint8_t content::binary_version;
+
+static constexpr std::uint8_t ATTACHMENT_FLAG = 1 << 0;
+static constexpr std::uint8_t AUDIO_WAV_FLAG  = 1 << 1;
+static constexpr std::uint8_t HTML_PROJECTION_FLAG = 1 << 2; // Version 2 only
+static constexpr std::uint8_t PROJECTION_VERSION = 2;
+
+using ostream_type = pfs::binary_ostream<pfs::endian::network>;
+using istream_type = pfs::binary_istream<pfs::endian::network>;
+
+std::string content::to_binary () const
+{
+    if (is_binary(_source) && _source.size() > 1
+            && static_cast<std::uint8_t>(_source[1]) == binary_version) {
+        return _source;
+    }
+
+    decode();
+
+    ostream_type out;
+
+    out << std::uint8_t{0} << binary_version
+        << pfs::numeric_cast<std::uint32_t>(_d.size());
+
+    for (auto const & c: _d) {
+        std::uint8_t flags = 0;
+
+        if (c.is_attachment) {
+            flags |= ATTACHMENT_FLAG;
+
+            if (c.wav)
+                flags |= AUDIO_WAV_FLAG;
+        }
+
+        out << flags << static_cast<std::int32_t>(c.mime) << c.text;
+
+        if (c.is_attachment) {
+            out << c.file_id << static_cast<std::int32_t>(c.size);
+
+            if (c.wav) {
+                auto const & wav = *c.wav;
+
+                out << wav.num_channels << wav.duration
+                    << wav.min_frame.first << wav.min_frame.second
+                    << wav.max_frame.first << wav.max_frame.second
+                    << pfs::numeric_cast<std::uint32_t>(wav.data.size());
+
+                for (auto const & frame: wav.data) {
+                    out << frame.first;
+
+                    if (wav.num_channels == 2)
+                        out << frame.second;
+                }
+            }
+        }
+    }
+
+    return std::string(out.data(), out.size());
+}
+
+std::vector<content::component> content::decode_binary (char const * data, std::size_t size)
+{
+    istream_type in {data, size};
+    std::uint8_t marker = 0;
+    std::uint8_t version = 0;
+    std::uint32_t count = 0;
+    std::vector<component> components;
+
+    try {
+        in >> marker >> version;
+
+        if (version != binary_version && version != PROJECTION_VERSION) {
+            throw error {errc::bad_content
+                , tr::f_("unsupported content encoding version: {}", static_cast<int>(version))};
+        }
+
+        in >> count;
+
+        // Each component occupies at least 9 bytes, so count can be checked before reserve
+        if (count > size)
+            throw error {errc::bad_content, tr::_("bad content components count")};
+
+        components.reserve(count);
+
+        for (std::uint32_t i = 0; i < count; i++) {
+            component c;
+            std::uint8_t flags = 0;
+            std::int32_t mime = 0;
+
+            in >> flags >> mime >> c.text;
+
+            c.mime = static_cast<mime::mime_enum>(mime);
+            c.is_attachment = (flags & ATTACHMENT_FLAG) != 0;
+
+            if (version == PROJECTION_VERSION && (flags & HTML_PROJECTION_FLAG)) {
+                std::string plain;
+                std::uint32_t segments_count = 0;
+
+                in >> plain >> segments_count;
+
+                if (segments_count > plain.size() || plain.size() > c.text.size())
+                    throw error {errc::bad_content, tr::_("bad HTML projection")};
+
+                text_segment seg;
+
+                for (std::uint32_t j = 0; j < segments_count; j++)
+                    in >> seg.plain_cu >> seg.plain_cp >> seg.source_cu >> seg.source_cp;
+            }
+
+            if (!c.is_attachment && c.mime == mime::mime_enum::text__html)
+                project_html(c);
+
+            if (c.is_attachment) {
+                std::int32_t file_size = 0;
+                in >> c.file_id >> file_size;
+                c.size = static_cast<file::filesize_t>(file_size);
+
+                if (flags & AUDIO_WAV_FLAG) {
+                    audio_wav_credentials wav;
+                    std::uint32_t frames_count = 0;
+
+                    in >> wav.num_channels >> wav.duration
+                        >> wav.min_frame.first >> wav.min_frame.second
+                        >> wav.max_frame.first >> wav.max_frame.second
+                        >> frames_count;
+
+                    if (wav.num_channels < 1 || wav.num_channels > 2)
+                        throw error {errc::bad_content, tr::_("bad audio WAV credentials")};
+
+                    // Frames count is checked against the data left before allocation
+                    if (frames_count > in.available() / (sizeof(float) * wav.num_channels))
+                        throw error {errc::bad_content, tr::_("bad audio WAV frames count")};
+
+                    wav.data.resize(frames_count, std::make_pair(.0f, .0f));
+
+                    for (auto & frame: wav.data) {
+                        in >> frame.first;
+
+                        if (wav.num_channels == 2)
+                            in >> frame.second;
+                    }
+
+                    c.wav = std::move(wav);
+                }
+            }
+
+            components.push_back(std::move(c));
+        }
+    } catch (error const &) {
+        throw;
+    } catch (pfs::error const & ex) {
+        // Truncated/corrupted data
+        throw error {errc::bad_content, ex.what()};
+    }
+
+    return components;
+}
+
+} // namespace message
+
+CHAT__NAMESPACE_END
@@ -0,0 +1,237 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/contact_trigram_index.hpp"
+#include <algorithm>
+#include <iterator>
+
+CHAT__NAMESPACE_BEGIN
+
+static constexpr std::uint32_t ALIAS_FIELD = 0;
+static constexpr std::uint32_t DESC_FIELD  = 1;
+
+inline std::uint8_t fold (char ch)
+{
+    return (ch >= 'A' && ch <= 'Z')
+        ? static_cast<std::uint8_t>(ch - 'A' + 'a')
+        : static_cast<std::uint8_t>(ch);
+}
+
+// Calls f for each distinct trigram key of the text
+template <typename F>
+static void for_each_trigram (std::string const & text, std::uint32_t field, F && f)
+{
+    if (text.size() < 3)
+        return;
+
+    std::vector<std::uint32_t> keys;
+    keys.reserve(text.size() - 2);
+
+    for (std::size_t i = 0, last = text.size() - 2; i < last; i++) {
+        keys.push_back((field << 24)
+            | (static_cast<std::uint32_t>(fold(text[i])) << 16)
+            | (static_cast<std::uint32_t>(fold(text[i + 1])) << 8)
+            | static_cast<std::uint32_t>(fold(text[i + 2])));
+    }
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    for (auto key: keys)
+        f(key);
+}
+
+bool contact_trigram_index::add (contact::id contact_id, std::string const & alias
+    , std::string const & description)
+{
+    if (_slots.find(contact_id) != _slots.end())
+        return false;
+
+    std::uint32_t slot = 0;
+
+    if (_free_slots.empty()) {
+        slot = static_cast<std::uint32_t>(_entries.size());
+        _entries.push_back(entry{contact_id, alias, description});
+    } else {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+        _entries[slot] = entry{contact_id, alias, description};
+    }
+
+    _slots[contact_id] = slot;
+    index_text(slot, alias, ALIAS_FIELD);
+    index_text(slot, description, DESC_FIELD);
+
+    return true;
+}
+
+void contact_trigram_index::update (contact::id contact_id, std::string const & alias
+    , std::string const & description)
+{
+    auto pos = _slots.find(contact_id);
+
+    if (pos == _slots.end()) {
+        add(contact_id, alias, description);
+        return;
+    }
+
+    auto slot = pos->second;
+    auto & e = _entries[slot];
+
+    if (e.alias != alias) {
+        unindex_text(slot, e.alias, ALIAS_FIELD);
+        index_text(slot, alias, ALIAS_FIELD);
+        e.alias = alias;
+    }
+
+    if (e.description != description) {
+        unindex_text(slot, e.description, DESC_FIELD);
+        index_text(slot, description, DESC_FIELD);
+        e.description = description;
+    }
+}
+
+bool contact_trigram_index::remove (contact::id contact_id)
+{
+    auto pos = _slots.find(contact_id);
+
+    if (pos == _slots.end())
+        return false;
+
+    auto slot = pos->second;
+    auto & e = _entries[slot];
+
+    unindex_text(slot, e.alias, ALIAS_FIELD);
+    unindex_text(slot, e.description, DESC_FIELD);
+
+    e = entry{};
+    _free_slots.push_back(slot);
+    _slots.erase(pos);
+
+    return true;
+}
+
+void contact_trigram_index::clear ()
+{
+    _entries.clear();
+    _free_slots.clear();
+    _slots.clear();
+    _postings.clear();
+}
+
+void contact_trigram_index::index_text (std::uint32_t slot, std::string const & text
+    , std::uint32_t field)
+{
+    for_each_trigram(text, field, [this, slot] (std::uint32_t key) {
+        auto & posting = _postings[key];
+
+        // Slots are mostly appended in increasing order
+        if (posting.empty() || posting.back() < slot)
+            posting.push_back(slot);
+        else
+            posting.insert(std::lower_bound(posting.begin(), posting.end(), slot), slot);
+    });
+}
+
+void contact_trigram_index::unindex_text (std::uint32_t slot, std::string const & text
+    , std::uint32_t field)
+{
+    for_each_trigram(text, field, [this, slot] (std::uint32_t key) {
+        auto pos = _postings.find(key);
+
+        if (pos == _postings.end())
+            return;
+
+        auto & posting = pos->second;
+        auto it = std::lower_bound(posting.begin(), posting.end(), slot);
+
+        if (it != posting.end() && *it == slot)
+            posting.erase(it);
+
+        if (posting.empty())
+            _postings.erase(pos);
+    });
+}
+
+std::vector<std::uint32_t> contact_trigram_index::candidates (std::string const & pattern
+    , std::uint32_t field) const
+{
+    std::vector<std::vector<std::uint32_t> const *> postings;
+    bool found_all = true;
+
+    for_each_trigram(pattern, field, [this, & postings, & found_all] (std::uint32_t key) {
+        auto pos = _postings.find(key);
+
+        if (pos == _postings.end())
+            found_all = false;
+        else
+            postings.push_back(& pos->second);
+    });
+
+    if (!found_all || postings.empty())
+        return std::vector<std::uint32_t>{};
+
+    // Intersect starting from the shortest posting
+    std::sort(postings.begin(), postings.end()
+        , [] (std::vector<std::uint32_t> const * a, std::vector<std::uint32_t> const * b) {
+            return a->size() < b->size();
+        });
+
+    std::vector<std::uint32_t> result = *postings.front();
+    std::vector<std::uint32_t> tmp;
+
+    for (std::size_t i = 1; i < postings.size() && !result.empty(); i++) {
+        tmp.clear();
+        std::set_intersection(result.begin(), result.end()
+            , postings[i]->begin(), postings[i]->end(), std::back_inserter(tmp));
+        result.swap(tmp);
+    }
+
+    return result;
+}
+
+bool contact_trigram_index::for_each_candidate (std::string const & pattern, bool ignore_case
+    , bool alias, bool description, std::function<void(entry const &)> f) const
+{
+    if (pattern.size() < 3)
+        return false;
+
+    // Case folding of non-ASCII characters is not supported by the index
+    if (ignore_case) {
+        auto non_ascii = std::any_of(pattern.begin(), pattern.end()
+            , [] (char ch) { return static_cast<std::uint8_t>(ch) >= 0x80; });
+
+        if (non_ascii)
+            return false;
+    }
+
+    std::vector<std::uint32_t> slots;
+
+    if (alias)
+        slots = candidates(pattern, ALIAS_FIELD);
+
+    if (description) {
+        auto desc_slots = candidates(pattern, DESC_FIELD);
+
+        if (slots.empty()) {
+            slots = std::move(desc_slots);
+        } else {
+            std::vector<std::uint32_t> merged;
+            std::set_union(slots.begin(), slots.end(), desc_slots.begin(), desc_slots.end()
+                , std::back_inserter(merged));
+            slots = std::move(merged);
+        }
+    }
+
+    for (auto slot: slots)
+        f(_entries[slot]);
+
+    return true;
+}
+
+CHAT__NAMESPACE_END
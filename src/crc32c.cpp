@@ -0,0 +1,78 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/crc32c.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__SSE4_2__) || defined(__AVX2__)
+#   include <nmmintrin.h>
+#   define CHAT__CRC32C_SSE42 1
+#endif
+
+CHAT__NAMESPACE_BEGIN
+
+#if CHAT__CRC32C_SSE42
+
+std::uint32_t crc32c (char const * data, std::size_t size, std::uint32_t crc)
+{
+    auto c = ~crc;
+
+#   if defined(__x86_64__) || defined(_M_X64)
+    std::uint64_t c64 = c;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        std::uint64_t chunk = 0;
+        std::memcpy(& chunk, data, 8);
+        c64 = _mm_crc32_u64(c64, chunk);
+    }
+
+    c = static_cast<std::uint32_t>(c64);
+#   endif
+
+    for (; size > 0; ++data, --size)
+        c = _mm_crc32_u8(c, static_cast<std::uint8_t>(*data));
+
+    return ~c;
+}
+
+#else
+
+static constexpr std::uint32_t POLY = 0x82F63B78; // Reversed Castagnoli polynomial
+
+static std::array<std::uint32_t, 256> make_table ()
+{
+    std::array<std::uint32_t, 256> table;
+
+    for (std::uint32_t i = 0; i < 256; i++) {
+        auto c = i;
+
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+
+        table[i] = c;
+    }
+
+    return table;
+}
+
+std::uint32_t crc32c (char const * data, std::size_t size, std::uint32_t crc)
+{
+    static auto const TABLE = make_table();
+
+    auto c = ~crc;
+
+    for (; size > 0; ++data, --size)
+        c = TABLE[(c ^ static_cast<std::uint8_t>(*data)) & 0xFF] ^ (c >> 8);
+
+    return ~c;
+}
+
+#endif
+
+CHAT__NAMESPACE_END
@@ -5,6 +5,7 @@
 //
 // Changelog:
 //      2022.01.05 Initial version.
+//      2026.10.16 Added `errc::bad_content`.
 ////////////////////////////////////////////////////////////////////////////////
 #include "pfs/chat/error.hpp"
 #include "pfs/i18n.hpp"
@@ -70,6 +71,9 @@ std::string error_category::message (int ev) const
         case errc::json_error:
             return tr::_("JSON backend error");
 
+        case errc::bad_content:
+            return tr::_("bad message content");
+
         default: return tr::_("unknown chat error");
     }
 };
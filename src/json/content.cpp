@@ -5,9 +5,15 @@
 //
 // Changelog:
 //      2022.02.04 Initial version.
+//      2026.10.16 JSON is used as encoding only, content is stored as components.
+//                 Content is decoded lazily.
+//                 Added plain text projection of HTML components.
+//                 Added content kinds.
+//                 Added decoding from the source view.
 ////////////////////////////////////////////////////////////////////////////////
 #include "pfs/chat/error.hpp"
 #include "pfs/chat/message.hpp"
+#include <algorithm>
 #include <cassert>
 
 CHAT__NAMESPACE_BEGIN
@@ -30,6 +36,96 @@ static char const * AU_SPECTRUM      = "spectrum";
 content::content () = default;
 
 content::content (std::string const & source)
+    : _source(source)
+    , _initialized(true)
+{}
+
+content::content (std::string && source)
+    : _source(std::move(source))
+    , _initialized(true)
+{}
+
+content::content (content const & other) = default;
+content::content (content && other) = default;
+content & content::operator = (content const & other) = default;
+content & content::operator = (content && other) = default;
+content::~content () = default;
+
+void content::decode () const
+{
+    if (_source.empty())
+        return;
+
+    _d = is_binary(_source) ? decode_binary(_source.data(), _source.size()) : decode_json(_source);
+    _source.clear();
+}
+
+content content::decode_view (pfs::string_view source)
+{
+    content c;
+
+    if (!source.empty()) {
+        c._d = (source[0] == '\0')
+            ? decode_binary(source.data(), source.size())
+            : decode_json(std::string(source.data(), source.size()));
+    }
+
+    c._initialized = true;
+    return c;
+}
+
+inline bool is_continuation_byte (char ch)
+{
+    return (static_cast<unsigned char>(ch) & 0xC0) == 0x80;
+}
+
+void content::project_html (component & c)
+{
+    c.plain.clear();
+    c.segments.clear();
+
+    // No tags, text is a projection itself
+    if (c.text.find('<') == std::string::npos)
+        return;
+
+    std::uint32_t source_cp = 0;
+    std::uint32_t plain_cp = 0;
+    bool in_tag = false;
+    bool in_run = false;
+
+    c.plain.reserve(c.text.size());
+
+    for (std::size_t i = 0, size = c.text.size(); i < size; i++) {
+        auto ch = c.text[i];
+        auto is_cp_start = !is_continuation_byte(ch);
+
+        if (ch == '<') {
+            in_tag = true;
+            in_run = false;
+        } else if (in_tag) {
+            if (ch == '>')
+                in_tag = false;
+        } else {
+            if (!in_run) {
+                c.segments.push_back(text_segment {
+                      static_cast<std::uint32_t>(c.plain.size()), plain_cp
+                    , static_cast<std::uint32_t>(i), source_cp
+                });
+                in_run = true;
+            }
+
+            c.plain.push_back(ch);
+
+            if (is_cp_start)
+                plain_cp++;
+        }
+
+        if (is_cp_start)
+            source_cp++;
+    }
+}
+
+std::vector<content::component> content::decode_json (std::string const & source)
 {
     json j;
 
@@ -39,38 +135,96 @@ content::content (std::string const & source)
         throw error{errc::json_error, ex.what()};
     }
 
-    if (!jeyson::is_array(j)) {
+    if (!jeyson::is_array(j))
         throw error{errc::json_error, "expected array"};
-    } else {
-        _d = std::move(j);
+
+    std::vector<component> components;
+    components.reserve(j.size());
+
+    for (std::size_t index = 0, count = j.size(); index < count; index++) {
+        auto elem = j[index];
+        assert(elem);
+
+        component c;
+        c.is_attachment = jeyson::get_or<bool>(elem[ATT_KEY], false);
+        c.mime = static_cast<mime::mime_enum>(jeyson::get_or<int>(elem[MIME_KEY]
+            , static_cast<int>(mime::mime_enum::unknown)));
+        c.text = jeyson::get_or<std::string>(elem[TEXT_KEY], std::string{});
+
+        if (!c.is_attachment && c.mime == mime::mime_enum::text__html)
+            project_html(c);
+
+        if (c.is_attachment) {
+            c.file_id = pfs::from_string<file::id>(jeyson::get_or<std::string>(elem[ID_KEY], std::string{}));
+            c.size = jeyson::get_or<file::filesize_t>(elem[SIZE_KEY], 0);
+
+            if (c.mime == mime::mime_enum::audio__wav) {
+                audio_wav_credentials wav;
+                wav.num_channels = jeyson::get_or<std::uint8_t>(elem[AU_WAV_KEY][AU_NUM_CHAN_KEY], 0);
+                wav.duration = jeyson::get_or<std::uint32_t>(elem[AU_WAV_KEY][AU_DURATION_KEY], 0);
+                wav.min_frame.first  = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][0], .0f);
+                wav.max_frame.first  = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][0], .0f);
+                wav.min_frame.second = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][1], .0f);
+                wav.max_frame.second = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][1], .0f);
+
+                elem[AU_WAV_KEY][AU_SPECTRUM].for_each ([& wav] (json::reference ref) {
+                    auto frame_left = jeyson::get_or<float>(ref[0], 0.f);
+                    auto frame_right = jeyson::get_or<float>(ref[1], 0.f);
+
+                    wav.data.push_back(std::make_pair(frame_left, frame_right));
+                });
+
+                // See add_audio_wav()
+                if (wav.num_channels > 0 && wav.num_channels <= 2)
+                    c.wav = std::move(wav);
+            }
+        }
+
+        components.push_back(std::move(c));
     }
-}
 
-content::content (content const & other) = default;
-content::content (content && other) = default;
-content & content::operator = (content const & other) = default;
-content & content::operator = (content && other) = default;
-content::~content () = default;
+    return components;
+}
 
-std::size_t content::count () const noexcept
+std::size_t content::count () const
 {
+    decode();
     return _d.size();
 }
 
+std::uint32_t content::kinds () const
+{
+    decode();
+
+    std::uint32_t result = 0;
+
+    for (auto const & c: _d) {
+        if (c.is_attachment) {
+            result |= content_kind::attachment;
+
+            if (c.mime == mime::mime_enum::audio__wav)
+                result |= content_kind::audio_wav;
+        } else if (c.mime == mime::mime_enum::text__plain) {
+            result |= content_kind::text;
+        } else if (c.mime == mime::mime_enum::text__html) {
+            result |= content_kind::html;
+        } else if (c.mime == mime::mime_enum::application__sdp) {
+            result |= content_kind::live_video;
+        }
+    }
+
+    return result;
+}
+
 content_credentials content::at (std::size_t index) const
 {
-    if (index < _d.size()) {
-        auto elem = _d[index];
-        assert(elem);
+    decode();
 
-        auto att = jeyson::get_or<bool>(elem[ATT_KEY], false);
-        auto x = jeyson::get_or<int>(elem[MIME_KEY], static_cast<int>(mime::mime_enum::unknown));
-        auto mime = static_cast<mime::mime_enum>(x);
+    if (index < _d.size()) {
+        auto const & c = _d[index];
 
-        if (is_valid(mime)) {
-            auto text = jeyson::get_or<std::string>(elem[TEXT_KEY], std::string{});
-            return content_credentials{att, mime, text};
-        }
+        if (is_valid(c.mime))
+            return content_credentials{c.is_attachment, c.mime, c.text};
     }
 
     return content_credentials{false, mime::mime_enum::unknown, std::string{}};
@@ -78,25 +232,13 @@ content_credentials content::at (std::size_t index) const
 
 attachment_credentials content::attachment (std::size_t index) const
 {
-    if (index < _d.size()) {
-        auto elem = _d[index];
-        assert(elem);
-
-        auto att = jeyson::get_or<bool>(elem[ATT_KEY], false);
-        auto x = jeyson::get_or<int>(elem[MIME_KEY], static_cast<int>(mime::mime_enum::unknown));
-        auto mime = static_cast<mime::mime_enum>(x);
+    decode();
 
-        if (att && is_valid(mime)) {
-            auto file_id = jeyson::get_or<std::string>(elem[ID_KEY], std::string{});
-            auto name    = jeyson::get_or<std::string>(elem[TEXT_KEY], std::string{});
-            auto size    = jeyson::get_or<file::filesize_t>(elem[SIZE_KEY], 0);
+    if (index < _d.size()) {
+        auto const & c = _d[index];
 
-            return attachment_credentials {
-                  pfs::from_string<file::id>(file_id)
-                , name
-                , size
-            };
-        }
+        if (c.is_attachment && is_valid(c.mime))
+            return attachment_credentials {c.file_id, c.text, c.size};
     }
 
     return attachment_credentials{};
@@ -104,147 +246,214 @@ attachment_credentials content::attachment (std::size_t index) const
 
 audio_wav_credentials content::audio_wav (std::size_t index) const
 {
+    decode();
+
     if (index < _d.size()) {
-        auto elem = _d[index];
-        assert(elem);
+        auto const & c = _d[index];
 
-        auto att = jeyson::get_or<bool>(elem[ATT_KEY], false);
-        auto x = jeyson::get_or<int>(elem[MIME_KEY], static_cast<int>(mime::mime_enum::unknown));
-        auto mime = static_cast<mime::mime_enum>(x);
-
-        if (att && mime == mime::mime_enum::audio__wav) {
-            auto num_channels = jeyson::get_or<std::uint8_t>(elem[AU_WAV_KEY][AU_NUM_CHAN_KEY], 0);
-            auto duration = jeyson::get_or<std::uint32_t>(elem[AU_WAV_KEY][AU_DURATION_KEY], 0);
-            auto min_frame_left  = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][0], .0f);
-            auto max_frame_left  = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][0], .0f);
-            auto min_frame_right = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][1], .0f);
-            auto max_frame_right = jeyson::get_or<float>(elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][1], .0f);
-
-            std::vector<std::pair<float, float>> data;
-
-            elem[AU_WAV_KEY][AU_SPECTRUM].for_each ([& data] (json::reference ref) {
-                auto frame_left = jeyson::get_or<float>(ref[0], 0.f);
-                auto frame_right = jeyson::get_or<float>(ref[1], 0.f);
-
-                data.push_back(std::make_pair(frame_left, frame_right));
-            });
-
-            return audio_wav_credentials {
-                  num_channels
-                , duration
-                , std::make_pair(min_frame_left, min_frame_right)
-                , std::make_pair(max_frame_left, max_frame_right)
-                , std::move(data)
-            };
+        if (c.is_attachment && c.mime == mime::mime_enum::audio__wav) {
+            if (c.wav)
+                return *c.wav;
+
+            return audio_wav_credentials {0, 0, std::make_pair(.0f, .0f), std::make_pair(.0f, .0f), {}};
         }
     }
 
     return audio_wav_credentials{};
 }
 
-live_video_credentials content::live_video (std::size_t index) const
+std::string const & content::plain_text (std::size_t index) const
 {
+    static std::string const EMPTY;
+
+    decode();
+
     if (index < _d.size()) {
-        auto elem = _d[index];
-        assert(elem);
+        auto const & c = _d[index];
 
-        auto att = jeyson::get_or<bool>(elem[ATT_KEY], false);
-        auto x = jeyson::get_or<int>(elem[MIME_KEY], static_cast<int>(mime::mime_enum::unknown));
-        auto mime = static_cast<mime::mime_enum>(x);
+        if (!is_valid(c.mime))
+            return EMPTY;
 
-        if (is_valid(mime) && mime == mime::mime_enum::application__sdp) {
-            auto description = jeyson::get_or<std::string>(elem[TEXT_KEY], std::string{});
-            return live_video_credentials{description};
-        }
+        return c.segments.empty() ? c.text : c.plain;
     }
 
-    return live_video_credentials{};
+    return EMPTY;
 }
 
-void content::add_text (std::string const & text)
+std::pair<std::size_t, std::size_t> content::source_position (std::size_t index
+    , std::size_t cu, std::size_t cp) const
 {
-    json elem;
-    elem[ATT_KEY] = false;
-    elem[MIME_KEY] = static_cast<int>(mime::mime_enum::text__plain);
-    elem[TEXT_KEY] = text;
-    _d.push_back(std::move(elem));
+    decode();
+
+    if (index >= _d.size() || _d[index].segments.empty())
+        return std::make_pair(cu, cp);
+
+    auto const & segments = _d[index].segments;
+
+    // Last segment starting at or before the position
+    auto pos = std::upper_bound(segments.begin(), segments.end(), cu
+        , [] (std::size_t value, text_segment const & s) { return value < s.plain_cu; });
+
+    if (pos == segments.begin())
+        return std::make_pair(cu, cp);
+
+    --pos;
+
+    return std::make_pair(pos->source_cu + (cu - pos->plain_cu)
+        , pos->source_cp + (cp - pos->plain_cp));
 }
 
-void content::add_html (std::string const & text)
+live_video_credentials content::live_video (std::size_t index) const
 {
-    json elem;
-    elem[ATT_KEY] = false;
-    elem[MIME_KEY] = static_cast<int>(mime::mime_enum::text__html);
-    elem[TEXT_KEY] = text;
-    _d.push_back(std::move(elem));
+    decode();
+
+    if (index < _d.size()) {
+        auto const & c = _d[index];
+
+        if (is_valid(c.mime) && c.mime == mime::mime_enum::application__sdp)
+            return live_video_credentials{c.text};
+    }
+
+    return live_video_credentials{};
 }
 
-static void init_attachment (json & elem, file::credentials const & fc)
+void content::add_text (std::string const & text)
 {
-    using pfs::to_string;
+    decode();
 
-    elem[ATT_KEY]  = true;
-    elem[MIME_KEY] = static_cast<int>(fc.mime);
-    elem[ID_KEY]   = to_string(fc.file_id);
-    elem[TEXT_KEY] = fc.name;
-    elem[SIZE_KEY] = fc.size;
+    component c;
+    c.mime = mime::mime_enum::text__plain;
+    c.text = text;
+    _d.push_back(std::move(c));
+    _initialized = true;
+}
+
+void content::add_html (std::string const & text)
+{
+    decode();
+
+    component c;
+    c.mime = mime::mime_enum::text__html;
+    c.text = text;
+    project_html(c);
+    _d.push_back(std::move(c));
+    _initialized = true;
 }
 
 void content::add_audio_wav (audio_wav_credentials const & wav
     , file::credentials const & fc)
 {
-    json elem;
-    init_attachment(elem, fc);
+    decode();
+
+    component c;
+    c.is_attachment = true;
+    c.mime = fc.mime;
+    c.file_id = fc.file_id;
+    c.text = fc.name;
+    c.size = fc.size;
 
     if (fc.mime == mime::mime_enum::audio__wav
             && wav.num_channels > 0 && wav.num_channels <= 2) {
-        elem[AU_WAV_KEY][AU_DURATION_KEY] = wav.duration;
-        elem[AU_WAV_KEY][AU_NUM_CHAN_KEY] = wav.num_channels;
+        audio_wav_credentials w = wav;
 
-        elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][0] = wav.min_frame.first;
-        elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][0] = wav.max_frame.first;
+        // Second channel is not stored for mono
+        if (w.num_channels == 1) {
+            w.min_frame.second = .0f;
+            w.max_frame.second = .0f;
 
-        if (wav.num_channels == 2) {
-            elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][1] = wav.min_frame.second;
-            elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][1] = wav.max_frame.second;
+            for (auto & frame: w.data)
+                frame.second = .0f;
         }
 
-        for (std::size_t i = 0, count = wav.data.size(); i < count; i++) {
-            elem[AU_WAV_KEY][AU_SPECTRUM][i][0] = wav.data[i].first;
-
-            if (wav.num_channels == 2)
-                elem[AU_WAV_KEY][AU_SPECTRUM][i][1] = wav.data[i].second;
-        }
+        c.wav = std::move(w);
     }
 
-    _d.push_back(std::move(elem));
+    _d.push_back(std::move(c));
+    _initialized = true;
 }
 
 void content::add_live_video (live_video_credentials const & lvc)
 {
-    json elem;
-    elem[ATT_KEY] = false;
-    elem[MIME_KEY] = static_cast<int>(mime::mime_enum::application__sdp);
-    elem[TEXT_KEY] = lvc.description;
-    _d.push_back(std::move(elem));
+    decode();
+
+    component c;
+    c.mime = mime::mime_enum::application__sdp;
+    c.text = lvc.description;
+    _d.push_back(std::move(c));
+    _initialized = true;
 }
 
 void content::attach (file::credentials const & fc)
 {
-    json elem;
-    init_attachment(elem, fc);
-    _d.push_back(std::move(elem));
+    decode();
+
+    component c;
+    c.is_attachment = true;
+    c.mime = fc.mime;
+    c.file_id = fc.file_id;
+    c.text = fc.name;
+    c.size = fc.size;
+    _d.push_back(std::move(c));
+    _initialized = true;
 }
 
 void content::clear ()
 {
-    json empty_content;
-    _d.swap(empty_content);
+    _source.clear();
+    _d.clear();
+    _initialized = false;
 }
 
-std::string content::to_string () const noexcept
+std::string content::to_string () const
 {
-    return jeyson::to_string(_d);
+    using pfs::to_string;
+
+    if (!_source.empty() && !is_binary(_source))
+        return _source;
+
+    decode();
+
+    json j;
+
+    for (auto const & c: _d) {
+        json elem;
+        elem[ATT_KEY] = c.is_attachment;
+        elem[MIME_KEY] = static_cast<int>(c.mime);
+
+        if (c.is_attachment) {
+            elem[ID_KEY] = to_string(c.file_id);
+            elem[TEXT_KEY] = c.text;
+            elem[SIZE_KEY] = c.size;
+
+            if (c.wav) {
+                auto const & wav = *c.wav;
+
+                elem[AU_WAV_KEY][AU_DURATION_KEY] = wav.duration;
+                elem[AU_WAV_KEY][AU_NUM_CHAN_KEY] = wav.num_channels;
+
+                elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][0] = wav.min_frame.first;
+                elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][0] = wav.max_frame.first;
+
+                if (wav.num_channels == 2) {
+                    elem[AU_WAV_KEY][AU_MIN_FRAME_KEY][1] = wav.min_frame.second;
+                    elem[AU_WAV_KEY][AU_MAX_FRAME_KEY][1] = wav.max_frame.second;
+                }
+
+                for (std::size_t i = 0, count = wav.data.size(); i < count; i++) {
+                    elem[AU_WAV_KEY][AU_SPECTRUM][i][0] = wav.data[i].first;
+
+                    if (wav.num_channels == 2)
+                        elem[AU_WAV_KEY][AU_SPECTRUM][i][1] = wav.data[i].second;
+                }
+            }
+        } else {
+            elem[TEXT_KEY] = c.text;
+        }
+
+        j.push_back(std::move(elem));
+    }
+
+    return _d.empty() ? std::string{"[]"} : jeyson::to_string(j);
 }
 
 } // namespace message
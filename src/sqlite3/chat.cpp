@@ -7,16 +7,39 @@
 //      2021.01.02 Initial version.
 //      2022.02.17 Refactored totally.
 //      2024.11.29 Started V2.
+//      2026.10.16 Added keyset (seek) pagination.
+//                 Added secondary indexes for sort orders and unread messages.
+//                 Added materialized message counters.
+//                 Wiped chat handle is marked to be dropped from the handle cache.
+//                 Added set-based marking of messages as delivered/read.
+//                 Content is stored in binary encoding.
+//                 Added message column projection, content is decoded lazily.
+//                 Hot queries use cached prepared statements.
+//                 Added full-text index maintenance.
+//                 HTML content is indexed by its plain text projection.
+//                 Added message filter, content kinds are stored.
+//                 Incoming content is bound as is (without re-encoding).
+//                 Added filtered `for_each_before`.
+//                 Chat table is created and upgraded within savepoint.
+//                 Content is stored as BLOB.
+//                 Set-based marking returns identifiers of marked messages.
+//                 Full-text index is built with trigram tokenizer.
+//                 Incoming content decoded by caller is not decoded again.
 ////////////////////////////////////////////////////////////////////////////////
 #include "chat_impl.hpp"
 #include "editor_impl.hpp"
+#include "savepoint.hpp"
 #include "chat/chat.hpp"
 #include "chat/editor_mode.hpp"
 #include <pfs/assert.hpp>
 #include <pfs/i18n.hpp>
 #include <pfs/debby/data_definition.hpp>
 #include <pfs/debby/relational_database.hpp>
+#include <algorithm>
 #include <array>
+#include <set>
+#include <utility>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -27,16 +50,38 @@ namespace storage {
 
 std::function<std::string ()> sqlite3::chat_table_name_prefix = [] { return std::string("#"); };
 std::function<std::size_t ()> sqlite3::cache_window_size = [] { return std::size_t{100}; };
+std::function<std::string ()> sqlite3::message_index_table_name = [] { return std::string{"message_index"}; };
+
+// Secondary indexes of the chat table: name suffix and definition.
+// Sort keys must match expressions returned by `sqlite3::chat::sort_key()`.
+static std::array<std::pair<char const *, char const *>, 6> const CHAT_INDEXES = {
+      std::make_pair("creation_time"    , "(creation_time)")
+    , std::make_pair("modification_time", "(modification_time)")
+    , std::make_pair("delivered_time"   , "(IFNULL(delivered_time, 0))")
+    , std::make_pair("read_time"        , "(IFNULL(read_time, 0))")
+
+    // Partial index for unread messages (see `chat::unread_message_count()`)
+    , std::make_pair("unread"           , "(author_id) WHERE read_time IS NULL")
+
+    // Author filter with creation time range (see `message_filter`)
+    , std::make_pair("author"           , "(author_id, creation_time)")
+};
 
 sqlite3::chat::chat (contact::id an_author_id, contact::id a_chat_id, relational_database_t & db)
     : author_id(an_author_id)
     , chat_id(a_chat_id)
 {
     table_name = chat_table_name_prefix() + to_string(chat_id);
+    counters_table_name = chat_counters_table_name();
 
     debby::error err;
+    std::vector<std::string> sqls;
+    bool table_exists = db.exists(table_name, & err);
+
+    if (err)
+        throw error {errc::storage_error, err.what()};
 
-    if (!db.exists(table_name, & err)) {
+    if (!table_exists) {
         auto chat_table = data_definition_t::create_table(table_name);
         chat_table.add_column<decltype(message::message_credentials::message_id)>("message_id").unique();
         chat_table.add_column<decltype(message::message_credentials::author_id)>("author_id");
@@ -44,13 +89,35 @@ sqlite3::chat::chat (contact::id an_author_id, contact::id a_chat_id, relational
         chat_table.add_column<decltype(message::message_credentials::modification_time)>("modification_time");
         chat_table.add_column<decltype(*message::message_credentials::delivered_time)>("delivered_time").nullable();
         chat_table.add_column<decltype(*message::message_credentials::read_time)>("read_time").nullable();
-        chat_table.add_column<std::string>("content").nullable();
+        chat_table.add_column<std::vector<char>>("content").nullable();
+        chat_table.add_column<std::int32_t>("content_kinds");
 
-        std::array<std::string, 1> sqls = {
-            chat_table.build()
-        };
+        sqls.push_back(chat_table.build());
+    }
+
+    pdb = & db;
+
+    // Index tables are created by message store if FTS5 is available
+    index_table_name = message_index_table_name();
+    index_enabled = db.exists(index_table_name, & err);
+
+    if (err)
+        throw error {errc::storage_error, err.what()};
+
+    // Tables created by previous versions are upgraded here too.
+    bool kinds_missing = table_exists && !has_content_kinds();
+
+    if (kinds_missing) {
+        sqls.push_back(fmt::format("ALTER TABLE \"{}\" ADD COLUMN content_kinds INTEGER NOT NULL DEFAULT 0"
+            , table_name));
+    }
+
+    for (auto & sql: missing_indexes(table_exists))
+        sqls.push_back(std::move(sql));
 
-        auto failure = db.transaction([& sqls, & db] () {
+    if (!sqls.empty()) {
+        // Savepoint is used since chat can be opened inside a transaction (e.g. batch processing)
+        auto failure = storage::with_savepoint(db, "open_chat", [this, & sqls, & db, kinds_missing] () {
             debby::error err;
 
             for (auto const & sql: sqls) {
@@ -60,17 +127,417 @@ sqlite3::chat::chat (contact::id an_author_id, contact::id a_chat_id, relational
                     return pfs::make_optional(std::string{err.what()});
             }
 
-            return pfs::optional<std::string>{};
+            if (kinds_missing)
+                update_content_kinds(& err);
+
+            return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
         });
 
         if (failure)
             throw error {errc::storage_error, failure.value()};
     }
 
+    init_counters();
+}
+
+void sqlite3::chat::init_counters ()
+{
+    static std::string const SELECT_COUNTERS_EXISTS {
+        "SELECT 1 FROM \"{}\" WHERE chat_id = :chat_id"
+    };
+
+    debby::error err;
+    bool exists = false;
+    auto stmt = pdb->prepare_cached(fmt::format(SELECT_COUNTERS_EXISTS, counters_table_name), & err);
+
+    if (!err) {
+        stmt.bind(":chat_id", chat_id, & err);
+
+        if (!err) {
+            auto res = stmt.exec(& err);
+
+            if (!err)
+                exists = res.has_more();
+        }
+    }
+
+    // Chat created by previous version or counters were dropped
+    if (!err && !exists)
+        recount(*pdb, table_name, chat_id, author_id, & err);
+
     if (err)
-        throw error {errc::storage_error, err.what()};
+        throw error {errc::storage_error, tr::_("initialize chat counters failure"), err.what()};
+}
 
-    pdb = & db;
+void sqlite3::chat::recount (relational_database_t & db, std::string const & table_name
+    , contact::id chat_id, contact::id me, debby::error * perr)
+{
+    static std::string const RECOUNT {
+        "INSERT OR REPLACE INTO \"{}\" (chat_id, total, unread)"
+        " SELECT :chat_id, COUNT(1), IFNULL(SUM(read_time IS NULL AND author_id != :author_id), 0)"
+        " FROM \"{}\""
+    };
+
+    auto stmt = db.prepare_cached(fmt::format(RECOUNT, chat_counters_table_name(), table_name), perr);
+
+    if (!*perr) {
+        stmt.bind(":chat_id", chat_id, perr)
+            && stmt.bind(":author_id", me, perr);
+
+        if (!*perr)
+            stmt.exec(perr);
+    }
+}
+
+void sqlite3::chat::adjust_counters (int total_delta, int unread_delta, debby::error * perr)
+{
+    static std::string const UPDATE_COUNTERS {
+        "UPDATE \"{}\" SET total = total + :total, unread = unread + :unread"
+        " WHERE chat_id = :chat_id"
+    };
+
+    if (total_delta == 0 && unread_delta == 0)
+        return;
+
+    auto stmt = pdb->prepare_cached(fmt::format(UPDATE_COUNTERS, counters_table_name), perr);
+
+    if (!*perr) {
+        stmt.bind(":total", total_delta, perr)
+            && stmt.bind(":unread", unread_delta, perr)
+            && stmt.bind(":chat_id", chat_id, perr);
+
+        if (!*perr)
+            stmt.exec(perr);
+    }
+}
+
+void sqlite3::chat::uncount_message (message::id message_id, bool total, debby::error * perr)
+{
+    // Partial index `unread` is used for the unread subquery
+    static std::string const UNCOUNT_MESSAGE {
+        "UPDATE \"{0}\" SET"
+        " total = total - :total * (SELECT COUNT(1) FROM \"{1}\" WHERE message_id = :message_id)"
+        ", unread = unread - (SELECT COUNT(1) FROM \"{1}\" WHERE message_id = :message_id"
+            " AND read_time IS NULL AND author_id != :author_id)"
+        " WHERE chat_id = :chat_id"
+    };
+
+    auto stmt = pdb->prepare_cached(fmt::format(UNCOUNT_MESSAGE, counters_table_name, table_name), perr);
+
+    if (!*perr) {
+        stmt.bind(":total", total ? 1 : 0, perr)
+            && stmt.bind(":message_id", message_id, perr)
+            && stmt.bind(":author_id", author_id, perr)
+            && stmt.bind(":chat_id", chat_id, perr);
+
+        if (!*perr)
+            stmt.exec(perr);
+    }
+}
+
+std::string sqlite3::chat::index_map_table_name (std::string const & index_table_name)
+{
+    return index_table_name + "_map";
+}
+
+bool sqlite3::chat::create_index (relational_database_t & db, std::string const & index_table_name
+    , debby::error * perr)
+{
+    // Index document identifier (rowid of the FTS table) is the `docid` of the map table.
+    // Trigram tokenizer allows to search arbitrary substrings (as message_searcher does),
+    // not only word prefixes.
+    static std::string const CREATE_FTS_TABLE {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS \"{}\" USING fts5(text, attachment"
+        ", tokenize = 'trigram case_sensitive 0')"
+    };
+
+    static std::string const CREATE_MAP_INDEX {
+        "CREATE UNIQUE INDEX IF NOT EXISTS \"{0}_key\" ON \"{0}\" (chat_id, message_id)"
+    };
+
+    debby::error err;
+    db.query(fmt::format(CREATE_FTS_TABLE, index_table_name), & err);
+
+    // SQLite is built without FTS5 (or trigram tokenizer)
+    if (err)
+        return false;
+
+    auto map_table_name = index_map_table_name(index_table_name);
+    auto map_table = data_definition_t::create_table(map_table_name);
+    map_table.add_column<std::int64_t>("docid").primary_key();
+    map_table.add_column<contact::id>("chat_id");
+    map_table.add_column<message::id>("message_id");
+
+    db.query(map_table.build(), perr);
+
+    if (!*perr)
+        db.query(fmt::format(CREATE_MAP_INDEX, map_table_name), perr);
+
+    return true;
+}
+
+void sqlite3::chat::index_document (relational_database_t & db, std::string const & index_table_name
+    , contact::id chat_id, message::id message_id, message::content const & contents
+    , debby::error * perr)
+{
+    static std::string const INSERT_KEY {
+        "INSERT OR IGNORE INTO \"{1}\" (chat_id, message_id) VALUES (:chat_id, :message_id)"
+    };
+
+    static std::string const DELETE_DOCUMENT {
+        "DELETE FROM \"{0}\" WHERE rowid ="
+        " (SELECT docid FROM \"{1}\" WHERE chat_id = :chat_id AND message_id = :message_id)"
+    };
+
+    static std::string const INSERT_DOCUMENT {
+        "INSERT INTO \"{0}\" (rowid, text, attachment)"
+        " SELECT docid, :text, :attachment FROM \"{1}\" WHERE chat_id = :chat_id AND message_id = :message_id"
+    };
+
+    // Statements placeholders: {0} - index table, {1} - map table
+    std::string text;
+    std::string attachment;
+
+    for (std::size_t i = 0, count = contents.count(); i < count; i++) {
+        auto cc = contents.at(i);
+        bool is_text_content = cc.mime == mime::mime_enum::text__plain
+            || cc.mime == mime::mime_enum::text__html;
+        auto & target = is_text_content ? text : attachment;
+
+        if (!target.empty())
+            target += '\n';
+
+        // HTML tags are not indexed
+        target += cc.mime == mime::mime_enum::text__html ? contents.plain_text(i) : cc.text;
+    }
+
+    auto map_table_name = index_map_table_name(index_table_name);
+
+    for (auto const * sql: {& INSERT_KEY, & DELETE_DOCUMENT, & INSERT_DOCUMENT}) {
+        auto stmt = db.prepare_cached(fmt::format(*sql, index_table_name, map_table_name), perr);
+
+        if (!*perr) {
+            stmt.bind(":chat_id", chat_id, perr)
+                && stmt.bind(":message_id", message_id, perr);
+
+            if (!*perr && sql == & INSERT_DOCUMENT) {
+                stmt.bind(":text", text, perr)
+                    && stmt.bind(":attachment", attachment, perr);
+            }
+
+            if (!*perr)
+                stmt.exec(perr);
+        }
+
+        if (*perr)
+            break;
+    }
+}
+
+void sqlite3::chat::index_message (message::id message_id, message::content const & contents
+    , debby::error * perr)
+{
+    if (index_enabled)
+        index_document(*pdb, index_table_name, chat_id, message_id, contents, perr);
+}
+
+void sqlite3::chat::unindex_message (message::id message_id, debby::error * perr)
+{
+    static std::string const DELETE_DOCUMENT {
+        "DELETE FROM \"{0}\" WHERE rowid ="
+        " (SELECT docid FROM \"{1}\" WHERE chat_id = :chat_id AND message_id = :message_id)"
+    };
+
+    static std::string const DELETE_KEY {
+        "DELETE FROM \"{1}\" WHERE chat_id = :chat_id AND message_id = :message_id"
+    };
+
+    if (!index_enabled)
+        return;
+
+    auto map_table_name = index_map_table_name(index_table_name);
+
+    for (auto const * sql: {& DELETE_DOCUMENT, & DELETE_KEY}) {
+        auto stmt = pdb->prepare_cached(fmt::format(*sql, index_table_name, map_table_name), perr);
+
+        if (!*perr) {
+            stmt.bind(":chat_id", chat_id, perr)
+                && stmt.bind(":message_id", message_id, perr);
+
+            if (!*perr)
+                stmt.exec(perr);
+        }
+
+        if (*perr)
+            break;
+    }
+}
+
+void sqlite3::chat::unindex_all (debby::error * perr)
+{
+    static std::string const DELETE_DOCUMENTS {
+        "DELETE FROM \"{0}\" WHERE rowid IN (SELECT docid FROM \"{1}\" WHERE chat_id = :chat_id)"
+    };
+
+    static std::string const DELETE_KEYS {
+        "DELETE FROM \"{1}\" WHERE chat_id = :chat_id"
+    };
+
+    if (!index_enabled)
+        return;
+
+    auto map_table_name = index_map_table_name(index_table_name);
+
+    for (auto const * sql: {& DELETE_DOCUMENTS, & DELETE_KEYS}) {
+        auto stmt = pdb->prepare_cached(fmt::format(*sql, index_table_name, map_table_name), perr);
+
+        if (!*perr) {
+            stmt.bind(":chat_id", chat_id, perr);
+
+            if (!*perr)
+                stmt.exec(perr);
+        }
+
+        if (*perr)
+            break;
+    }
+}
+
+std::pair<std::size_t, std::size_t> sqlite3::chat::counters () const
+{
+    static std::string const SELECT_COUNTERS {
+        "SELECT total, unread FROM \"{}\" WHERE chat_id = :chat_id"
+    };
+
+    std::pair<std::size_t, std::size_t> result {0, 0};
+    debby::error err;
+    auto stmt = pdb->prepare_cached(fmt::format(SELECT_COUNTERS, counters_table_name), & err);
+
+    if (!err) {
+        stmt.bind(":chat_id", chat_id, & err);
+
+        if (!err) {
+            auto res = stmt.exec(& err);
+
+            if (!err && res.has_more()) {
+                result.first = res.get_or("total", std::size_t{0});
+                result.second = res.get_or("unread", std::size_t{0});
+            }
+        }
+    }
+
+    if (err)
+        throw error {errc::storage_error, tr::_("fetch chat counters failure"), err.what()};
+
+    return result;
+}
+
+bool sqlite3::chat::has_content_kinds () const
+{
+    debby::error err;
+    bool found = false;
+    auto res = pdb->exec(fmt::format("PRAGMA table_info(\"{}\")", table_name), & err);
+
+    if (!err) {
+        for (; res.has_more(); res.next()) {
+            if (res.get_or("name", std::string{}) == "content_kinds")
+                found = true;
+        }
+    }
+
+    if (err)
+        throw error {errc::storage_error, tr::_("fetch chat table columns failure"), err.what()};
+
+    return found;
+}
+
+void sqlite3::chat::update_content_kinds (debby::error * perr)
+{
+    static std::string const SELECT_CONTENT {
+        "SELECT rowid AS rid, content FROM \"{}\" WHERE content IS NOT NULL"
+    };
+
+    static std::string const UPDATE_KINDS {
+        "UPDATE \"{}\" SET content_kinds = :kinds WHERE rowid = :rid"
+    };
+
+    std::vector<std::pair<std::int64_t, std::int32_t>> rows;
+    auto res = pdb->exec(fmt::format(SELECT_CONTENT, table_name), perr);
+
+    if (*perr)
+        return;
+
+    for (; res.has_more(); res.next()) {
+        auto rid = res.get_or("rid", std::int64_t{0});
+        auto content_data = res.get_or("content", std::string{});
+
+        if (!content_data.empty()) {
+            auto kinds = static_cast<std::int32_t>(message::content{std::move(content_data)}.kinds());
+
+            if (kinds != 0)
+                rows.emplace_back(rid, kinds);
+        }
+    }
+
+    for (auto const & row: rows) {
+        auto stmt = pdb->prepare_cached(fmt::format(UPDATE_KINDS, table_name), perr);
+
+        if (!*perr) {
+            stmt.bind(":kinds", row.second, perr)
+                && stmt.bind(":rid", row.first, perr);
+
+            if (!*perr)
+                stmt.exec(perr);
+        }
+
+        if (*perr)
+            return;
+    }
+}
+
+std::vector<std::string> sqlite3::chat::missing_indexes (bool table_exists) const
+{
+    static std::string const SELECT_INDEXES {
+        "SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = :table_name"
+    };
+
+    static std::string const CREATE_INDEX {
+        "CREATE INDEX IF NOT EXISTS \"{}\" ON \"{}\" {}"
+    };
+
+    std::set<std::string> existing_indexes;
+
+    if (table_exists) {
+        debby::error err;
+        auto stmt = pdb->prepare_cached(SELECT_INDEXES, & err);
+
+        if (!err) {
+            stmt.bind(":table_name", std::string{table_name}, & err);
+
+            if (!err) {
+                auto res = stmt.exec(& err);
+
+                if (!err) {
+                    for (; res.has_more(); res.next())
+                        existing_indexes.insert(res.get_or(0, std::string{}));
+                }
+            }
+        }
+
+        if (err)
+            throw error {errc::storage_error, tr::_("fetch chat indexes failure"), err.what()};
+    }
+
+    std::vector<std::string> result;
+
+    for (auto const & x: CHAT_INDEXES) {
+        auto index_name = fmt::format("{}_{}_index", table_name, x.first);
+
+        if (existing_indexes.find(index_name) == existing_indexes.end())
+            result.push_back(fmt::format(CREATE_INDEX, index_name, table_name, x.second));
+    }
+
+    return result;
 }
 
 void sqlite3::chat::invalidate_cache ()
@@ -78,13 +545,213 @@ void sqlite3::chat::invalidate_cache ()
     cache.dirty = true;
 }
 
-void sqlite3::chat::prefetch (int offset, int limit, int sort_flags)
+static std::string const SELECT_MESSAGES_PREFIX { "SELECT {} FROM \"{}\"" };
+
+std::vector<char> sqlite3::chat::content_blob (pfs::string_view data)
+{
+    return std::vector<char>(data.begin(), data.end());
+}
+
+char const * sqlite3::chat::message_columns (message_projection projection)
+{
+    if (projection == message_projection::headers) {
+        return "message_id, author_id, creation_time, modification_time, delivered_time, read_time";
+    }
+
+    return "message_id, author_id, creation_time, modification_time, delivered_time, read_time, content";
+}
+
+chat_sort_flag sqlite3::chat::sort_field (int sort_flags)
+{
+    if (sort_flag_on(sort_flags, chat_sort_flag::by_id))
+        return chat_sort_flag::by_id;
+    else if (sort_flag_on(sort_flags, chat_sort_flag::by_creation_time))
+        return chat_sort_flag::by_creation_time;
+    else if (sort_flag_on(sort_flags, chat_sort_flag::by_modification_time))
+        return chat_sort_flag::by_modification_time;
+    else if (sort_flag_on(sort_flags, chat_sort_flag::by_delivered_time))
+        return chat_sort_flag::by_delivered_time;
+    else if (sort_flag_on(sort_flags, chat_sort_flag::by_read_time))
+        return chat_sort_flag::by_read_time;
+
+    return chat_sort_flag::by_id;
+}
+
+std::string sqlite3::chat::sort_key (int sort_flags)
+{
+    // NULL values for delivered/read time are replaced by zero to make row values comparable
+    // (see `seek()`). Indexes must be created on the same expressions.
+    switch (sort_field(sort_flags)) {
+        case chat_sort_flag::by_creation_time:
+            return "creation_time";
+        case chat_sort_flag::by_modification_time:
+            return "modification_time";
+        case chat_sort_flag::by_delivered_time:
+            return "IFNULL(delivered_time, 0)";
+        case chat_sort_flag::by_read_time:
+            return "IFNULL(read_time, 0)";
+        default:
+            break;
+    }
+
+    return "rowid";
+}
+
+bool sqlite3::chat::is_descending (int sort_flags)
+{
+    return !sort_flag_on(sort_flags, chat_sort_flag::ascending_order)
+        && sort_flag_on(sort_flags, chat_sort_flag::descending_order);
+}
+
+// Returns key columns and ORDER BY clause for the sort key `key`.
+static std::pair<std::string, std::string> keyset_columns (std::string const & key, bool descending)
+{
+    char const * order = descending ? "DESC" : "ASC";
+
+    if (key == "rowid")
+        return std::make_pair(key, fmt::format("rowid {}", order));
+
+    return std::make_pair(fmt::format("{}, rowid", key), fmt::format("{0} {1}, rowid {1}", key, order));
+}
+
+std::string sqlite3::chat::filter_condition (message_filter const & filter)
+{
+    std::vector<std::string> conditions;
+
+    if (filter.since)
+        conditions.emplace_back("creation_time >= :since");
+
+    if (filter.until)
+        conditions.emplace_back("creation_time < :until");
+
+    if (!filter.authors.empty()) {
+        std::string placeholders;
+
+        for (std::size_t i = 0; i < filter.authors.size(); i++) {
+            if (i > 0)
+                placeholders += ", ";
+
+            placeholders += fmt::format(":author{}", i);
+        }
+
+        conditions.push_back(fmt::format("author_id IN ({})", placeholders));
+    }
+
+    if (filter.has_attachment)
+        conditions.push_back(fmt::format("(content_kinds & {}) != 0"
+            , static_cast<std::uint32_t>(message::content_kind::attachment)));
+
+    if (filter.content_kinds != 0)
+        conditions.emplace_back("(content_kinds & :kinds) != 0");
+
+    std::string result;
+
+    for (auto const & c: conditions) {
+        if (!result.empty())
+            result += " AND ";
+
+        result += c;
+    }
+
+    return result;
+}
+
+// Binds parameters of the condition returned by `filter_condition()`.
+template <typename Statement>
+static void bind_filter (Statement & stmt, message_filter const & filter, debby::error * perr)
+{
+    if (!*perr && filter.since)
+        stmt.bind(":since", *filter.since, perr);
+
+    if (!*perr && filter.until)
+        stmt.bind(":until", *filter.until, perr);
+
+    for (std::size_t i = 0; !*perr && i < filter.authors.size(); i++) {
+        auto name = fmt::format(":author{}", i);
+        stmt.bind(name.c_str(), filter.authors[i], perr);
+    }
+
+    if (!*perr && filter.content_kinds != 0)
+        stmt.bind(":kinds", static_cast<std::int32_t>(filter.content_kinds), perr);
+}
+
+void sqlite3::chat::seek (message::id anchor_id, bool forward, bool inclusive, int skip, int limit
+    , int sort_flags, std::function<void(message::message_credentials &&)> f
+    , message_filter const & filter)
 {
-    static std::string const SELECT_ROWS_RANGE {
-        "SELECT message_id, author_id, creation_time, modification_time, delivered_time, read_time"
-        ", content FROM \"{}\" ORDER BY {} {} LIMIT {} OFFSET {}"
+    static std::string const ANCHOR_CONDITION {
+        "({0}) {1} (SELECT {0} FROM \"{2}\" WHERE message_id = :anchor_id)"
     };
 
+    static std::string const ORDER_AND_LIMIT { " ORDER BY {} LIMIT :limit OFFSET :skip" };
+
+    // Backward fetching is the forward fetching in the reverse order.
+    bool descending = is_descending(sort_flags) ? forward : !forward;
+    auto cols = keyset_columns(sort_key(sort_flags), descending);
+    bool has_anchor = anchor_id != message::id{};
+
+    auto sql = fmt::format(SELECT_MESSAGES_PREFIX, message_columns(message_projection::full), table_name);
+    auto where = filter_condition(filter);
+
+    if (has_anchor) {
+        std::string op = descending ? "<" : ">";
+
+        if (inclusive)
+            op += "=";
+
+        auto anchor_condition = fmt::format(ANCHOR_CONDITION, cols.first, op, table_name);
+        where = where.empty() ? anchor_condition : anchor_condition + " AND " + where;
+    }
+
+    if (!where.empty())
+        sql += " WHERE " + where;
+
+    sql += fmt::format(ORDER_AND_LIMIT, cols.second);
+
+    std::vector<message::message_credentials> backward_data;
+    debby::error err;
+    auto stmt = pdb->prepare_cached(sql, & err);
+
+    if (!err) {
+        if (has_anchor)
+            stmt.bind(":anchor_id", anchor_id, & err);
+
+        bind_filter(stmt, filter, & err);
+
+        if (!err) {
+            stmt.bind(":limit", limit, & err)
+                && stmt.bind(":skip", skip, & err);
+        }
+
+        if (!err) {
+            auto res = stmt.exec(& err);
+
+            if (!err) {
+                for (; res.has_more(); res.next()) {
+                    message::message_credentials m;
+                    fill_message(res, m);
+
+                    if (forward)
+                        f(std::move(m));
+                    else
+                        backward_data.push_back(std::move(m));
+                }
+            }
+        }
+    }
+
+    if (err)
+        throw error {errc::storage_error, tr::_("fetch messages failure"), err.what()};
+
+    for (auto pos = backward_data.rbegin(); pos != backward_data.rend(); ++pos)
+        f(std::move(*pos));
+}
+
+void sqlite3::chat::prefetch (int offset, int limit, int sort_flags)
+{
+    // Statement is cached per table, sort field and order
+    static std::string const SELECT_ROWS_RANGE { " ORDER BY {} LIMIT :limit OFFSET :offset" };
+
     bool prefetch_required = cache.dirty
         || offset < cache.offset
         || offset + limit > cache.offset + cache.limit
@@ -93,6 +760,15 @@ void sqlite3::chat::prefetch (int offset, int limit, int sort_flags)
     if (!prefetch_required)
         return;
 
+    // Positions of messages are unknown after modifications or for another sort order.
+    if (cache.dirty || sort_flags != cache.sort_flags)
+        cache.anchors.clear();
+
+    // Align window to the page boundaries, so sequential scrolling in both
+    // directions starts exactly from the known anchors.
+    if (limit > 0)
+        offset -= offset % limit;
+
     cache.data.clear();
     cache.map.clear();
     cache.offset = offset;
@@ -100,54 +776,212 @@ void sqlite3::chat::prefetch (int offset, int limit, int sort_flags)
     cache.dirty = true;
     cache.sort_flags = sort_flags;
 
-    std::string field = "rowid";
-    std::string order = "ASC";
+    auto append = [this] (message::message_credentials && m) {
+        cache.data.push_back(std::move(m));
+        cache.map.emplace(cache.data.back().message_id, cache.data.size() - 1);
+        cache.limit++;
+    };
 
-    if (sort_flag_on(sort_flags, chat_sort_flag::by_id))
-        field = "rowid";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_creation_time))
-        field = "creation_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_modification_time))
-        field = "modification_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_delivered_time))
-        field = "delivered_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_read_time))
-        field = "read_time";
+    // Nearest known anchor at or before the window start.
+    auto below = cache.anchors.upper_bound(offset);
+    bool has_below = below != cache.anchors.begin();
 
-    if (sort_flag_on(sort_flags, chat_sort_flag::ascending_order))
-        order = "ASC";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::descending_order))
-        order = "DESC";
+    if (has_below)
+        --below;
 
-    debby::error err;
-    auto res = pdb->exec(fmt::format(SELECT_ROWS_RANGE, table_name, field, order
-        , limit, offset), & err);
+    // Nearest known anchor after the window end.
+    auto above = cache.anchors.lower_bound(offset + limit);
+    bool has_above = above != cache.anchors.end();
 
-    if (!err) {
-        for (; res.has_more(); res.next()) {
-            cache.data.emplace_back();
-            message::message_credentials * m = & cache.data.back();
-            fill_message(res, *m);
-            cache.map.emplace(m->message_id, cache.data.size() - 1);
-            cache.limit++;
+    // Number of rows SQLite need to skip. Plain OFFSET skips all rows before window.
+    int below_skip = has_below ? offset - below->first : offset;
+    int above_skip = has_above ? above->first - (offset + limit) : offset;
+
+    if (has_above && above_skip < below_skip) {
+        seek(above->second, false, false, above_skip, limit, sort_flags, append);
+    } else if (has_below && below_skip < offset) {
+        seek(below->second, true, true, below_skip, limit, sort_flags, append);
+    } else {
+        auto cols = keyset_columns(sort_key(sort_flags), is_descending(sort_flags));
+
+        debby::error err;
+        auto stmt = pdb->prepare_cached(fmt::format(SELECT_MESSAGES_PREFIX, message_columns(message_projection::full), table_name)
+            + fmt::format(SELECT_ROWS_RANGE, cols.second), & err);
+
+        if (!err) {
+            stmt.bind(":limit", limit, & err)
+                && stmt.bind(":offset", offset, & err);
+
+            if (!err) {
+                auto res = stmt.exec(& err);
+
+                if (!err) {
+                    for (; res.has_more(); res.next()) {
+                        message::message_credentials m;
+                        fill_message(res, m);
+                        append(std::move(m));
+                    }
+                }
+            }
         }
     }
 
-    cache.dirty = false;
+    cache.at_end = cache.limit < limit;
+    record_window_anchors();
+    cache.dirty = false;
+}
+
+// Sort key value of the message (see `sort_key()`), not applicable for `by_id`.
+static pfs::utc_time_point sort_key_value (message::message_credentials const & m, chat_sort_flag field)
+{
+    switch (field) {
+        case chat_sort_flag::by_creation_time:
+            return m.creation_time;
+        case chat_sort_flag::by_modification_time:
+            return m.modification_time;
+        case chat_sort_flag::by_delivered_time:
+            return m.delivered_time ? *m.delivered_time : pfs::utc_time_point{};
+        case chat_sort_flag::by_read_time:
+            return m.read_time ? *m.read_time : pfs::utc_time_point{};
+        default:
+            break;
+    }
+
+    return pfs::utc_time_point{};
+}
+
+void sqlite3::chat::record_window_anchors ()
+{
+    if (cache.limit > 0) {
+        cache.anchors[cache.offset] = cache.data.front().message_id;
+        cache.anchors[cache.offset + cache.limit - 1] = cache.data.back().message_id;
+    }
+}
+
+void sqlite3::chat::reset_window_anchors (int first_shifted)
+{
+    // Positions starting from `first_shifted` are not valid any more.
+    cache.anchors.erase(cache.anchors.lower_bound(first_shifted), cache.anchors.end());
+    record_window_anchors();
+}
+
+void sqlite3::chat::cache_update (message::id message_id, chat_sort_flag modified_field
+    , std::function<void(message::message_credentials &)> patch)
+{
+    if (cache.dirty)
+        return;
+
+    // Message position may change
+    if (sort_field(cache.sort_flags) == modified_field) {
+        invalidate_cache();
+        return;
+    }
+
+    auto pos = cache.map.find(message_id);
+
+    // Message is out of the window, positions are not affected.
+    if (pos == cache.map.end())
+        return;
+
+    patch(cache.data[pos->second]);
+}
+
+void sqlite3::chat::cache_insert (message::message_credentials && m)
+{
+    if (cache.dirty)
+        return;
+
+    auto field = sort_field(cache.sort_flags);
+    bool descending = is_descending(cache.sort_flags);
+
+    // Number of window messages preceding the new one. The new message has
+    // the greatest rowid, so it follows messages with the same key in ascending
+    // order and precedes them in descending order.
+    int n = cache.limit;
+
+    if (field == chat_sort_flag::by_id) {
+        n = descending ? 0 : cache.limit;
+    } else {
+        auto key = sort_key_value(m, field);
+
+        while (n > 0) {
+            auto prev_key = sort_key_value(cache.data[n - 1], field);
+
+            if (descending ? key < prev_key : !(key < prev_key))
+                break;
+
+            n--;
+        }
+    }
+
+    if (n == cache.limit) {
+        // After the window, window content is unchanged
+        if (!cache.at_end) {
+            reset_window_anchors(cache.offset + cache.limit);
+            return;
+        }
+    } else if (n == 0 && cache.offset > 0) {
+        // Position before the window is unknown
+        invalidate_cache();
+        return;
+    }
+
+    cache.data.insert(cache.data.begin() + n, std::move(m));
+    cache.limit++;
+
+    for (auto & x: cache.map) {
+        if (x.second >= static_cast<std::size_t>(n))
+            x.second++;
+    }
+
+    cache.map.emplace(cache.data[n].message_id, static_cast<std::size_t>(n));
+    reset_window_anchors(cache.offset + n);
+}
+
+void sqlite3::chat::cache_remove (message::id message_id)
+{
+    if (cache.dirty)
+        return;
+
+    auto pos = cache.map.find(message_id);
+
+    // Position of the message is unknown
+    if (pos == cache.map.end()) {
+        invalidate_cache();
+        return;
+    }
+
+    auto n = pos->second;
+    cache.map.erase(pos);
+    cache.data.erase(cache.data.begin() + n);
+    cache.limit--;
+
+    for (auto & x: cache.map) {
+        if (x.second > n)
+            x.second--;
+    }
+
+    reset_window_anchors(cache.offset + static_cast<int>(n));
 }
 
-void sqlite3::chat::fill_message (relational_database_t::result_type & result, message::message_credentials & m)
+void sqlite3::chat::fill_message (relational_database_t::result_type & result, message::message_credentials & m
+    , message_projection projection)
 {
     m.message_id        = result.get_or("message_id", message::id{});
     m.author_id         = result.get_or("author_id", contact::id{});
     m.creation_time     = result.get_or("creation_time", pfs::utc_time_point{});
     m.modification_time = result.get_or("modification_time", pfs::utc_time_point{});
-    m.delivered_time    = result.get_or("delivered_time", pfs::utc_time_point{});
-    m.read_time         = result.get_or("read_time", pfs::utc_time_point{});
-    auto content_data   = result.get<std::string>("content");
+    m.delivered_time    = result.get<pfs::utc_time_point>("delivered_time");
+    m.read_time         = result.get<pfs::utc_time_point>("read_time");
+
+    if (projection == message_projection::headers)
+        return;
+
+    auto content_data = result.get<std::string>("content");
 
-    if (content_data)
-        m.contents = message::content {*content_data};
+    // Empty content is not set, content is decoded on first access
+    if (content_data && !content_data->empty())
+        m.contents = message::content {std::move(*content_data)};
 }
 
 } // namespace storage
@@ -183,6 +1017,11 @@ chat_t::chat (rep * d) noexcept
     : _d(d)
 {}
 
+template <>
+chat_t::chat (std::shared_ptr<rep> d) noexcept
+    : _d(std::move(d))
+{}
+
 template <> chat_t::~chat () = default;
 
 template <>
@@ -200,39 +1039,13 @@ contact::id chat_t::id () const noexcept
 template <>
 std::size_t chat_t::count () const
 {
-    return _d->pdb->rows_count(_d->table_name);
+    return _d->counters().first;
 }
 
 template <>
 std::size_t chat_t::unread_message_count () const
 {
-    static std::string const UNREAD_MESSAGES_COUNT {
-        "SELECT COUNT(1) as count FROM \"{}\" WHERE read_time IS NULL AND author_id != :author_id"
-    };
-
-    std::size_t count = 0;
-    debby::error err;
-    auto stmt = _d->pdb->prepare_cached(fmt::format(UNREAD_MESSAGES_COUNT, _d->table_name), & err);
-
-    if (!err) {
-        stmt.bind(":author_id", _d->author_id, & err);
-
-        if (!err) {
-            auto res = stmt.exec(& err);
-
-            if (!err) {
-                if (res.has_more()) {
-                    count = res.get_or(0, std::size_t{0});
-                    res.next();
-                }
-            }
-        }
-    }
-
-    if (err)
-        throw error { errc::storage_error, tr::f_("get unread message count failure: {}", err.what()) };
-
-    return count;
+    return _d->counters().second;
 }
 
 static void mark_message_status (relational_database_t * pdb
@@ -276,7 +1089,11 @@ void chat_t::mark_delivered (message::id message_id, pfs::utc_time_point deliver
     };
 
     mark_message_status(_d->pdb, UPDATE_DELIVERED_TIME, _d->table_name, message_id, delivered_time, "delivered");
-    _d->invalidate_cache();
+
+    _d->cache_update(message_id, chat_sort_flag::by_delivered_time
+        , [& delivered_time] (message::message_credentials & m) {
+            m.delivered_time = delivered_time;
+        });
 }
 
 template <>
@@ -286,8 +1103,284 @@ void chat_t::mark_read (message::id message_id, pfs::utc_time_point read_time)
         "UPDATE OR IGNORE \"{}\" SET read_time = :time WHERE message_id = :message_id"
     };
 
-    mark_message_status(_d->pdb, UPDATE_READ_TIME, _d->table_name, message_id, read_time, "read");
-    _d->invalidate_cache();
+    auto failure = storage::with_savepoint(*_d->pdb, "mark_read", [this, message_id, & read_time] {
+        debby::error err;
+
+        // Must precede the marking
+        _d->uncount_message(message_id, false, & err);
+
+        if (err)
+            return pfs::make_optional(std::string{err.what()});
+
+        mark_message_status(_d->pdb, UPDATE_READ_TIME, _d->table_name, message_id, read_time, "read");
+        return pfs::optional<std::string>{};
+    });
+
+    if (failure) {
+        throw error {
+              errc::storage_error, tr::f_("message ({}) mark as {} failure", message_id, "read")
+            , *failure
+        };
+    }
+
+    _d->cache_update(message_id, chat_sort_flag::by_read_time
+        , [& read_time] (message::message_credentials & m) {
+            m.read_time = read_time;
+        });
+}
+
+namespace storage {
+
+// Number of parameters in the `IN (...)` list of set-based statements. Shorter lists are
+// padded by repeating the last identifier, so one prepared statement is cached for any
+// number of identifiers.
+static constexpr std::size_t ID_LIST_SIZE = 32;
+
+static std::array<std::string, ID_LIST_SIZE> const & id_list_params ()
+{
+    static std::array<std::string, ID_LIST_SIZE> const params = [] {
+        std::array<std::string, ID_LIST_SIZE> result;
+
+        for (std::size_t i = 0; i < ID_LIST_SIZE; i++)
+            result[i] = fmt::format(":id{}", i);
+
+        return result;
+    }();
+
+    return params;
+}
+
+static std::string id_list_placeholders ()
+{
+    std::string result;
+
+    for (auto const & p: id_list_params()) {
+        if (!result.empty())
+            result += ", ";
+
+        result += p;
+    }
+
+    return result;
+}
+
+template <typename Statement>
+static bool bind_id_list (Statement & stmt, std::vector<message::id> const & ids
+    , std::size_t first, debby::error * perr)
+{
+    auto last = (std::min)(first + ID_LIST_SIZE, ids.size()) - 1;
+
+    for (std::size_t i = 0; i < ID_LIST_SIZE; i++) {
+        if (!stmt.bind(id_list_params()[i].c_str(), ids[(std::min)(first + i, last)], perr))
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace storage
+
+namespace storage {
+
+/**
+ * Selects messages from @a message_ids (chunk starting at @a first) not marked yet, i.e.
+ * having NULL value in the @a column.
+ */
+static void select_unmarked (relational_database_t & db, std::string const & table_name
+    , char const * column, std::vector<message::id> const & message_ids, std::size_t first
+    , std::vector<message::id> & result, debby::error * perr)
+{
+    static std::string const SELECT_UNMARKED {
+        "SELECT message_id FROM \"{}\" WHERE message_id IN ({}) AND {} IS NULL"
+    };
+
+    auto stmt = db.prepare_cached(fmt::format(SELECT_UNMARKED, table_name
+        , id_list_placeholders(), column), perr);
+
+    if (!*perr && bind_id_list(stmt, message_ids, first, perr)) {
+        auto res = stmt.exec(perr);
+
+        if (!*perr) {
+            for (; res.has_more(); res.next())
+                result.push_back(res.get_or(0, message::id{}));
+        }
+    }
+}
+
+} // namespace storage
+
+template <>
+std::vector<message::id> chat_t::mark_delivered (std::vector<message::id> const & message_ids
+    , pfs::utc_time_point delivered_time)
+{
+    static std::string const UPDATE_DELIVERED_TIME_BULK {
+        "UPDATE OR IGNORE \"{}\" SET delivered_time = :time"
+        " WHERE message_id IN ({}) AND delivered_time IS NULL"
+    };
+
+    std::vector<message::id> marked;
+
+    if (message_ids.empty())
+        return marked;
+
+    auto failure = storage::with_savepoint(*_d->pdb, "mark_delivered"
+        , [this, & message_ids, & delivered_time, & marked] {
+            debby::error err;
+            auto sql = fmt::format(UPDATE_DELIVERED_TIME_BULK, _d->table_name, storage::id_list_placeholders());
+
+            for (std::size_t first = 0; first < message_ids.size() && !err; first += storage::ID_LIST_SIZE) {
+                storage::select_unmarked(*_d->pdb, _d->table_name, "delivered_time", message_ids
+                    , first, marked, & err);
+
+                if (err)
+                    break;
+
+                auto stmt = _d->pdb->prepare_cached(sql, & err);
+
+                if (!err) {
+                    stmt.bind(":time", delivered_time, & err)
+                        && storage::bind_id_list(stmt, message_ids, first, & err);
+
+                    if (!err)
+                        stmt.exec(& err);
+                }
+            }
+
+            return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+        });
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("mark messages as delivered failure"), *failure};
+
+    for (auto const & message_id: marked) {
+        _d->cache_update(message_id, chat_sort_flag::by_delivered_time
+            , [& delivered_time] (message::message_credentials & m) {
+                m.delivered_time = delivered_time;
+            });
+    }
+
+    return marked;
+}
+
+template <>
+std::vector<message::id> chat_t::mark_read (std::vector<message::id> const & message_ids
+    , pfs::utc_time_point read_time)
+{
+    static std::string const UNCOUNT_UNREAD_BULK {
+        "UPDATE \"{}\" SET unread = unread - (SELECT COUNT(1) FROM \"{}\""
+        " WHERE message_id IN ({}) AND read_time IS NULL AND author_id != :author_id)"
+        " WHERE chat_id = :chat_id"
+    };
+
+    static std::string const UPDATE_READ_TIME_BULK {
+        "UPDATE OR IGNORE \"{}\" SET read_time = :time WHERE message_id IN ({}) AND read_time IS NULL"
+    };
+
+    std::vector<message::id> marked;
+
+    if (message_ids.empty())
+        return marked;
+
+    auto failure = storage::with_savepoint(*_d->pdb, "mark_read"
+        , [this, & message_ids, & read_time, & marked] {
+            debby::error err;
+            auto placeholders = storage::id_list_placeholders();
+            auto uncount_sql = fmt::format(UNCOUNT_UNREAD_BULK, _d->counters_table_name
+                , _d->table_name, placeholders);
+            auto update_sql = fmt::format(UPDATE_READ_TIME_BULK, _d->table_name, placeholders);
+
+            for (std::size_t first = 0; first < message_ids.size() && !err; first += storage::ID_LIST_SIZE) {
+                storage::select_unmarked(*_d->pdb, _d->table_name, "read_time", message_ids
+                    , first, marked, & err);
+
+                if (err)
+                    break;
+
+                // Counter must be updated before marking
+                auto uncount_stmt = _d->pdb->prepare_cached(uncount_sql, & err);
+
+                if (!err) {
+                    uncount_stmt.bind(":author_id", _d->author_id, & err)
+                        && uncount_stmt.bind(":chat_id", _d->chat_id, & err)
+                        && storage::bind_id_list(uncount_stmt, message_ids, first, & err);
+
+                    if (!err)
+                        uncount_stmt.exec(& err);
+                }
+
+                if (err)
+                    break;
+
+                auto stmt = _d->pdb->prepare_cached(update_sql, & err);
+
+                if (!err) {
+                    stmt.bind(":time", read_time, & err)
+                        && storage::bind_id_list(stmt, message_ids, first, & err);
+
+                    if (!err)
+                        stmt.exec(& err);
+                }
+            }
+
+            return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+        });
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("mark messages as read failure"), *failure};
+
+    for (auto const & message_id: marked) {
+        _d->cache_update(message_id, chat_sort_flag::by_read_time
+            , [& read_time] (message::message_credentials & m) {
+                m.read_time = read_time;
+            });
+    }
+
+    return marked;
+}
+
+template <>
+std::vector<message::id> chat_t::mark_read_up_to (message::id message_id
+    , pfs::utc_time_point read_time, bool outgoing)
+{
+    static std::string const SELECT_UNREAD_UP_TO {
+        "SELECT message_id FROM \"{0}\""
+        " WHERE read_time IS NULL AND author_id {1} :author_id"
+        " AND (creation_time, rowid) <= (SELECT creation_time, rowid FROM \"{0}\" WHERE message_id = :message_id)"
+    };
+
+    std::vector<message::id> message_ids;
+
+    auto failure = storage::with_savepoint(*_d->pdb, "mark_read_up_to"
+        , [this, message_id, & read_time, outgoing, & message_ids] {
+            debby::error err;
+            auto stmt = _d->pdb->prepare_cached(fmt::format(SELECT_UNREAD_UP_TO, _d->table_name
+                , outgoing ? "=" : "!="), & err);
+
+            if (!err) {
+                stmt.bind(":author_id", _d->author_id, & err)
+                    && stmt.bind(":message_id", message_id, & err);
+
+                if (!err) {
+                    auto res = stmt.exec(& err);
+
+                    if (!err) {
+                        for (; res.has_more(); res.next())
+                            message_ids.push_back(res.get_or(0, message::id{}));
+                    }
+                }
+            }
+
+            if (err)
+                return pfs::make_optional(std::string{err.what()});
+
+            mark_read(message_ids, read_time);
+            return pfs::optional<std::string>{};
+        });
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("mark messages as read failure"), *failure};
+
+    return message_ids;
 }
 
 template <>
@@ -368,17 +1461,10 @@ chat_t::message (int offset, int sort_flag) const
 
 template <>
 pfs::optional<message::message_credentials>
-chat_t::message (message::id message_id) const
+chat_t::message (message::id message_id, message_projection projection) const
 {
     static std::string const SELECT_MESSAGE {
-        "SELECT message_id"
-            ", author_id"
-            ", creation_time"
-            ", modification_time"
-            ", delivered_time"
-            ", read_time"
-            ", content"
-            " FROM \"{}\" WHERE message_id = :message_id"
+        "SELECT {} FROM \"{}\" WHERE message_id = :message_id"
     };
 
     // Check cache
@@ -388,12 +1474,26 @@ chat_t::message (message::id message_id) const
         if (it != _d->cache.map.end()) {
             PFS__TERMINATE(it->second >= 0 && it->second < _d->cache.data.size()
                 , "Unexpected condition");
+
+            if (projection == message_projection::headers) {
+                auto const & cached = _d->cache.data[it->second];
+                message::message_credentials m;
+                m.message_id = cached.message_id;
+                m.author_id = cached.author_id;
+                m.creation_time = cached.creation_time;
+                m.modification_time = cached.modification_time;
+                m.delivered_time = cached.delivered_time;
+                m.read_time = cached.read_time;
+                return m;
+            }
+
             return _d->cache.data[it->second];
         }
     }
 
     debby::error err;
-    auto stmt = _d->pdb->prepare_cached(fmt::format(SELECT_MESSAGE, _d->table_name), & err);
+    auto stmt = _d->pdb->prepare_cached(fmt::format(SELECT_MESSAGE
+        , storage::sqlite3::chat::message_columns(projection), _d->table_name), & err);
 
     if (!err) {
         stmt.bind(":message_id", message_id, & err);
@@ -403,7 +1503,7 @@ chat_t::message (message::id message_id) const
 
             if (res.has_more()) {
                 message::message_credentials m;
-                _d->fill_message(res, m);
+                _d->fill_message(res, m, projection);
                 return m;
             }
         }
@@ -420,21 +1520,17 @@ pfs::optional<message::message_credentials>
 chat_t::last_message () const
 {
     static std::string const SELECT_LAST_MESSAGE {
-        "SELECT message_id"
-            ", author_id"
-            ", creation_time"
-            ", modification_time"
-            ", delivered_time"
-            ", read_time"
-            ", content"
-            " FROM \"{}\" ORDER BY ROWID DESC LIMIT 1"
+        "SELECT {} FROM \"{}\" ORDER BY rowid DESC LIMIT 1"
     };
 
     debby::error err;
-    auto res = _d->pdb->exec(fmt::format(SELECT_LAST_MESSAGE, _d->table_name), & err);
+    auto stmt = _d->pdb->prepare_cached(fmt::format(SELECT_LAST_MESSAGE
+        , storage::sqlite3::chat::message_columns(message_projection::full), _d->table_name), & err);
 
     if (!err) {
-        if (res.has_more()) {
+        auto res = stmt.exec(& err);
+
+        if (!err && res.has_more()) {
             message::message_credentials m;
             _d->fill_message(res, m);
             return m;
@@ -446,22 +1542,54 @@ chat_t::last_message () const
 
 template <>
 void chat_t::save_incoming (message::id message_id, contact::id author_id
-    , pfs::utc_time_point const & creation_time, std::string const & content)
+    , pfs::utc_time_point const & creation_time, pfs::string_view content)
+{
+    // Validates content before storing
+    save_incoming(message_id, author_id, creation_time, content
+        , content.empty() ? message::content{} : message::content::decode_view(content));
+}
+
+template <>
+void chat_t::save_incoming (message::id message_id, contact::id author_id
+    , pfs::utc_time_point const & creation_time, pfs::string_view content
+    , message::content && decoded)
 {
     static std::string const INSERT_INCOMING_MESSAGE {
-        "INSERT INTO \"{}\" (message_id, author_id, creation_time, modification_time, content)"
-        " VALUES (:message_id, :author_id, :creation_time, :modification_time, :content)"
+        "INSERT INTO \"{}\" (message_id, author_id, creation_time, modification_time, content, content_kinds)"
+        " VALUES (:message_id, :author_id, :creation_time, :modification_time, :content, :kinds)"
     };
 
     static std::string const UPDATE_INCOMING_MESSAGE {
         "UPDATE OR IGNORE \"{}\" SET creation_time = :time"
         ", modification_time = :time"
         ", content = :content"
+        ", content_kinds = :kinds"
         " WHERE message_id = :message_id"
     };
 
+    // Content is stored in binary encoding, JSON source and binary source of previous
+    // versions are converted. Source of the current version is bound as is.
+    pfs::optional<message::content> contents;
+    std::string encoded;
+    pfs::string_view data;
+    std::int32_t kinds = 0;
+
+    if (!content.empty()) {
+        contents = std::move(decoded);
+
+        if (content.size() > 1 && content[0] == '\0'
+                && static_cast<std::uint8_t>(content[1]) == message::content::binary_version) {
+            data = content;
+        } else {
+            encoded = contents->to_binary();
+            data = encoded;
+        }
+
+        kinds = static_cast<std::int32_t>(contents->kinds());
+    }
+
+    auto blob = storage::sqlite3::chat::content_blob(data);
     auto m = message(message_id);
-    debby::error err;
 
     // Message already exists
     if (m) {
@@ -479,8 +1607,8 @@ void chat_t::save_incoming (message::id message_id, contact::id author_id
         }
 
         // Content is different
-        if (m->contents && !content.empty()) {
-            if (m->contents->to_string() != content) {
+        if (m->contents && !data.empty()) {
+            if (pfs::string_view{m->contents->to_binary()} != data) {
                 need_update = true;
             }
         }
@@ -489,122 +1617,257 @@ void chat_t::save_incoming (message::id message_id, contact::id author_id
             need_update = true;
 
         if (need_update) {
-            auto stmt = _d->pdb->prepare_cached(fmt::format(UPDATE_INCOMING_MESSAGE, _d->table_name), & err);
+            auto failure = storage::with_savepoint(*_d->pdb, "save_incoming"
+                , [this, message_id, & creation_time, & blob, kinds, & contents] {
+                    debby::error err;
+                    auto stmt = _d->pdb->prepare_cached(fmt::format(UPDATE_INCOMING_MESSAGE, _d->table_name), & err);
+
+                    if (!err) {
+                        stmt.bind(":time", creation_time, & err)
+                            && stmt.bind(":content", blob, & err)
+                            && stmt.bind(":kinds", kinds, & err)
+                            && stmt.bind(":message_id", message_id, & err);
+
+                        if (!err)
+                            stmt.exec(& err);
+                    }
 
-            if (!err) {
-                stmt.bind(":time", creation_time, & err)
-                    && stmt.bind(":content", std::string{content}, & err)
-                    && stmt.bind(":message_id", message_id, & err);
+                    if (!err && contents)
+                        _d->index_message(message_id, *contents, & err);
 
-                if (!err) {
-                    stmt.exec(& err);
-                    _d->invalidate_cache();
-                }
+                    return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+                });
+
+            if (failure) {
+                throw error {
+                      errc::storage_error, tr::f_("save incoming message failure: {}", message_id)
+                    , *failure
+                };
+            }
+
+            // Both creation and modification times are changed
+            if (storage::sqlite3::chat::sort_field(_d->cache.sort_flags) == chat_sort_flag::by_creation_time) {
+                _d->invalidate_cache();
+            } else {
+                _d->cache_update(message_id, chat_sort_flag::by_modification_time
+                    , [& creation_time, & contents] (message::message_credentials & m) {
+                        m.creation_time = creation_time;
+                        m.modification_time = creation_time;
+
+                        if (contents)
+                            m.contents = *contents;
+                    });
             }
         }
     } else {
-        auto stmt = _d->pdb->prepare_cached(fmt::format(INSERT_INCOMING_MESSAGE, _d->table_name), & err);
-
-        if (!err) {
-            stmt.bind(":message_id", message_id, & err)
-                && stmt.bind(":author_id", author_id, & err)
-                && stmt.bind(":creation_time", creation_time, & err)
-                && stmt.bind(":modification_time", creation_time, & err)
-                && stmt.bind(":content", std::string{content}, & err);
-
-            if (!err) {
-                auto res = stmt.exec(& err);
+        auto failure = storage::with_savepoint(*_d->pdb, "save_incoming"
+            , [this, message_id, author_id, & creation_time, & blob, kinds, & contents] {
+                debby::error err;
+                auto stmt = _d->pdb->prepare_cached(fmt::format(INSERT_INCOMING_MESSAGE, _d->table_name), & err);
 
                 if (!err) {
-                    if (res.rows_affected() == 0) {
-                        throw error {
-                              errc::inconsistent_data
-                            , tr::f_("may be non-unique ID for incoming message: {}", message_id)
-                        };
-                    } else {
-                        _d->invalidate_cache();
+                    stmt.bind(":message_id", message_id, & err)
+                        && stmt.bind(":author_id", author_id, & err)
+                        && stmt.bind(":creation_time", creation_time, & err)
+                        && stmt.bind(":modification_time", creation_time, & err)
+                        && stmt.bind(":content", blob, & err)
+                        && stmt.bind(":kinds", kinds, & err);
+
+                    if (!err) {
+                        auto res = stmt.exec(& err);
+
+                        if (!err && res.rows_affected() == 0) {
+                            throw error {
+                                  errc::inconsistent_data
+                                , tr::f_("may be non-unique ID for incoming message: {}", message_id)
+                            };
+                        }
                     }
                 }
-            }
+
+                if (!err)
+                    _d->adjust_counters(1, author_id != _d->author_id ? 1 : 0, & err);
+
+                if (!err && contents)
+                    _d->index_message(message_id, *contents, & err);
+
+                if (err)
+                    return pfs::make_optional(std::string{err.what()});
+
+                return pfs::optional<std::string>{};
+            });
+
+        if (failure) {
+            throw error {
+                  errc::storage_error, tr::f_("save incoming message failure: {}", message_id)
+                , *failure
+            };
         }
+
+        message::message_credentials m;
+        m.message_id = message_id;
+        m.author_id = author_id;
+        m.creation_time = creation_time;
+        m.modification_time = creation_time;
+
+        m.contents = std::move(contents);
+        _d->cache_insert(std::move(m));
     }
 }
 
 template <>
 void chat_t::for_each (std::function<void(message::message_credentials const &)> f
-    , int sort_flags, int max_count) const
+    , int sort_flags, int max_count, message_projection projection) const
+{
+    for_each(std::move(f), message_filter{}, sort_flags, max_count, projection);
+}
+
+template <>
+void chat_t::for_each (std::function<void(message::message_credentials const &)> f
+    , message_filter const & filter, int sort_flags, int max_count, message_projection projection) const
 {
+    // Negative limit means no limit in SQLite
     static std::string const SELECT_ALL_MESSAGES {
-        "SELECT message_id"
-            ", author_id"
-            ", creation_time"
-            ", modification_time"
-            ", delivered_time"
-            ", read_time"
-            ", content"
-            " FROM \"{}\" ORDER BY {} {}"
+        "SELECT {} FROM \"{}\"{} ORDER BY {} LIMIT :limit"
     };
 
-    std::string field = "creation_time";
-    std::string order = "ASC";
+    // Order by indexed sort key with ties resolved by rowid
+    auto cols = storage::keyset_columns(storage::sqlite3::chat::sort_key(sort_flags)
+        , storage::sqlite3::chat::is_descending(sort_flags));
 
-    if (sort_flag_on(sort_flags, chat_sort_flag::by_creation_time))
-        field = "creation_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_modification_time))
-        field = "modification_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_delivered_time))
-        field = "delivered_time";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::by_read_time))
-        field = "read_time";
+    auto where = storage::sqlite3::chat::filter_condition(filter);
 
-    if (sort_flag_on(sort_flags, chat_sort_flag::ascending_order))
-        order = "ASC";
-    else if (sort_flag_on(sort_flags, chat_sort_flag::descending_order))
-        order = "DESC";
+    if (!where.empty())
+        where = " WHERE " + where;
 
     debby::error err;
-    auto res = _d->pdb->exec(fmt::format(SELECT_ALL_MESSAGES, _d->table_name, field, order), & err);
+    auto stmt = _d->pdb->prepare_cached(fmt::format(SELECT_ALL_MESSAGES
+        , storage::sqlite3::chat::message_columns(projection), _d->table_name, where, cols.second), & err);
 
     if (!err) {
-        int counter = max_count < 0 ? -1 : max_count;
+        storage::bind_filter(stmt, filter, & err);
 
-        while (res.has_more()) {
-            if (max_count >= 0 && counter-- == 0)
-                break;
+        if (!err)
+            stmt.bind(":limit", max_count < 0 ? -1 : max_count, & err);
 
-            message::message_credentials m;
+        if (!err) {
+            auto res = stmt.exec(& err);
 
-            m.message_id = res.get_or("message_id", message::id{});
-            m.author_id = res.get_or("author_id", contact::id{});
-            m.creation_time = res.get_or("creation_time", pfs::utc_time_point{});
-            m.modification_time = res.get_or("modification_time", pfs::utc_time_point{});
-            m.delivered_time = res.get<pfs::utc_time_point>("delivered_time");
-            m.read_time = res.get<pfs::utc_time_point>("read_time");
-            auto content_data = res.get_or("content", std::string{});
-
-            if (!content_data.empty()) {
-                message::content content{content_data};
-                m.contents = std::move(content);
+            if (!err) {
+                for (; res.has_more(); res.next()) {
+                    message::message_credentials m;
+                    _d->fill_message(res, m, projection);
+                    f(m);
+                }
             }
-
-            f(m);
-            res.next();
         }
     }
+
+    if (err)
+        throw error {errc::storage_error, tr::_("fetch messages failure"), err.what()};
+}
+
+template <>
+void chat_t::for_each_after (message::id anchor_id
+    , std::function<void(message::message_credentials const &)> f
+    , int sort_flags, int max_count) const
+{
+    _d->seek(anchor_id, true, false, 0, max_count, sort_flags
+        , [& f] (message::message_credentials && m) { f(m); });
+}
+
+template <>
+void chat_t::for_each_after (message::id anchor_id
+    , std::function<void(message::message_credentials const &)> f
+    , message_filter const & filter, int sort_flags, int max_count) const
+{
+    _d->seek(anchor_id, true, false, 0, max_count, sort_flags
+        , [& f] (message::message_credentials && m) { f(m); }, filter);
+}
+
+template <>
+void chat_t::for_each_before (message::id anchor_id
+    , std::function<void(message::message_credentials const &)> f
+    , int sort_flags, int max_count) const
+{
+    _d->seek(anchor_id, false, false, 0, max_count, sort_flags
+        , [& f] (message::message_credentials && m) { f(m); });
+}
+
+template <>
+void chat_t::for_each_before (message::id anchor_id
+    , std::function<void(message::message_credentials const &)> f
+    , message_filter const & filter, int sort_flags, int max_count) const
+{
+    _d->seek(anchor_id, false, false, 0, max_count, sort_flags
+        , [& f] (message::message_credentials && m) { f(m); }, filter);
 }
 
 template <>
 void chat_t::clear ()
 {
-    _d->pdb->clear(_d->table_name);
+    static std::string const RESET_COUNTERS {
+        "UPDATE \"{}\" SET total = 0, unread = 0 WHERE chat_id = :chat_id"
+    };
+
+    auto failure = storage::with_savepoint(*_d->pdb, "clear_chat", [this] {
+        _d->pdb->clear(_d->table_name);
+
+        debby::error err;
+        auto stmt = _d->pdb->prepare_cached(fmt::format(RESET_COUNTERS, _d->counters_table_name), & err);
+
+        if (!err) {
+            stmt.bind(":chat_id", _d->chat_id, & err);
+
+            if (!err)
+                stmt.exec(& err);
+        }
+
+        if (!err)
+            _d->unindex_all(& err);
+
+        return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+    });
+
     _d->invalidate_cache();
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("clear chat failure"), *failure};
 }
 
 template <>
 void chat_t::wipe ()
 {
-    _d->pdb->remove(_d->table_name);
+    static std::string const DELETE_COUNTERS {
+        "DELETE FROM \"{}\" WHERE chat_id = :chat_id"
+    };
+
+    auto failure = storage::with_savepoint(*_d->pdb, "wipe_chat", [this] {
+        _d->pdb->remove(_d->table_name);
+
+        debby::error err;
+        auto stmt = _d->pdb->prepare_cached(fmt::format(DELETE_COUNTERS, _d->counters_table_name), & err);
+
+        if (!err) {
+            stmt.bind(":chat_id", _d->chat_id, & err);
+
+            if (!err)
+                stmt.exec(& err);
+        }
+
+        if (!err)
+            _d->unindex_all(& err);
+
+        return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+    });
+
     _d->invalidate_cache();
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("wipe chat failure"), *failure};
+
+    // Handle must not be reused (see message_store::open_chat)
+    _d->wiped = true;
 }
 
 CHAT__NAMESPACE_END
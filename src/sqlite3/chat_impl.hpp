@@ -5,16 +5,29 @@
 //
 // Changelog:
 //      2024.11.30 Initial version.
+//      2026.10.16 Added keyset (seek) pagination.
+//                 Added secondary indexes management.
+//                 Added incremental cache maintenance.
+//                 Added materialized message counters.
+//                 Added message column projection.
+//                 Added full-text index maintenance.
+//                 Added message filter.
+//                 Content is stored as BLOB.
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "chat/sqlite3.hpp"
+#include "chat/chat.hpp"
 #include "chat/contact.hpp"
 #include "chat/flags.hpp"
 #include "chat/message.hpp"
 #include "chat/sqlite3.hpp"
+#include <pfs/string_view.hpp>
 #include <atomic>
+#include <functional>
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -26,11 +39,16 @@ public:
     struct cache_data
     {
         std::atomic<bool> dirty {true};
-        int offset;
-        int limit;
-        int sort_flags;
+        int offset {0};
+        int limit {0};
+        int sort_flags {0};
+        bool at_end {false}; // Window contains the last message
         std::vector<message::message_credentials> data;
         std::map<message::id, std::size_t> map;
+
+        // Known positions of messages in `sort_flags` order (offset -> message ID).
+        // Used to translate offsets into keyset anchors.
+        std::map<int, message::id> anchors;
     };
 
 public:
@@ -39,16 +57,166 @@ public:
     contact::id chat_id;
     mutable cache_data cache;
     std::string table_name;
+    std::string counters_table_name;
+    std::string index_table_name;
+    bool index_enabled {false}; // Full-text index is available
+    bool wiped {false}; // Table is removed, handle is not usable any more
 
 public:
     chat (contact::id an_author_id, contact::id a_chat_id, relational_database_t & db);
 
 public:
     void invalidate_cache ();
+
+    /**
+     * Applies @a patch to the cached message @a message_id in place. The cache is
+     * invalidated if @a modified_field is the sort field of the cached window.
+     */
+    void cache_update (message::id message_id, chat_sort_flag modified_field
+        , std::function<void(message::message_credentials &)> patch);
+
+    /**
+     * Inserts just saved message @a m into the cached window if it falls into it.
+     * The cache is invalidated only if the message position can not be determined.
+     */
+    void cache_insert (message::message_credentials && m);
+
+    /**
+     * Removes message @a message_id from the cached window.
+     */
+    void cache_remove (message::id message_id);
+
+    /**
+     * Returns DDL statements for secondary indexes missing for this chat table.
+     * If @a table_exists is @c false all indexes are considered missing.
+     */
+    std::vector<std::string> missing_indexes (bool table_exists) const;
+
     void prefetch (int offset, int limit, int sort_flags);
 
+    /**
+     * Adds @a total_delta and @a unread_delta to the chat counters.
+     * Must be called in the same savepoint/transaction as the modification of the chat table.
+     */
+    void adjust_counters (int total_delta, int unread_delta, debby::error * perr);
+
+    /**
+     * Subtracts contribution of message @a message_id from the unread counter (and total counter
+     * if @a total is @c true). Must be called before the message is removed or marked as read.
+     * Nothing is changed if the message does not exist.
+     */
+    void uncount_message (message::id message_id, bool total, debby::error * perr);
+
+    /**
+     * Reads materialized counters: total and unread message count.
+     */
+    std::pair<std::size_t, std::size_t> counters () const;
+
+    /**
+     * Replaces full-text index document of message @a message_id by @a contents.
+     * Must be called in the same savepoint/transaction as the modification of the chat table.
+     * Does nothing if the index is disabled.
+     */
+    void index_message (message::id message_id, message::content const & contents, debby::error * perr);
+
+    /**
+     * Removes message @a message_id from the full-text index.
+     */
+    void unindex_message (message::id message_id, debby::error * perr);
+
+    /**
+     * Removes all chat messages from the full-text index.
+     */
+    void unindex_all (debby::error * perr);
+
+    /**
+     * Fetches up to @a limit messages next to the message @a anchor_id in @a sort_flags order
+     * (@a forward is @c true) or previous to it (@a forward is @c false) skipping @a skip
+     * messages. The anchor itself is included into result if @a inclusive is @c true.
+     * If @a anchor_id is nil fetching starts from the first (or last) message.
+     * Only messages matching @a filter are fetched (and skipped).
+     *
+     * @details Messages are passed to @a f in @a sort_flags order regardless of direction.
+     */
+    void seek (message::id anchor_id, bool forward, bool inclusive, int skip, int limit
+        , int sort_flags, std::function<void(message::message_credentials &&)> f
+        , message_filter const & filter = message_filter{});
+
+    /**
+     * Checks if chat table has `content_kinds` column (absent in tables created by previous versions).
+     */
+    bool has_content_kinds () const;
+
+    /**
+     * Calculates `content_kinds` column from stored contents.
+     */
+    void update_content_kinds (debby::error * perr);
+
+private:
+    void init_counters ();
+    void record_window_anchors ();
+    void reset_window_anchors (int first_shifted);
+
 public: // static
-    static void fill_message (relational_database_t::result_type & result, message::message_credentials & m);
+    /**
+     * Fills @a m from the current row of @a result. Content is left unset (and is not
+     * required in the result) if @a projection is @c message_projection::headers.
+     */
+    static void fill_message (relational_database_t::result_type & result, message::message_credentials & m
+        , message_projection projection = message_projection::full);
+
+    /**
+     * Column list for @a projection.
+     */
+    static char const * message_columns (message_projection projection);
+
+    /**
+     * Value of the content column. Binary content starts with zero byte and is not a valid
+     * text, so it is stored as BLOB.
+     */
+    static std::vector<char> content_blob (pfs::string_view data);
+
+    /**
+     * SQL condition (without WHERE keyword) for @a filter, empty string if filter is empty.
+     * Parameters are named `:since`, `:until`, `:authorN` and `:kinds`.
+     */
+    static std::string filter_condition (message_filter const & filter);
+
+    static chat_sort_flag sort_field (int sort_flags);
+
+    /**
+     * Expression used as a sort key for @a sort_flags. Ties are always resolved by rowid.
+     */
+    static std::string sort_key (int sort_flags);
+
+    static bool is_descending (int sort_flags);
+
+    /**
+     * Recalculates counters for the chat @a chat_id stored in table @a table_name from scratch.
+     */
+    static void recount (relational_database_t & db, std::string const & table_name
+        , contact::id chat_id, contact::id me, debby::error * perr);
+
+    /**
+     * Creates full-text index tables named by @a index_table_name if FTS5 is available.
+     *
+     * @return @c false if FTS5 is not available.
+     */
+    static bool create_index (relational_database_t & db, std::string const & index_table_name
+        , debby::error * perr);
+
+    /**
+     * Name of the table mapping index document identifiers to chat and message identifiers.
+     */
+    static std::string index_map_table_name (std::string const & index_table_name);
+
+    /**
+     * Writes full-text index document for the message @a message_id of chat @a chat_id.
+     * Text components are indexed in `text` column, attachment names in `attachment` column.
+     */
+    static void index_document (relational_database_t & db, std::string const & index_table_name
+        , contact::id chat_id, message::id message_id, message::content const & contents
+        , debby::error * perr);
 };
 
 } // namespace storage
@@ -7,8 +7,15 @@
 //      2021.01.04 Initial version.
 //      2022.02.17 Refactored totally.
 //      2024.12.01 Started V2.
+//      2026.10.16 Chat window cache is updated in place.
+//                 Chat counters are maintained on save.
+//                 Content is stored in binary encoding.
+//                 Full-text index is maintained on save.
+//                 Content kinds are stored.
+//                 Content is stored as BLOB.
 ////////////////////////////////////////////////////////////////////////////////
 #include "editor_impl.hpp"
+#include "savepoint.hpp"
 #include "chat/editor.hpp"
 #include "chat/error.hpp"
 #include "chat/sqlite3.hpp"
@@ -137,8 +144,8 @@ template <>
 void editor_t::save ()
 {
     static std::string const INSERT_MESSAGE {
-        "INSERT INTO \"{}\" (message_id, author_id, creation_time, modification_time, content)"
-        " VALUES (:message_id, :author_id, :creation_time, :modification_time, :content)"
+        "INSERT INTO \"{}\" (message_id, author_id, creation_time, modification_time, content, content_kinds)"
+        " VALUES (:message_id, :author_id, :creation_time, :modification_time, :content, :kinds)"
     };
 
     static std::string const DELETE_MESSAGE {
@@ -146,7 +153,7 @@ void editor_t::save ()
     };
 
     static std::string const MODIFY_CONTENT {
-        "UPDATE OR IGNORE \"{}\" SET content = :content"
+        "UPDATE OR IGNORE \"{}\" SET content = :content, content_kinds = :kinds"
         ", modification_time = :modification_time WHERE message_id = :message_id"
     };
 
@@ -155,48 +162,103 @@ void editor_t::save ()
     if (_d->content.empty()) {
         // Remove message if already initialized.
         if (_d->message_id != message::id{}) {
-            auto stmt = _d->holder->pdb->prepare_cached(fmt::format(DELETE_MESSAGE, _d->holder->table_name), & err);
-
-            if (!err) {
-                stmt.bind(":message_id", _d->message_id, & err);
+            auto failure = storage::with_savepoint(*_d->holder->pdb, "editor_save", [this, & err] {
+                // Counters must be adjusted while the message still exists
+                _d->holder->uncount_message(_d->message_id, true, & err);
 
                 if (!err) {
-                    stmt.exec(& err);
-                    _d->holder->invalidate_cache();
+                    auto stmt = _d->holder->pdb->prepare_cached(fmt::format(DELETE_MESSAGE, _d->holder->table_name), & err);
+
+                    if (!err) {
+                        stmt.bind(":message_id", _d->message_id, & err);
+
+                        if (!err)
+                            stmt.exec(& err);
+                    }
                 }
-            }
+
+                if (!err)
+                    _d->holder->unindex_message(_d->message_id, & err);
+
+                return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+            });
+
+            if (failure)
+                throw error {errc::storage_error, tr::_("save message failure"), *failure};
+
+            _d->holder->cache_remove(_d->message_id);
        }
     } else {
         if (_d->mode == editor_mode::create) {
             // Create/save new message
             auto creation_time = pfs::current_utc_time_point();
 
-            auto stmt = _d->holder->pdb->prepare_cached(fmt::format(INSERT_MESSAGE
-                , _d->holder->table_name), & err);
+            auto failure = storage::with_savepoint(*_d->holder->pdb, "editor_save", [this, & err, & creation_time] {
+                auto stmt = _d->holder->pdb->prepare_cached(fmt::format(INSERT_MESSAGE
+                    , _d->holder->table_name), & err);
+
+                stmt.bind(":message_id", _d->message_id, & err)
+                    && stmt.bind(":author_id", _d->holder->author_id, & err)
+                    && stmt.bind(":creation_time"    , creation_time, & err)
+                    && stmt.bind(":modification_time", creation_time, & err)
+                    && stmt.bind(":content", storage::sqlite3::chat::content_blob(_d->content.to_binary()), & err)
+                    && stmt.bind(":kinds", static_cast<std::int32_t>(_d->content.kinds()), & err);
+
+                if (!err)
+                    stmt.exec(& err);
 
-            stmt.bind(":message_id", _d->message_id, & err)
-                && stmt.bind(":author_id", _d->holder->author_id, & err)
-                && stmt.bind(":creation_time"    , creation_time, & err)
-                && stmt.bind(":modification_time", creation_time, & err)
-                && stmt.bind(":content", to_string(_d->content), & err);
+                // Outgoing message does not affect unread counter
+                if (!err)
+                    _d->holder->adjust_counters(1, 0, & err);
 
-            if (!err)
-               stmt.exec(& err);
+                if (!err)
+                    _d->holder->index_message(_d->message_id, _d->content, & err);
+
+                return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+            });
+
+            if (failure)
+                throw error {errc::storage_error, tr::_("save message failure"), *failure};
+
+            message::message_credentials m;
+            m.message_id = _d->message_id;
+            m.author_id = _d->holder->author_id;
+            m.creation_time = creation_time;
+            m.modification_time = creation_time;
+            m.contents = _d->content;
+
+            _d->holder->cache_insert(std::move(m));
         } else {
             // Modify content
-            auto stmt = _d->holder->pdb->prepare_cached(fmt::format(MODIFY_CONTENT, _d->holder->table_name), & err);
+            auto now = pfs::current_utc_time_point();
 
-            if (!err) {
-                auto now = pfs::current_utc_time_point();
-                stmt.bind(":content", to_string(_d->content), & err)
-                    && stmt.bind(":message_id", _d->message_id, & err)
-                    && stmt.bind(":modification_time", now, & err);
+            auto failure = storage::with_savepoint(*_d->holder->pdb, "editor_save", [this, & err, & now] {
+                auto stmt = _d->holder->pdb->prepare_cached(fmt::format(MODIFY_CONTENT, _d->holder->table_name), & err);
 
                 if (!err) {
-                    stmt.exec(& err);
-                    _d->holder->invalidate_cache();
+                    stmt.bind(":content", storage::sqlite3::chat::content_blob(_d->content.to_binary()), & err)
+                        && stmt.bind(":kinds", static_cast<std::int32_t>(_d->content.kinds()), & err)
+                        && stmt.bind(":message_id", _d->message_id, & err)
+                        && stmt.bind(":modification_time", now, & err);
+
+                    if (!err)
+                        stmt.exec(& err);
                 }
-            }
+
+                if (!err)
+                    _d->holder->index_message(_d->message_id, _d->content, & err);
+
+                return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+            });
+
+            if (failure)
+                throw error {errc::storage_error, tr::_("save message failure"), *failure};
+
+            _d->holder->cache_update(_d->message_id, chat_sort_flag::by_modification_time
+                , [this, & now] (message::message_credentials & m) {
+                    m.contents = _d->content;
+                    m.modification_time = now;
+                });
         }
     }
 
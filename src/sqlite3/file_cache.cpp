@@ -6,12 +6,17 @@
 // Changelog:
 //      2021.12.06 Initial version.
 //      2022.07.23 Totally refactored.
+//      2026.10.16 Added nestable transactions.
+//                 Added attachment search and secondary indexes.
+//                 Attachment search statements are reused for any limit and MIME list.
 ////////////////////////////////////////////////////////////////////////////////
+#include "savepoint.hpp"
 #include "chat/file_cache.hpp"
 #include "chat/sqlite3.hpp"
 #include <pfs/i18n.hpp>
 #include <pfs/debby/data_definition.hpp>
 #include <pfs/debby/sqlite3.hpp>
+#include <algorithm>
 
 CHAT__NAMESPACE_BEGIN
 
@@ -60,10 +65,21 @@ public:
         auto out_uindex = data_definition_t::create_index(out_table_name + "_id_uindex");
         out_uindex.unique().on(out_table_name).add_column("file_id");
 
-        std::array<std::string, 4> sqls = {
+        std::vector<std::string> sqls = {
             in.build(), out.build(), in_uindex.build(), out_uindex.build()
         };
 
+        // Secondary indexes for attachment search
+        static std::string const CREATE_INDEX {
+            "CREATE INDEX IF NOT EXISTS \"{0}_{1}_index\" ON \"{0}\" ({2})"
+        };
+
+        for (auto const * table_name: {& in_table_name, & out_table_name}) {
+            sqls.push_back(fmt::format(CREATE_INDEX, *table_name, "chat", "chat_id, modtime"));
+            sqls.push_back(fmt::format(CREATE_INDEX, *table_name, "author", "author_id, modtime"));
+            sqls.push_back(fmt::format(CREATE_INDEX, *table_name, "mime", "mime, size"));
+        }
+
         auto failure = db.transaction([& sqls, & db] () {
             debby::error err;
 
@@ -202,7 +218,173 @@ public:
         return result;
     }
 
+    std::vector<file::credentials> search_files (attachment_filter const & filter)
+    {
+        static std::string const SELECT_FILES {
+            "SELECT file_id, author_id, chat_id, message_id, attachment_index"
+                ", abspath, name, size, mime, modtime"
+            " FROM \"{}\"{}"
+        };
+
+        std::vector<std::string> tables;
+
+        if (filter.incoming)
+            tables.push_back(in_table_name);
+
+        if (filter.outgoing)
+            tables.push_back(out_table_name);
+
+        if (tables.empty() || filter.limit == 0)
+            return std::vector<file::credentials>{};
+
+        auto cond = condition(filter);
+        std::string sql;
+
+        for (auto const & table_name: tables) {
+            if (!sql.empty())
+                sql += " UNION ALL ";
+
+            sql += fmt::format(SELECT_FILES, table_name, cond);
+        }
+
+        // Negative limit means no limit in SQLite
+        sql += " ORDER BY modtime DESC, file_id LIMIT :limit";
+
+        std::vector<file::credentials> result;
+        debby::error err;
+        auto stmt = pdb->prepare_cached(sql, & err);
+
+        if (!err) {
+            bind_filter(stmt, filter, & err)
+                && stmt.bind(":limit", filter.limit < 0 ? -1 : filter.limit, & err);
+
+            if (!err) {
+                auto res = stmt.exec(& err);
+
+                if (!err) {
+                    while (res.has_more()) {
+                        file::credentials fc;
+                        fill(res, fc);
+                        result.push_back(std::move(fc));
+                        res.next();
+                    }
+                }
+            }
+        }
+
+        if (err)
+            throw error {errc::storage_error, tr::_("search files failure"), err.what()};
+
+        return result;
+    }
+
 private: // static
+    // Number of parameters in the `mime IN (...)` list is a multiple of MIME_LIST_SIZE. Shorter
+    // lists are padded by repeating the last MIME type, so a few prepared statements are cached
+    // for any number of MIME types.
+    static constexpr std::size_t MIME_LIST_SIZE = 8;
+
+    static std::size_t mime_list_size (std::size_t count)
+    {
+        return (count + MIME_LIST_SIZE - 1) / MIME_LIST_SIZE * MIME_LIST_SIZE;
+    }
+
+    /**
+     * SQL condition (with WHERE keyword) for @a filter, empty string if filter is empty.
+     * Parameters are named `:name`, `:mimeN`, `:min_size`, `:max_size`, `:chat_id`
+     * and `:author_id`.
+     */
+    static std::string condition (attachment_filter const & filter)
+    {
+        std::vector<std::string> conds;
+
+        if (!filter.name_pattern.empty())
+            conds.push_back("name LIKE :name ESCAPE '\\'");
+
+        if (!filter.mimes.empty()) {
+            std::string params;
+
+            for (std::size_t i = 0, n = mime_list_size(filter.mimes.size()); i < n; i++) {
+                if (i > 0)
+                    params += ", ";
+
+                params += fmt::format(":mime{}", i);
+            }
+
+            conds.push_back(fmt::format("mime IN ({})", params));
+        }
+
+        if (filter.min_size)
+            conds.push_back("size >= :min_size");
+
+        if (filter.max_size)
+            conds.push_back("size <= :max_size");
+
+        if (filter.chat_id != contact::id{})
+            conds.push_back("chat_id = :chat_id");
+
+        if (filter.author_id != contact::id{})
+            conds.push_back("author_id = :author_id");
+
+        std::string result;
+
+        for (auto const & c: conds) {
+            result += result.empty() ? " WHERE " : " AND ";
+            result += c;
+        }
+
+        return result;
+    }
+
+    /**
+     * Escapes LIKE wildcards in @a pattern and surrounds it by `%`.
+     */
+    static std::string like_pattern (std::string const & pattern)
+    {
+        std::string result {"%"};
+
+        for (auto ch: pattern) {
+            if (ch == '%' || ch == '_' || ch == '\\')
+                result += '\\';
+
+            result += ch;
+        }
+
+        result += '%';
+        return result;
+    }
+
+    template <typename Statement>
+    static bool bind_filter (Statement & stmt, attachment_filter const & filter, debby::error * perr)
+    {
+        if (!filter.name_pattern.empty()) {
+            if (!stmt.bind(":name", like_pattern(filter.name_pattern), perr))
+                return false;
+        }
+
+        for (std::size_t i = 0, n = mime_list_size(filter.mimes.size()); i < n; i++) {
+            auto name = fmt::format(":mime{}", i);
+            auto mime = filter.mimes[(std::min)(i, filter.mimes.size() - 1)];
+
+            if (!stmt.bind(name.c_str(), mime, perr))
+                return false;
+        }
+
+        if (filter.min_size && !stmt.bind(":min_size", *filter.min_size, perr))
+            return false;
+
+        if (filter.max_size && !stmt.bind(":max_size", *filter.max_size, perr))
+            return false;
+
+        if (filter.chat_id != contact::id{} && !stmt.bind(":chat_id", filter.chat_id, perr))
+            return false;
+
+        if (filter.author_id != contact::id{} && !stmt.bind(":author_id", filter.author_id, perr))
+            return false;
+
+        return true;
+    }
+
     static void fill (relational_database_t::result_type & res, file::credentials & fc)
     {
         debby::error err;
@@ -403,6 +585,12 @@ std::vector<file::credentials> file_cache_t::incoming_files (contact::id chat_id
     return _d->fetch_files(chat_id, _d->in_table_name);
 }
 
+template <>
+std::vector<file::credentials> file_cache_t::search_files (attachment_filter const & filter) const
+{
+    return _d->search_files(filter);
+}
+
 static std::string const DELETE_BY_ID { "DELETE FROM \"{}\" WHERE file_id = {}" };
 
 template <>
@@ -492,4 +680,11 @@ void file_cache_t::clear ()
         throw error{errc::storage_error, err.what()};
 }
 
+template <>
+pfs::optional<std::string>
+file_cache_t::transaction (std::function<pfs::optional<std::string>()> op)
+{
+    return storage::with_savepoint(*_d->pdb, "file_cache", [& op] { return op(); });
+}
+
 CHAT__NAMESPACE_END
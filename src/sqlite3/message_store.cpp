@@ -7,29 +7,259 @@
 //      2021.12.13 Initial version.
 //      2021.12.27 Refactored.
 //      2024.11.30 Started V2.
+//      2026.10.16 Added materialized chat counters.
+//                 Added LRU cache of chat handles.
+//                 Added nestable transactions.
+//                 Added content migration to binary encoding.
+//                 Added full-text index.
+//                 Content migration converts text values into BLOB.
+//                 Handles in use are invalidated by `clear()`.
+//                 Full-text index supports substring search.
+//                 Added `find_chat()`.
+//                 Content migration removes encoded HTML projection.
+//                 Chat caches are invalidated on transaction rollback.
+//                 Content migration can be nested into transaction.
+//                 Counters rebuilding can be nested into transaction.
 ////////////////////////////////////////////////////////////////////////////////
 #include "chat_impl.hpp"
+#include "savepoint.hpp"
 #include "chat/message_store.hpp"
 #include "chat/sqlite3.hpp"
+#include <pfs/i18n.hpp>
+#include <pfs/debby/data_definition.hpp>
+#include <algorithm>
 #include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 CHAT__NAMESPACE_BEGIN
 
 using relational_database_t = debby::relational_database<debby::backend_enum::sqlite3>;
+using data_definition_t = debby::data_definition<debby::backend_enum::sqlite3>;
 
 namespace storage {
 
+std::function<std::string ()> sqlite3::chat_counters_table_name = [] { return std::string{"chat_counters"}; };
+std::function<std::size_t ()> sqlite3::chat_handle_cache_size = [] { return std::size_t{16}; };
+
 class sqlite3::message_store
 {
 public:
     relational_database_t * pdb {nullptr};
     contact::id me;
+    std::string counters_table_name;
+    std::string index_table_name;
+    bool index_enabled {false};
+
+    // Recently used chat handles (most recent first). Handles keep their window caches and
+    // are shared with `chat` instances returned by `open_chat()`.
+    std::size_t handle_cache_capacity {0};
+    std::list<std::shared_ptr<sqlite3::chat>> handles;
+    std::map<contact::id, std::list<std::shared_ptr<sqlite3::chat>>::iterator> handle_index;
+
+    // All handles created by the store (including evicted ones still used by `chat` instances).
+    // They are invalidated when chat tables are removed by `clear()`.
+    std::vector<std::weak_ptr<sqlite3::chat>> issued_handles;
 
 public:
     message_store (contact::id my_contact_id, relational_database_t & db)
         : pdb(& db)
         , me(my_contact_id)
-    {}
+        , counters_table_name(sqlite3::chat_counters_table_name())
+        , index_table_name(sqlite3::message_index_table_name())
+        , handle_cache_capacity(sqlite3::chat_handle_cache_size())
+    {
+        auto counters = data_definition_t::create_table(counters_table_name);
+        counters.add_column<contact::id>("chat_id").primary_key().unique();
+        counters.add_column<std::int64_t>("total");
+        counters.add_column<std::int64_t>("unread");
+        counters.constraint("WITHOUT ROWID");
+
+        debby::error err;
+        db.query(counters.build(), & err);
+
+        if (err)
+            throw error {errc::storage_error, tr::_("create chat counters table failure"), err.what()};
+
+        bool index_exists = db.exists(index_table_name, & err);
+
+        // Index created by previous version supports word prefix search only
+        if (!err && index_exists && !is_trigram_index(& err)) {
+            db.query(fmt::format("DROP TABLE IF EXISTS \"{}\"", index_table_name), & err);
+
+            if (!err) {
+                db.query(fmt::format("DROP TABLE IF EXISTS \"{}\""
+                    , sqlite3::chat::index_map_table_name(index_table_name)), & err);
+            }
+
+            index_exists = false;
+        }
+
+        if (!err)
+            index_enabled = sqlite3::chat::create_index(db, index_table_name, & err);
+
+        if (err)
+            throw error {errc::storage_error, tr::_("create message index failure"), err.what()};
+
+        // Messages saved before the index was created (or by previous versions)
+        if (index_enabled && !index_exists)
+            rebuild_index();
+    }
+
+    bool is_trigram_index (debby::error * perr)
+    {
+        static std::string const SELECT_INDEX_SQL {
+            "SELECT sql FROM sqlite_master WHERE name = :name"
+        };
+
+        auto stmt = pdb->prepare_cached(SELECT_INDEX_SQL, perr);
+
+        if (!*perr && stmt.bind(":name", index_table_name, perr)) {
+            auto res = stmt.exec(perr);
+
+            if (!*perr && res.has_more())
+                return res.get_or(0, std::string{}).find("trigram") != std::string::npos;
+        }
+
+        return false;
+    }
+
+    /**
+     * Clears full-text index and fills it with contents of all chats.
+     */
+    void rebuild_index ()
+    {
+        static std::string const SELECT_CONTENT {
+            "SELECT message_id, content FROM \"{}\" WHERE length(content) > 0"
+        };
+
+        auto failure = with_savepoint(*pdb, "rebuild_index", [this] {
+            debby::error err;
+
+            pdb->clear(index_table_name);
+            pdb->clear(sqlite3::chat::index_map_table_name(index_table_name));
+
+            for_each_chat_table([this, & err] (contact::id chat_id, std::string const & table_name) {
+                if (err)
+                    return;
+
+                std::vector<std::pair<message::id, std::string>> rows;
+                auto res = pdb->exec(fmt::format(SELECT_CONTENT, table_name), & err);
+
+                if (!err) {
+                    for (; res.has_more(); res.next()) {
+                        rows.emplace_back(res.get_or("message_id", message::id{})
+                            , res.get_or("content", std::string{}));
+                    }
+                }
+
+                for (auto & row: rows) {
+                    if (err)
+                        break;
+
+                    message::content contents {std::move(row.second)};
+                    sqlite3::chat::index_document(*pdb, index_table_name, chat_id, row.first
+                        , contents, & err);
+                }
+            });
+
+            return err ? pfs::make_optional(std::string{err.what()}) : pfs::optional<std::string>{};
+        });
+
+        if (failure)
+            throw error {errc::storage_error, tr::_("rebuild message index failure"), *failure};
+    }
+
+    /**
+     * Returns cached handle for chat @a chat_id or creates new one.
+     */
+    std::shared_ptr<sqlite3::chat> acquire_chat (contact::id chat_id)
+    {
+        auto pos = handle_index.find(chat_id);
+
+        if (pos != handle_index.end()) {
+            if (!(*pos->second)->wiped) {
+                handles.splice(handles.begin(), handles, pos->second);
+                return handles.front();
+            }
+
+            handles.erase(pos->second);
+            handle_index.erase(pos);
+        }
+
+        auto h = std::make_shared<sqlite3::chat>(me, chat_id, *pdb);
+
+        issued_handles.erase(std::remove_if(issued_handles.begin(), issued_handles.end()
+            , [] (std::weak_ptr<sqlite3::chat> const & wh) { return wh.expired(); })
+            , issued_handles.end());
+        issued_handles.push_back(h);
+
+        if (handle_cache_capacity == 0)
+            return h;
+
+        if (handles.size() >= handle_cache_capacity) {
+            handle_index.erase(handles.back()->chat_id);
+            handles.pop_back();
+        }
+
+        handles.push_front(h);
+        handle_index[chat_id] = handles.begin();
+
+        return h;
+    }
+
+    /**
+     * Marks all handles in use as wiped (their tables are about to be removed) and drops
+     * them from the cache.
+     */
+    /**
+     * Invalidates caches of all handles (cached and in use), e.g. after rollback of
+     * the changes they are patched with.
+     */
+    void invalidate_chat_caches () noexcept
+    {
+        for (auto & wh: issued_handles) {
+            auto h = wh.lock();
+
+            if (h)
+                h->invalidate_cache();
+        }
+    }
+
+    void drop_chat_handles () noexcept
+    {
+        for (auto & wh: issued_handles) {
+            auto h = wh.lock();
+
+            if (h) {
+                h->invalidate_cache();
+                h->wiped = true;
+            }
+        }
+
+        issued_handles.clear();
+        handle_index.clear();
+        handles.clear();
+    }
+
+    /**
+     * Calls @a f for each chat table with chat identifier and table name.
+     */
+    void for_each_chat_table (std::function<void(contact::id, std::string const &)> f) const
+    {
+        auto prefix = chat_table_name_prefix();
+        auto tables = pdb->tables("^" + prefix);
+
+        for (auto const & t: tables) {
+            auto chat_id = pfs::from_string<contact::id>(t.substr(prefix.size()));
+
+            if (chat_id != contact::id{})
+                f(chat_id, t);
+        }
+    }
 };
 
 sqlite3::message_store *
@@ -69,7 +299,25 @@ message_store_t::chat_type message_store_t::open_chat (contact::id chat_id) cons
     if (_d->pdb == nullptr)
         return chat_type{};
 
-    return chat_type{new storage::sqlite3::chat(_d->me, chat_id, *_d->pdb)};
+    return chat_type{_d->acquire_chat(chat_id)};
+}
+
+template <>
+message_store_t::chat_type message_store_t::find_chat (contact::id chat_id) const
+{
+    if (chat_id == contact::id{} || !_d || _d->pdb == nullptr)
+        return chat_type{};
+
+    debby::error err;
+    auto exists = _d->pdb->exists(storage::sqlite3::chat_table_name_prefix() + to_string(chat_id), & err);
+
+    if (err)
+        throw error {errc::storage_error, tr::_("check chat existence failure"), err.what()};
+
+    if (!exists)
+        return chat_type{};
+
+    return chat_type{_d->acquire_chat(chat_id)};
 }
 
 template <>
@@ -77,10 +325,288 @@ void message_store_t::clear () noexcept
 {
     auto tables = _d->pdb->tables("^" + storage::sqlite3::chat_table_name_prefix());
 
-    if (tables.empty())
-        return;
+    // Handles (cached and in use) refer to removed tables
+    _d->drop_chat_handles();
+
+    if (!tables.empty())
+        _d->pdb->remove(tables);
+
+    _d->pdb->clear(_d->counters_table_name);
+
+    if (_d->index_enabled) {
+        _d->pdb->clear(_d->index_table_name);
+        _d->pdb->clear(storage::sqlite3::chat::index_map_table_name(_d->index_table_name));
+    }
+}
+
+template <>
+std::size_t message_store_t::unread_message_count () const
+{
+    static std::string const TOTAL_UNREAD {
+        "SELECT IFNULL(SUM(unread), 0) FROM \"{}\""
+    };
+
+    std::size_t count = 0;
+    debby::error err;
+    auto res = _d->pdb->exec(fmt::format(TOTAL_UNREAD, _d->counters_table_name), & err);
+
+    if (!err && res.has_more())
+        count = res.get_or(0, std::size_t{0});
+
+    if (err)
+        throw error { errc::storage_error, tr::f_("get unread message count failure: {}", err.what()) };
+
+    return count;
+}
+
+template <>
+bool message_store_t::verify_counters () const
+{
+    static std::string const VERIFY {
+        "SELECT (SELECT COUNT(1) FROM \"{1}\") = total"
+        " AND (SELECT COUNT(1) FROM \"{1}\" WHERE read_time IS NULL AND author_id != :author_id) = unread"
+        " FROM \"{0}\" WHERE chat_id = :chat_id"
+    };
+
+    bool consistent = true;
+    debby::error err;
+
+    _d->for_each_chat_table([this, & consistent, & err] (contact::id chat_id, std::string const & table_name) {
+        if (!consistent || err)
+            return;
+
+        auto stmt = _d->pdb->prepare_cached(fmt::format(VERIFY, _d->counters_table_name, table_name), & err);
+
+        if (!err) {
+            stmt.bind(":author_id", _d->me, & err)
+                && stmt.bind(":chat_id", chat_id, & err);
+
+            if (!err) {
+                auto res = stmt.exec(& err);
+
+                // Missing counters are consistent: they are initialized on chat opening
+                if (!err && res.has_more())
+                    consistent = res.get_or(0, false);
+            }
+        }
+    });
+
+    if (err)
+        throw error { errc::storage_error, tr::_("verify chat counters failure"), err.what() };
+
+    return consistent;
+}
+
+template <>
+void message_store_t::rebuild_counters ()
+{
+    auto failure = storage::with_savepoint(*_d->pdb, "rebuild_counters", [this] () {
+        debby::error err;
+
+        _d->pdb->clear(_d->counters_table_name);
+
+        _d->for_each_chat_table([this, & err] (contact::id chat_id, std::string const & table_name) {
+            if (!err)
+                storage::sqlite3::chat::recount(*_d->pdb, table_name, chat_id, _d->me, & err);
+        });
+
+        if (err)
+            return pfs::make_optional(std::string{err.what()});
+
+        return pfs::optional<std::string>{};
+    });
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("rebuild chat counters failure"), *failure};
+}
+
+template <>
+std::size_t message_store_t::migrate_content ()
+{
+    // Content stored as text (JSON or binary content stored by previous versions) or binary
+    // content of version 2 (with encoded HTML projection)
+    static std::string const SELECT_OUTDATED_CONTENT {
+        "SELECT rowid AS rid, content FROM \"{}\""
+        " WHERE (typeof(content) = 'text' AND length(content) > 0)"
+        " OR substr(content, 1, 2) = X'0002'"
+    };
+
+    static std::string const UPDATE_CONTENT {
+        "UPDATE \"{}\" SET content = :content WHERE rowid = :rid"
+    };
+
+    std::size_t count = 0;
+
+    auto failure = storage::with_savepoint(*_d->pdb, "migrate_content", [this, & count] () {
+        debby::error err;
+
+        _d->for_each_chat_table([this, & count, & err] (contact::id, std::string const & table_name) {
+            if (err)
+                return;
+
+            std::vector<std::pair<std::int64_t, std::vector<char>>> rows;
+            auto res = _d->pdb->exec(fmt::format(SELECT_OUTDATED_CONTENT, table_name), & err);
+
+            if (!err) {
+                for (; res.has_more(); res.next()) {
+                    auto rid = res.get_or("rid", std::int64_t{0});
+                    auto content_data = res.get_or("content", std::string{});
+                    rows.emplace_back(rid, storage::sqlite3::chat::content_blob(
+                        message::content{content_data}.to_binary()));
+                }
+            }
+
+            for (auto const & row: rows) {
+                if (err)
+                    break;
+
+                auto stmt = _d->pdb->prepare_cached(fmt::format(UPDATE_CONTENT, table_name), & err);
+
+                if (!err) {
+                    stmt.bind(":content", row.second, & err)
+                        && stmt.bind(":rid", row.first, & err);
+
+                    if (!err) {
+                        stmt.exec(& err);
+
+                        if (!err)
+                            count++;
+                    }
+                }
+            }
+        });
+
+        if (err)
+            return pfs::make_optional(std::string{err.what()});
+
+        return pfs::optional<std::string>{};
+    });
+
+    if (failure)
+        throw error {errc::storage_error, tr::_("migrate message content failure"), *failure};
+
+    return count;
+}
+
+template <>
+bool message_store_t::full_text_index_enabled () const noexcept
+{
+    return _d->index_enabled;
+}
+
+template <>
+void message_store_t::rebuild_full_text_index ()
+{
+    if (_d->index_enabled)
+        _d->rebuild_index();
+}
+
+// Minimum number of pattern characters (code points) for trigram index search
+static constexpr std::size_t MIN_INDEXED_PATTERN_LENGTH = 3;
+
+static std::size_t utf8_length (std::string const & s)
+{
+    return static_cast<std::size_t>(std::count_if(s.begin(), s.end(), [] (char ch) {
+        return (static_cast<unsigned char>(ch) & 0xC0) != 0x80;
+    }));
+}
+
+// Builds FTS5 query: the pattern is a single phrase (substring for trigram tokenizer)
+// restricted to the requested columns.
+static std::string fts_query (std::string const & pattern, search_flags sf)
+{
+    std::string columns;
+
+    if (sf.value & search_flags::text_content)
+        columns += "text";
+
+    if (sf.value & search_flags::attachment_name)
+        columns += columns.empty() ? "attachment" : " attachment";
+
+    if (columns.empty())
+        return std::string{};
+
+    std::string phrase;
+
+    for (auto ch: pattern) {
+        if (ch == '"')
+            phrase += '"';
+
+        phrase += ch;
+    }
+
+    return fmt::format("{{{}}} : \"{}\"", columns, phrase);
+}
+
+template <>
+bool message_store_t::indexable (std::string const & pattern) const
+{
+    return _d->index_enabled && utf8_length(pattern) >= MIN_INDEXED_PATTERN_LENGTH;
+}
+
+template <>
+std::vector<std::pair<contact::id, message::id>>
+message_store_t::search_index (std::string const & pattern, search_flags sf, int offset, int limit) const
+{
+    static std::string const SEARCH_INDEX {
+        "SELECT m.chat_id AS chat_id, m.message_id AS message_id"
+        " FROM \"{0}\" JOIN \"{1}\" AS m ON m.docid = \"{0}\".rowid"
+        " WHERE \"{0}\" MATCH :query ORDER BY rank LIMIT :limit OFFSET :offset"
+    };
+
+    std::vector<std::pair<contact::id, message::id>> result;
+
+    if (!indexable(pattern))
+        return result;
+
+    auto query = fts_query(pattern, sf);
+
+    if (query.empty())
+        return result;
+
+    debby::error err;
+    auto stmt = _d->pdb->prepare_cached(fmt::format(SEARCH_INDEX, _d->index_table_name
+        , storage::sqlite3::chat::index_map_table_name(_d->index_table_name)), & err);
+
+    if (!err) {
+        stmt.bind(":query", query, & err)
+            && stmt.bind(":limit", limit < 0 ? -1 : limit, & err)
+            && stmt.bind(":offset", offset < 0 ? 0 : offset, & err);
+
+        if (!err) {
+            auto res = stmt.exec(& err);
+
+            if (!err) {
+                for (; res.has_more(); res.next()) {
+                    result.emplace_back(res.get_or("chat_id", contact::id{})
+                        , res.get_or("message_id", message::id{}));
+                }
+            }
+        }
+    }
+
+    if (err)
+        throw error {errc::storage_error, tr::_("search message index failure"), err.what()};
+
+    return result;
+}
+
+template <>
+pfs::optional<std::string>
+message_store_t::transaction (std::function<pfs::optional<std::string>()> op)
+{
+    // Chat caches are patched by operations, so they must not keep rolled back changes
+    try {
+        auto failure = storage::with_savepoint(*_d->pdb, "message_store", [& op] { return op(); });
+
+        if (failure)
+            _d->invalidate_chat_caches();
 
-    _d->pdb->remove(tables);
+        return failure;
+    } catch (...) {
+        _d->invalidate_chat_caches();
+        throw;
+    }
 }
 
 CHAT__NAMESPACE_END
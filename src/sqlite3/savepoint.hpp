@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "chat/sqlite3.hpp"
+#include <pfs/fmt.hpp>
+#include <pfs/optional.hpp>
+#include <string>
+
+CHAT__NAMESPACE_BEGIN
+
+namespace storage {
+
+/**
+ * Executes @a op inside the savepoint @a name. Unlike `relational_database::transaction()`
+ * savepoints can be nested, so the operation stays atomic when called inside another
+ * transaction (e.g. batch processing).
+ *
+ * @return @c nullopt on success or failure description, changes made by @a op are
+ *         rolled back in the last case or if @a op throws.
+ */
+template <typename F>
+pfs::optional<std::string> with_savepoint (sqlite3::relational_database_t & db
+    , char const * name, F && op)
+{
+    debby::error err;
+    db.query(fmt::format("SAVEPOINT \"{}\"", name), & err);
+
+    if (err)
+        return pfs::make_optional(std::string{err.what()});
+
+    auto rollback = [& db, name] {
+        debby::error err;
+        db.query(fmt::format("ROLLBACK TO \"{}\"", name), & err);
+        db.query(fmt::format("RELEASE \"{}\"", name), & err);
+    };
+
+    pfs::optional<std::string> failure;
+
+    try {
+        failure = op();
+    } catch (...) {
+        rollback();
+        throw;
+    }
+
+    if (failure) {
+        rollback();
+        return failure;
+    }
+
+    db.query(fmt::format("RELEASE \"{}\"", name), & err);
+
+    if (err) {
+        rollback();
+        return pfs::make_optional(std::string{err.what()});
+    }
+
+    return pfs::nullopt;
+}
+
+} // namespace storage
+
+CHAT__NAMESPACE_END
@@ -0,0 +1,264 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2026 Vladislav Trifochkin
+//
+// This file is part of `chat-lib`.
+//
+// Changelog:
+//      2026.10.16 Initial version.
+////////////////////////////////////////////////////////////////////////////////
+#include "pfs/chat/substring_matcher.hpp"
+#include <pfs/unicode/utf8_iterator.hpp>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define CHAT__SUBSTRING_MATCHER_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define CHAT__SUBSTRING_MATCHER_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+CHAT__NAMESPACE_BEGIN
+
+using utf8_iterator = pfs::unicode::utf8_iterator<std::string::const_iterator>;
+
+inline bool is_ascii_upper (char ch)
+{
+    return ch >= 'A' && ch <= 'Z';
+}
+
+inline char ascii_lower (char ch)
+{
+    return is_ascii_upper(ch) ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+inline char ascii_upper (char ch)
+{
+    return (ch >= 'a' && ch <= 'z') ? static_cast<char>(ch - 'a' + 'A') : ch;
+}
+
+inline bool is_continuation_byte (char ch)
+{
+    return (static_cast<unsigned char>(ch) & 0xC0) == 0x80;
+}
+
+#if CHAT__SUBSTRING_MATCHER_AVX2 || CHAT__SUBSTRING_MATCHER_SSE2
+inline int lowest_bit (std::uint32_t mask)
+{
+#   if defined(_MSC_VER)
+    unsigned long index = 0;
+    _BitScanForward(& index, mask);
+    return static_cast<int>(index);
+#   else
+    return __builtin_ctz(mask);
+#   endif
+}
+#endif
+
+// Returns pointer to the first byte equal to c1 or c2 in range [first, last) or last.
+static char const * find_candidate (char const * first, char const * last, char c1, char c2)
+{
+#if CHAT__SUBSTRING_MATCHER_AVX2
+    auto v1 = _mm256_set1_epi8(c1);
+    auto v2 = _mm256_set1_epi8(c2);
+
+    for (; last - first >= 32; first += 32) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(first));
+        auto eq = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, v1), _mm256_cmpeq_epi8(chunk, v2));
+        auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(eq));
+
+        if (mask != 0)
+            return first + lowest_bit(mask);
+    }
+#elif CHAT__SUBSTRING_MATCHER_SSE2
+    auto v1 = _mm_set1_epi8(c1);
+    auto v2 = _mm_set1_epi8(c2);
+
+    for (; last - first >= 16; first += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(first));
+        auto eq = _mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2));
+        auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(eq));
+
+        if (mask != 0)
+            return first + lowest_bit(mask);
+    }
+#endif
+
+    // Tail (or whole range for scalar implementation)
+    if (c1 == c2) {
+        auto pos = static_cast<char const *>(std::memchr(first, c1, static_cast<std::size_t>(last - first)));
+        return pos != nullptr ? pos : last;
+    }
+
+    for (; first != last; ++first) {
+        if (*first == c1 || *first == c2)
+            return first;
+    }
+
+    return last;
+}
+
+substring_matcher::substring_matcher (std::string const & pattern, bool ignore_case)
+    : _pattern(pattern)
+    , _ignore_case(ignore_case)
+{
+    for (auto & ch: _pattern) {
+        if (!is_continuation_byte(ch))
+            _cp_count++;
+
+        if (_ignore_case) {
+            if (static_cast<unsigned char>(ch) >= 0x80)
+                _fallback = true;
+            else
+                ch = ascii_lower(ch);
+        }
+    }
+
+    // Folded pattern is not used
+    if (_fallback)
+        _pattern = pattern;
+}
+
+void substring_matcher::search (std::string const & text, char skip_begin, char skip_end
+    , std::function<bool(pfs::unicode::match_item const &)> f) const
+{
+    if (_pattern.empty() || text.size() < _pattern.size())
+        return;
+
+    auto const * begin = text.data();
+    auto const * end = begin + text.size();
+    auto const * last = end - _pattern.size() + 1; // Last candidate position (exclusive)
+    auto c1 = _pattern[0];
+    auto c2 = _ignore_case ? ascii_upper(c1) : c1;
+
+    // Code point position and skip region state are advanced up to `counted` position
+    // only when a match is found.
+    auto const * counted = begin;
+    std::size_t cp_pos = 0;
+    bool in_skip = false;
+
+    auto advance = [& counted, & cp_pos, & in_skip, skip_begin, skip_end] (char const * pos) {
+        for (; counted != pos; ++counted) {
+            if (!is_continuation_byte(*counted))
+                cp_pos++;
+
+            if (skip_begin != '\0') {
+                if (*counted == skip_begin)
+                    in_skip = true;
+                else if (*counted == skip_end)
+                    in_skip = false;
+            }
+        }
+    };
+
+    auto pos = begin;
+
+    while (pos < last) {
+        pos = find_candidate(pos, last, c1, c2);
+
+        if (pos == last)
+            break;
+
+        bool matched = true;
+
+        if (_ignore_case) {
+            for (std::size_t i = 1; i < _pattern.size(); i++) {
+                if (ascii_lower(pos[i]) != _pattern[i]) {
+                    matched = false;
+                    break;
+                }
+            }
+        } else {
+            matched = std::memcmp(pos + 1, _pattern.data() + 1, _pattern.size() - 1) == 0;
+        }
+
+        if (!matched) {
+            ++pos;
+            continue;
+        }
+
+        advance(pos);
+
+        auto const * match_end = pos + _pattern.size();
+
+        if (skip_begin != '\0') {
+            // Match starts inside the skipped region or crosses its boundary
+            if (in_skip || std::memchr(pos, skip_begin, _pattern.size()) != nullptr
+                    || std::memchr(pos, skip_end, _pattern.size()) != nullptr) {
+                ++pos;
+                continue;
+            }
+        }
+
+        pfs::unicode::match_item m;
+        m.cp_first = static_cast<decltype(m.cp_first)>(cp_pos);
+        m.cp_last  = static_cast<decltype(m.cp_last)>(cp_pos + _cp_count);
+        m.cu_first = static_cast<decltype(m.cu_first)>(pos - begin);
+        m.cu_last  = static_cast<decltype(m.cu_last)>(match_end - begin);
+
+        if (!f(m))
+            return;
+
+        // Matches are not overlapped
+        advance(match_end);
+        pos = match_end;
+    }
+}
+
+void substring_matcher::search_all (std::string const & text
+    , std::function<void(pfs::unicode::match_item const &)> f
+    , char skip_begin, char skip_end) const
+{
+    if (_fallback) {
+        auto first = utf8_iterator::begin(text.begin(), text.end());
+        auto s_first = utf8_iterator::begin(_pattern.begin(), _pattern.end());
+
+        if (skip_begin != '\0') {
+            pfs::unicode::search_all(first, first.end(), s_first, s_first.end()
+                , _ignore_case, skip_begin, skip_end, std::move(f));
+        } else {
+            pfs::unicode::search_all(first, first.end(), s_first, s_first.end()
+                , _ignore_case, std::move(f));
+        }
+
+        return;
+    }
+
+    search(text, skip_begin, skip_end, [& f] (pfs::unicode::match_item const & m) {
+        f(m);
+        return true;
+    });
+}
+
+pfs::unicode::match_item substring_matcher::search_first (std::string const & text
+    , char skip_begin, char skip_end) const
+{
+    if (_fallback) {
+        auto first = utf8_iterator::begin(text.begin(), text.end());
+        auto s_first = utf8_iterator::begin(_pattern.begin(), _pattern.end());
+
+        if (skip_begin != '\0') {
+            return pfs::unicode::search_first(first, first.end(), s_first, s_first.end()
+                , _ignore_case, skip_begin, skip_end);
+        }
+
+        return pfs::unicode::search_first(first, first.end(), s_first, s_first.end(), _ignore_case);
+    }
+
+    pfs::unicode::match_item result;
+    result.cp_first = -1;
+
+    search(text, skip_begin, skip_end, [& result] (pfs::unicode::match_item const & m) {
+        result = m;
+        return false;
+    });
+
+    return result;
+}
+
+CHAT__NAMESPACE_END
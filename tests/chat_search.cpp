@@ -5,6 +5,15 @@
 //
 // Changelog:
 //      2023.04.24 Initial version.
+//      2026.10.16 Added indexed search test.
+//                 Added parallel search test.
+//                 Added streaming search test.
+//                 Added substring matcher test.
+//                 Added ranking test.
+//                 Added search session test.
+//                 Added indexed substring search and pagination test.
+//                 Added streaming search test with deleted cursor message.
+//                 Added search session refinement test with deleted message.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -13,6 +22,11 @@
 #include "pfs/chat/message_store.hpp"
 #include "pfs/chat/search.hpp"
 #include "pfs/chat/sqlite3.hpp"
+#include "pfs/chat/substring_matcher.hpp"
+#include <pfs/unicode/utf8_iterator.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 using message_store_t = chat::message_store<chat::storage::sqlite3>;
 using chat_t   = message_store_t::chat_type;
@@ -114,3 +128,500 @@ TEST_CASE("search") {
         }
     }
 }
+
+// Contact list is used by searcher only if full-text index is not available
+struct empty_contact_list
+{
+    void for_each (std::function<void(chat::contact::contact const &)>) const {}
+};
+
+TEST_CASE("indexed search") {
+    auto db = debby::sqlite3::make(message_db_path);
+
+    REQUIRE(db);
+
+    auto message_store = message_store_t::make(my_id, db);
+
+    REQUIRE(message_store);
+
+    if (!message_store.full_text_index_enabled()) {
+        MESSAGE("Full-text index is not available (SQLite built without FTS5)");
+        return;
+    }
+
+    auto chat = message_store.open_chat("01FV1KFY7WWS3WSBV4BFYF7ZCA"_uuid);
+    chat.clear();
+
+    std::vector<chat::message::id> ids;
+
+    for (auto const * text: {"Hello world", "Say hello to the whole world"}) {
+        auto ed = chat.create();
+        ed.add_text(text);
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    auto ed = chat.create();
+    ed.add_html("<b>Hello</b>");
+    ed.save();
+
+    chat::search_flags sf {chat::search_flags::ignore_case | chat::search_flags::text_content};
+
+    CHECK_EQ(message_store.search_index("hello", sf).size(), 3);
+    CHECK_EQ(message_store.search_index("HEL", sf).size(), 3);
+    CHECK_EQ(message_store.search_index("hello world", sf).size(), 1);
+    CHECK_EQ(message_store.search_index("hello", sf, 1, 1).size(), 1);
+    CHECK_EQ(message_store.search_index("hello", chat::search_flags{chat::search_flags::attachment_name}).size(), 0);
+
+    empty_contact_list cl;
+    chat::message_store_searcher<message_store_t, empty_contact_list> searcher {message_store, cl};
+
+    CHECK_EQ(searcher.search_indexed("hello", sf).m.size(), 3);
+
+    // Substrings are found, not only word prefixes
+    CHECK_EQ(message_store.search_index("ELL", sf).size(), 3);
+    CHECK_EQ(message_store.search_index("orld", sf).size(), 2);
+
+    // Patterns shorter than three characters are not indexable
+    CHECK_FALSE(message_store.indexable("he"));
+    CHECK(message_store.search_index("he", sf).empty());
+
+    // HTML tags are not indexed and not searched
+    CHECK(message_store.search_index("<b>", sf).empty());
+    CHECK(searcher.search_indexed("<b>", sf).m.empty());
+
+    // Offset and limit are applied to verified messages (case sensitive search rejects
+    // case insensitive index candidates)
+    chat::search_flags sf_case {chat::search_flags::text_content};
+
+    CHECK_EQ(searcher.search_indexed("Hello", sf_case).m.size(), 2);
+    CHECK_EQ(searcher.search_indexed("hello", sf_case).m.size(), 1);
+    CHECK_EQ(searcher.search_indexed("Hello", sf_case, 1, 1).m.size(), 1);
+    CHECK_EQ(searcher.search_indexed("Hello", sf_case, 0, 1).m.size(), 1);
+    CHECK(searcher.search_indexed("Hello", sf_case, 2, 1).m.empty());
+
+    // Match in HTML content is positioned in the source text
+    auto html_result = searcher.search_indexed("ell", sf);
+    int html_matches = 0;
+
+    for (auto const & r: html_result.m) {
+        for (auto const & r1: r.m) {
+            if (r1.message_id != ed.message_id())
+                continue;
+
+            auto cc = chat.message(r1.message_id)->contents->at(r1.content_index);
+            CHECK_EQ(cc.text.substr(r1.m.cu_first, r1.m.cu_last - r1.m.cu_first), std::string{"ell"});
+            CHECK_EQ(r1.m.cp_first, 4);
+            html_matches++;
+        }
+    }
+
+    CHECK_EQ(html_matches, 1);
+
+    // Index follows modifications
+    auto ed1 = chat.open(ids[0]);
+    ed1.clear();
+    ed1.add_text("Goodbye world");
+    ed1.save();
+
+    CHECK_EQ(message_store.search_index("hello", sf).size(), 2);
+    CHECK_EQ(message_store.search_index("goodbye", sf).size(), 1);
+
+    auto ed2 = chat.open(ids[1]);
+    ed2.clear();
+    ed2.save(); // Remove message
+
+    CHECK_EQ(message_store.search_index("hello", sf).size(), 1);
+
+    message_store.rebuild_full_text_index();
+    CHECK_EQ(message_store.search_index("hello", sf).size(), 1);
+
+    chat.clear();
+    CHECK(message_store.search_index("hello", sf).empty());
+    CHECK(message_store.search_index("goodbye", sf).empty());
+}
+
+struct test_contact_list
+{
+    std::vector<chat::contact::id> ids;
+
+    void for_each (std::function<void(chat::contact::contact const &)> f) const
+    {
+        for (auto const & id: ids) {
+            chat::contact::contact c;
+            c.contact_id = id;
+            f(c);
+        }
+    }
+};
+
+TEST_CASE("parallel search") {
+    using database_t = decltype(debby::sqlite3::make(message_db_path));
+
+    auto db = debby::sqlite3::make(message_db_path);
+    auto message_store = message_store_t::make(my_id, db);
+
+    REQUIRE(message_store);
+
+    test_contact_list cl;
+
+    for (int i = 0; i < 5; i++) {
+        cl.ids.push_back(chat::contact::id_generator{}.next());
+        auto chat = message_store.open_chat(cl.ids.back());
+
+        for (int j = 0; j < 3; j++) {
+            auto ed = chat.create();
+            ed.add_text(j % 2 == 0 ? "needle in a haystack" : "just hay");
+            ed.save();
+        }
+    }
+
+    auto factory = [] {
+        auto db = std::make_shared<database_t>(debby::sqlite3::make(message_db_path));
+        return std::shared_ptr<message_store_t const>(new message_store_t(message_store_t::make(my_id, *db))
+            , [db] (message_store_t const * p) { delete p; });
+    };
+
+    chat::message_store_searcher<message_store_t, test_contact_list> searcher {message_store, cl};
+    chat::search_flags sf {chat::search_flags::ignore_case | chat::search_flags::text_content};
+
+    auto expected = searcher.search_all("needle", sf);
+    REQUIRE_EQ(expected.m.size(), 10);
+
+    decltype(searcher)::parallel_options opts;
+    opts.thread_count = 3;
+
+    auto sr = searcher.search_parallel("needle", factory, sf, opts);
+    REQUIRE_EQ(sr.m.size(), expected.m.size());
+
+    for (std::size_t i = 0; i < sr.m.size(); i++) {
+        CHECK_EQ(sr.m[i].contact_id, expected.m[i].contact_id);
+        CHECK_EQ(sr.m[i].message_id, expected.m[i].message_id);
+    }
+
+    // Limit keeps the first messages in deterministic order
+    opts.limit = 3;
+    sr = searcher.search_parallel("needle", factory, sf, opts);
+    REQUIRE_EQ(sr.m.size(), 3);
+    CHECK_EQ(sr.m[2].message_id, expected.m[2].message_id);
+
+    std::atomic<bool> cancelled {true};
+    opts.limit = -1;
+    opts.cancelled = & cancelled;
+    CHECK(searcher.search_parallel("needle", factory, sf, opts).m.empty());
+}
+
+TEST_CASE("streaming search") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto message_store = message_store_t::make(my_id, db);
+
+    REQUIRE(message_store);
+
+    test_contact_list cl;
+
+    for (int i = 0; i < 3; i++) {
+        cl.ids.push_back(chat::contact::id_generator{}.next());
+        auto chat = message_store.open_chat(cl.ids.back());
+
+        for (int j = 0; j < 4; j++) {
+            auto ed = chat.create();
+            ed.add_text(j % 2 == 0 ? "needle" : "hay");
+            ed.save();
+        }
+    }
+
+    chat::message_store_searcher<message_store_t, test_contact_list> searcher {message_store, cl};
+    chat::search_flags sf {chat::search_flags::ignore_case | chat::search_flags::text_content};
+
+    auto expected = searcher.search_all("needle", sf);
+    REQUIRE_EQ(expected.m.size(), 6);
+
+    // Pages of two matches continued from the cursor
+    std::vector<chat::message::id> streamed;
+    chat::search_stream_options opts;
+    opts.max_results = 2;
+    chat::search_cursor cursor;
+    int pages = 0;
+
+    do {
+        cursor = searcher.search_stream("needle", [& streamed] (chat::message_searcher::search_result && msr) {
+            streamed.push_back(msr.m.front().message_id);
+            return true;
+        }, sf, opts, cursor);
+
+        pages++;
+    } while (!cursor.at_end && pages < 10);
+
+    CHECK(cursor.at_end);
+    REQUIRE_EQ(streamed.size(), expected.m.size());
+
+    for (std::size_t i = 0; i < streamed.size(); i++)
+        CHECK_EQ(streamed[i], expected.m[i].message_id);
+
+    // Stopped by callback
+    int counter = 0;
+    cursor = searcher.search_stream("needle", [& counter] (chat::message_searcher::search_result &&) {
+        return ++counter < 3;
+    }, sf);
+
+    CHECK_EQ(counter, 3);
+    CHECK_FALSE(cursor.at_end);
+    CHECK_EQ(cursor.chat_id, cl.ids[1]);
+
+    // Stopped by stop flag
+    std::atomic<bool> stop {true};
+    opts.max_results = -1;
+    opts.stop = & stop;
+    counter = 0;
+    cursor = searcher.search_stream("needle", [& counter] (chat::message_searcher::search_result &&) {
+        return ++counter > 0;
+    }, sf, opts);
+
+    CHECK_EQ(counter, 0);
+    CHECK_FALSE(cursor.at_end);
+
+    // Single chat
+    auto chat = message_store.open_chat(cl.ids[0]);
+    chat::chat_searcher<chat_t> chat_searcher {chat};
+    counter = 0;
+    cursor = chat_searcher.search_stream("needle", [& counter] (chat::message_searcher::search_result &&) {
+        return ++counter > 0;
+    }, sf);
+
+    CHECK_EQ(counter, 2);
+    CHECK(cursor.at_end);
+
+    // Cursor message is deleted: search continues by creation time
+    opts.stop = nullptr;
+    opts.max_results = 1;
+    streamed.clear();
+
+    cursor = searcher.search_stream("needle", [& streamed] (chat::message_searcher::search_result && msr) {
+        streamed.push_back(msr.m.front().message_id);
+        return true;
+    }, sf, opts);
+
+    REQUIRE_FALSE(cursor.at_end);
+    REQUIRE_EQ(streamed.size(), 1);
+    CHECK_EQ(cursor.message_id, streamed.front());
+
+    auto ed = chat.open(cursor.message_id);
+    ed.clear();
+    ed.save(); // Remove message
+
+    opts.max_results = -1;
+    streamed.clear();
+
+    cursor = searcher.search_stream("needle", [& streamed] (chat::message_searcher::search_result && msr) {
+        streamed.push_back(msr.m.front().message_id);
+        return true;
+    }, sf, opts, cursor);
+
+    CHECK(cursor.at_end);
+    REQUIRE_EQ(streamed.size(), expected.m.size() - 1);
+
+    for (std::size_t i = 0; i < streamed.size(); i++)
+        CHECK_EQ(streamed[i], expected.m[i + 1].message_id);
+
+    // Cursor chat is removed from contact list
+    chat::search_cursor unknown;
+    unknown.chat_id = chat::contact::id_generator{}.next();
+
+    CHECK_THROWS_AS(searcher.search_stream("needle", [] (chat::message_searcher::search_result &&) {
+        return true;
+    }, sf, opts, unknown), chat::error);
+}
+
+TEST_CASE("ranking") {
+    chat::top_k_selector<int> selector {3};
+
+    for (auto score: {1, 5, 3, 5, 2})
+        selector.push(score, int{score});
+
+    auto top = selector.take();
+
+    REQUIRE_EQ(top.size(), 3);
+    CHECK_EQ(top[0].score, 5);
+    CHECK_EQ(top[0].seq, 1); // Earlier item is preferred among equal scores
+    CHECK_EQ(top[1].seq, 3);
+    CHECK_EQ(top[2].value, 3);
+
+    auto db = debby::sqlite3::make(message_db_path);
+    auto message_store = message_store_t::make(my_id, db);
+
+    REQUIRE(message_store);
+
+    test_contact_list cl;
+    cl.ids.push_back(chat::contact::id_generator{}.next());
+    cl.ids.push_back(chat::contact::id_generator{}.next());
+
+    std::vector<chat::message::id> ids;
+
+    for (auto const * text: {"needle", "hay", "needle needle needle"}) {
+        auto ed = message_store.open_chat(cl.ids[0]).create();
+        ed.add_text(text);
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    {
+        auto ed = message_store.open_chat(cl.ids[1]).create();
+        ed.add_text("needle needle");
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    chat::message_store_searcher<message_store_t, test_contact_list> searcher {message_store, cl};
+    chat::search_flags sf {chat::search_flags::ignore_case | chat::search_flags::text_content};
+
+    auto ranked = searcher.search_top("needle", 10, sf);
+
+    REQUIRE_EQ(ranked.size(), 3);
+    CHECK_EQ(ranked[0].result.m.front().message_id, ids[2]);
+    CHECK_EQ(ranked[1].result.m.front().message_id, ids[3]);
+    CHECK_EQ(ranked[2].result.m.front().message_id, ids[0]);
+    CHECK_GE(ranked[0].score, ranked[1].score);
+    CHECK_GE(ranked[1].score, ranked[2].score);
+
+    ranked = searcher.search_top("needle", 1, sf);
+    REQUIRE_EQ(ranked.size(), 1);
+    CHECK_EQ(ranked[0].result.m.size(), 3);
+
+    CHECK(searcher.search_top("needle", 0, sf).empty());
+
+    // Recency factor is halved each half-life period
+    chat::rank_weights w;
+    w.recency_half_life = std::chrono::hours{1};
+
+    using searcher_t = chat::message_store_searcher<message_store_t, test_contact_list>;
+    auto t = pfs::current_utc_time_point();
+
+    CHECK_EQ(searcher_t::recency(t, t, w), 1.0);
+    CHECK_EQ(searcher_t::recency(t - std::chrono::hours{2}, t, w), doctest::Approx(0.25));
+}
+
+TEST_CASE("search session") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto message_store = message_store_t::make(my_id, db);
+
+    REQUIRE(message_store);
+
+    test_contact_list cl;
+    cl.ids.push_back(chat::contact::id_generator{}.next());
+    auto chat = message_store.open_chat(cl.ids.back());
+
+    for (auto const * text: {"Meet me", "Meeting at noon", "Meetup", "No meeting today"}) {
+        auto ed = chat.create();
+        ed.add_text(text);
+        ed.save();
+    }
+
+    chat::search_flags sf {chat::search_flags::ignore_case | chat::search_flags::text_content};
+    chat::message_store_searcher<message_store_t, test_contact_list> searcher {message_store, cl};
+    auto session = chat::search_session::for_message_store(message_store, cl, sf);
+
+    CHECK_EQ(session.update("meet").m.size(), 4);
+    CHECK_FALSE(session.refined());
+
+    // Extended pattern: previous hits are re-checked only
+    auto const & r = session.update("meeti");
+    CHECK(session.refined());
+    CHECK_EQ(session.matched_count(), 2);
+
+    auto expected = searcher.search_all("meeti", sf);
+    REQUIRE_EQ(r.m.size(), expected.m.size());
+
+    for (std::size_t i = 0; i < r.m.size(); i++) {
+        CHECK_EQ(r.m[i].message_id, expected.m[i].message_id);
+        CHECK_EQ(r.m[i].m.cu_first, expected.m[i].m.cu_first);
+    }
+
+    CHECK_EQ(session.update("MEETING").m.size(), 2);
+    CHECK(session.refined());
+
+    // Matched messages are fetched again on refinement, deleted message is dropped
+    auto ed = chat.open(expected.m[1].message_id);
+    ed.clear();
+    ed.save(); // Remove message
+
+    CHECK_EQ(session.update("meeting").m.size(), 1);
+    CHECK(session.refined());
+    CHECK_EQ(session.matched_count(), 1);
+
+    // Not an extension: full scan
+    CHECK_EQ(session.update("meetu").m.size(), 1);
+    CHECK_FALSE(session.refined());
+
+    CHECK(session.update("").m.empty());
+
+    // Single chat session
+    auto chat_session = chat::search_session::for_chat(chat, sf);
+    CHECK_EQ(chat_session.update("noon").m.size(), 1);
+    CHECK(chat_session.update("noon!").m.empty());
+    CHECK(chat_session.refined());
+}
+
+TEST_CASE("substring matcher") {
+    using utf8_iterator = pfs::unicode::utf8_iterator<std::string::const_iterator>;
+
+    auto reference = [] (std::string const & text, std::string const & pattern, bool ignore_case) {
+        std::vector<pfs::unicode::match_item> result;
+        auto first = utf8_iterator::begin(text.begin(), text.end());
+        auto s_first = utf8_iterator::begin(pattern.begin(), pattern.end());
+
+        pfs::unicode::search_all(first, first.end(), s_first, s_first.end(), ignore_case
+            , [& result] (pfs::unicode::match_item const & m) { result.push_back(m); });
+
+        return result;
+    };
+
+    struct {
+        std::string text;
+        std::string pattern;
+        bool ignore_case;
+    } samples[] = {
+          {"Lorem ipsum dolor sit amet. LOREM, lOrEm!", "lorem", true}
+        , {"Lorem ipsum dolor sit amet. LOREM, lOrEm!", "Lorem", false}
+        , {"Лорем ипсум lorem долор Lorem, лорем", "lorem", true}
+        , {"Лорем ипсум lorem долор Lorem, лорем", "лорем", false}
+        , {"Лорем ипсум lorem долор Lorem, лорем", "ЛОРЕМ", true} // Code point comparator
+        , {std::string(100, 'a') + "needle" + std::string(100, 'b') + "NEEDLE", "needle", true}
+        , {"short", "longer pattern", true}
+    };
+
+    for (auto const & x: samples) {
+        chat::substring_matcher matcher {x.pattern, x.ignore_case};
+        std::vector<pfs::unicode::match_item> result;
+
+        matcher.search_all(x.text, [& result] (pfs::unicode::match_item const & m) {
+            result.push_back(m);
+        });
+
+        auto expected = reference(x.text, x.pattern, x.ignore_case);
+        REQUIRE_EQ(result.size(), expected.size());
+
+        for (std::size_t i = 0; i < result.size(); i++) {
+            CHECK_EQ(result[i].cp_first, expected[i].cp_first);
+            CHECK_EQ(result[i].cu_first, expected[i].cu_first);
+            CHECK_EQ(result[i].cu_last, expected[i].cu_last);
+        }
+
+        auto m = matcher.search_first(x.text);
+
+        if (expected.empty())
+            CHECK_LT(m.cp_first, 0);
+        else
+            CHECK_EQ(m.cu_first, expected[0].cu_first);
+    }
+
+    // HTML tags are skipped
+    chat::substring_matcher matcher {"div", true};
+    std::vector<pfs::unicode::match_item> result;
+
+    matcher.search_all("<div class=\"x\">div</div>", [& result] (pfs::unicode::match_item const & m) {
+        result.push_back(m);
+    }, '<', '>');
+
+    REQUIRE_EQ(result.size(), 1);
+    CHECK_EQ(result[0].cu_first, 15);
+}
@@ -5,6 +5,7 @@
 //
 // Changelog:
 //      2023.04.20 Initial version.
+//      2026.10.16 Added trigram index test.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -113,3 +114,76 @@ TEST_CASE("search") {
     }
 }
 
+
+TEST_CASE("trigram index") {
+    auto db = debby::sqlite3::make(contact_db_path);
+
+    REQUIRE(db);
+
+    auto contact_manager = contact_manager_t::make(db);
+
+    REQUIRE(contact_manager);
+
+    auto contact_list = contact_manager.contacts<>();
+
+    chat::contact_trigram_index index;
+    index.build(contact_list);
+
+    REQUIRE_EQ(index.count(), contact_list.count());
+
+    chat::contacts_searcher<decltype(contact_list)> scanner {contact_list};
+    chat::contacts_searcher<decltype(contact_list)> searcher {contact_list, index};
+
+    chat::search_flags sf {chat::search_flags::alias_field | chat::search_flags::desc_field};
+
+    // Case sensitive search uses the index, results are the same as for scanning
+    for (auto const * pattern: {"нов", "ов", "Иван", "xyz"}) {
+        CHECK_EQ(searcher.search_all(pattern, sf).m.size(), scanner.search_all(pattern, sf).m.size());
+    }
+
+    // Incremental maintenance
+    auto id1 = pfs::generate_uuid();
+    auto id2 = pfs::generate_uuid();
+
+    CHECK(index.add(id1, "John Smith", "Team lead"));
+    CHECK(index.add(id2, "Jane Doe", "Developer"));
+    CHECK_FALSE(index.add(id1, "John Smith", "Team lead"));
+
+    std::vector<chat::contact::id> found;
+    auto collect = [& found] (chat::contact_trigram_index::entry const & e) {
+        found.push_back(e.contact_id);
+    };
+
+    REQUIRE(index.for_each_candidate("SMITH", true, true, false, collect));
+    REQUIRE_EQ(found.size(), 1);
+    CHECK_EQ(found[0], id1);
+
+    found.clear();
+    REQUIRE(index.for_each_candidate("lead", true, true, false, collect));
+    CHECK(found.empty());
+
+    REQUIRE(index.for_each_candidate("lead", true, false, true, collect));
+    REQUIRE_EQ(found.size(), 1);
+
+    // Too short pattern or non-ASCII case insensitive pattern are not served by the index
+    CHECK_FALSE(index.for_each_candidate("Jo", true, true, true, collect));
+    CHECK_FALSE(index.for_each_candidate("нов", true, true, true, collect));
+
+    index.update(id2, "Jane Smith", "Developer");
+    found.clear();
+    REQUIRE(index.for_each_candidate("smith", true, true, false, collect));
+    CHECK_EQ(found.size(), 2);
+
+    found.clear();
+    REQUIRE(index.for_each_candidate("doe", true, true, false, collect));
+    CHECK(found.empty());
+
+    CHECK(index.remove(id1));
+    CHECK_FALSE(index.remove(id1));
+    found.clear();
+    REQUIRE(index.for_each_candidate("smith", true, true, false, collect));
+    REQUIRE_EQ(found.size(), 1);
+    CHECK_EQ(found[0], id2);
+
+    CHECK_EQ(index.count(), contact_list.count() + 1);
+}
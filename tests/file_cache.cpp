@@ -6,6 +6,7 @@
 // Changelog:
 //      2021.12.11 Initial version.
 //      2022.07.25 Refactored.
+//      2026.10.16 Added attachment search test.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -43,3 +44,83 @@ TEST_CASE("file_cache") {
     REQUIRE(file_cache);
     file_cache.clear();
 }
+
+TEST_CASE("search files") {
+    if (pfs::filesystem::exists(file_cache_db_path)) {
+        REQUIRE(pfs::filesystem::remove_all(file_cache_db_path) > 0);
+    }
+
+    auto db = debby::sqlite3::make(file_cache_db_path);
+
+    REQUIRE(db);
+
+    auto file_cache = file_cache_t::make(db);
+
+    REQUIRE(file_cache);
+
+    auto author1 = pfs::generate_uuid();
+    auto author2 = pfs::generate_uuid();
+    auto chat1 = pfs::generate_uuid();
+    auto chat2 = pfs::generate_uuid();
+
+    file_cache.reserve_incoming_file(pfs::generate_uuid(), author1, chat1, pfs::generate_uuid()
+        , 0, "Report_2026.txt", 100, mime::mime_enum::text__plain);
+    file_cache.reserve_incoming_file(pfs::generate_uuid(), author1, chat1, pfs::generate_uuid()
+        , 0, "index.html", 2000, mime::mime_enum::text__html);
+    file_cache.reserve_incoming_file(pfs::generate_uuid(), author2, chat2, pfs::generate_uuid()
+        , 1, "report%.bin", 30000, mime::mime_enum::application__octet_stream);
+
+    chat::attachment_filter filter;
+    CHECK_EQ(file_cache.search_files(filter).size(), 3);
+
+    filter.name_pattern = "REPORT";
+    CHECK_EQ(file_cache.search_files(filter).size(), 2);
+
+    // LIKE wildcards are matched literally
+    filter.name_pattern = "t%";
+    auto files = file_cache.search_files(filter);
+    REQUIRE_EQ(files.size(), 1);
+    CHECK_EQ(files[0].name, std::string{"report%.bin"});
+    CHECK_EQ(files[0].chat_id, chat2);
+    CHECK_EQ(files[0].author_id, author2);
+    CHECK_EQ(files[0].attachment_index, 1);
+
+    filter = chat::attachment_filter{};
+    filter.mimes = {mime::mime_enum::text__plain, mime::mime_enum::text__html};
+    CHECK_EQ(file_cache.search_files(filter).size(), 2);
+
+    // Same statement with padded MIME list
+    filter.mimes = {mime::mime_enum::text__html};
+    CHECK_EQ(file_cache.search_files(filter).size(), 1);
+    filter.mimes = {mime::mime_enum::text__plain, mime::mime_enum::text__html};
+
+    filter.min_size = 1000;
+    files = file_cache.search_files(filter);
+    REQUIRE_EQ(files.size(), 1);
+    CHECK_EQ(files[0].name, std::string{"index.html"});
+
+    filter = chat::attachment_filter{};
+    filter.max_size = 2000;
+    CHECK_EQ(file_cache.search_files(filter).size(), 2);
+
+    filter = chat::attachment_filter{};
+    filter.chat_id = chat2;
+    CHECK_EQ(file_cache.search_files(filter).size(), 1);
+
+    filter = chat::attachment_filter{};
+    filter.author_id = author1;
+    CHECK_EQ(file_cache.search_files(filter).size(), 2);
+
+    filter.limit = 1;
+    CHECK_EQ(file_cache.search_files(filter).size(), 1);
+
+    filter.limit = -1;
+    CHECK_EQ(file_cache.search_files(filter).size(), 2);
+
+    // Outgoing files only
+    filter = chat::attachment_filter{};
+    filter.incoming = false;
+    CHECK(file_cache.search_files(filter).empty());
+
+    file_cache.clear();
+}
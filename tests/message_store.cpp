@@ -6,6 +6,12 @@
 // Changelog:
 //      2021.12.03 Initial version.
 //      2021.12.30 Refactored.
+//      2026.10.16 Added message filter test.
+//                 Added filtered backward paging test.
+//                 Added check of handle invalidation by `clear()`.
+//                 Bulk marking reports marked messages.
+//                 Added migration of binary content stored as text.
+//                 Added `find_chat()` test.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -14,6 +20,9 @@
 #include "pfs/chat/message_store.hpp"
 #include "pfs/chat/sqlite3.hpp"
 #include <pfs/filesystem.hpp>
+#include <pfs/fmt.hpp>
+#include <string>
+#include <vector>
 
 namespace fs = pfs::filesystem;
 
@@ -129,3 +138,537 @@ TEST_CASE("outgoing messages") {
         }
     });
 }
+
+TEST_CASE("keyset pagination") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+
+    REQUIRE(chat);
+
+    int const message_count = 250;
+    std::vector<chat::message::id> ids;
+
+    for (int i = 0; i < message_count; i++) {
+        auto ed = chat.create();
+        ed.add_text(std::to_string(i));
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    int sf = chat::sort_flags(chat::chat_sort_flag::by_id, chat::chat_sort_flag::ascending_order);
+
+    // Forward pages
+    std::vector<chat::message::id> fetched;
+    chat::message::id anchor_id;
+
+    for (;;) {
+        int n = 0;
+
+        chat.for_each_after(anchor_id, [& fetched, & anchor_id, & n] (chat::message::message_credentials const & m) {
+            fetched.push_back(m.message_id);
+            anchor_id = m.message_id;
+            n++;
+        }, sf, 40);
+
+        if (n == 0)
+            break;
+    }
+
+    REQUIRE_EQ(fetched, ids);
+
+    // Backward pages
+    fetched.clear();
+    anchor_id = chat::message::id{};
+
+    for (;;) {
+        std::vector<chat::message::id> page;
+
+        chat.for_each_before(anchor_id, [& page] (chat::message::message_credentials const & m) {
+            page.push_back(m.message_id);
+        }, sf, 40);
+
+        if (page.empty())
+            break;
+
+        anchor_id = page.front();
+        fetched.insert(fetched.begin(), page.begin(), page.end());
+    }
+
+    REQUIRE_EQ(fetched, ids);
+
+    // Offset access translated to anchors: forward, backward and random scrolling
+    for (int i = 0; i < message_count; i++)
+        REQUIRE_EQ(chat.message(i, sf)->message_id, ids[i]);
+
+    for (int i = message_count - 1; i >= 0; i--)
+        REQUIRE_EQ(chat.message(i, sf)->message_id, ids[i]);
+
+    for (int i: {210, 3, 120, 249, 0, 99, 100})
+        REQUIRE_EQ(chat.message(i, sf)->message_id, ids[i]);
+
+    REQUIRE_FALSE(chat.message(message_count, sf));
+}
+
+TEST_CASE("chat indexes") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat_id = chat::contact::id_generator{}.next();
+    auto table_name = chat::storage::sqlite3::chat_table_name_prefix() + to_string(chat_id);
+
+    auto index_count = [& db, & table_name] () {
+        auto res = db.exec(fmt::format("SELECT COUNT(1) FROM sqlite_master"
+            " WHERE type = 'index' AND tbl_name = '{}' AND name LIKE '%_index'", table_name));
+        return res.has_more() ? res.get_or(0, int{0}) : 0;
+    };
+
+    {
+        auto chat = message_store.open_chat(chat_id);
+        REQUIRE(chat);
+        CHECK_EQ(index_count(), 5);
+    }
+
+    // Emulate database created by previous version: indexes must be recreated on open
+    db.query(fmt::format("DROP INDEX \"{}_unread_index\"", table_name));
+    db.query(fmt::format("DROP INDEX \"{}_read_time_index\"", table_name));
+    REQUIRE_EQ(index_count(), 3);
+
+    {
+        auto chat = message_store.open_chat(chat_id);
+        REQUIRE(chat);
+        CHECK_EQ(index_count(), 5);
+    }
+}
+
+TEST_CASE("incremental cache") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+
+    REQUIRE(chat);
+
+    std::vector<chat::message::id> ids;
+
+    for (int i = 0; i < 10; i++) {
+        auto ed = chat.create();
+        ed.add_text(std::to_string(i));
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    int sf = chat::sort_flags(chat::chat_sort_flag::by_id, chat::chat_sort_flag::ascending_order);
+
+    // Populate window
+    REQUIRE_EQ(chat.message(0, sf)->message_id, ids[0]);
+
+    auto now = pfs::current_utc_time_point();
+    chat.mark_delivered(ids[3], now);
+    chat.mark_read(ids[4], now);
+
+    REQUIRE(chat.message(3, sf)->delivered_time);
+    CHECK_EQ(*chat.message(3, sf)->delivered_time, now);
+    REQUIRE(chat.message(4, sf)->read_time);
+    CHECK_EQ(*chat.message(4, sf)->read_time, now);
+
+    // Append to the tail
+    {
+        auto ed = chat.create();
+        ed.add_text("10");
+        ed.save();
+        ids.push_back(ed.message_id());
+    }
+
+    REQUIRE(chat.message(10, sf));
+    CHECK_EQ(chat.message(10, sf)->message_id, ids[10]);
+
+    // Incoming message
+    auto author_id = chat::contact::id_generator{}.next();
+    auto incoming_id = chat::message::id_generator{}.next();
+    chat.save_incoming(incoming_id, author_id, now, "[]");
+    ids.push_back(incoming_id);
+
+    REQUIRE(chat.message(11, sf));
+    CHECK_EQ(chat.message(11, sf)->message_id, incoming_id);
+
+    // Remove message
+    {
+        auto ed = chat.open(ids[5]);
+        ed.clear();
+        ed.save();
+        ids.erase(ids.begin() + 5);
+    }
+
+    for (int i = 0; i < static_cast<int>(ids.size()); i++)
+        CHECK_EQ(chat.message(i, sf)->message_id, ids[i]);
+
+    CHECK_FALSE(chat.message(static_cast<int>(ids.size()), sf));
+}
+
+TEST_CASE("counters") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat1 = message_store.open_chat(chat::contact::id_generator{}.next());
+    auto chat2 = message_store.open_chat(chat::contact::id_generator{}.next());
+
+    REQUIRE(chat1);
+    REQUIRE(chat2);
+
+    // Outgoing messages are never unread
+    for (int i = 0; i < 3; i++) {
+        auto ed = chat1.create();
+        ed.add_text(std::to_string(i));
+        ed.save();
+    }
+
+    auto now = pfs::current_utc_time_point();
+    std::vector<chat::message::id> incoming_ids;
+
+    for (int i = 0; i < 4; i++) {
+        auto author_id = chat2.id();
+        auto message_id = chat::message::id_generator{}.next();
+        chat2.save_incoming(message_id, author_id, now, "[]");
+        incoming_ids.push_back(message_id);
+    }
+
+    CHECK_EQ(chat1.count(), 3);
+    CHECK_EQ(chat1.unread_message_count(), 0);
+    CHECK_EQ(chat2.count(), 4);
+    CHECK_EQ(chat2.unread_message_count(), 4);
+    CHECK_EQ(message_store.unread_message_count(), 4);
+
+    // Marking as read twice decrements counter once
+    chat2.mark_read(incoming_ids[0], now);
+    chat2.mark_read(incoming_ids[0], now);
+    CHECK_EQ(chat2.unread_message_count(), 3);
+    CHECK_EQ(message_store.unread_message_count(), 3);
+
+    // Duplicate incoming message does not change counters
+    chat2.save_incoming(incoming_ids[1], chat2.id(), now, "[]");
+    CHECK_EQ(chat2.count(), 4);
+
+    CHECK(message_store.verify_counters());
+    message_store.rebuild_counters();
+    CHECK(message_store.verify_counters());
+    CHECK_EQ(message_store.unread_message_count(), 3);
+
+    chat2.clear();
+    CHECK_EQ(chat2.count(), 0);
+    CHECK_EQ(message_store.unread_message_count(), 0);
+}
+
+TEST_CASE("chat handle cache") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat_id = chat::contact::id_generator{}.next();
+    int sf = chat::sort_flags(chat::chat_sort_flag::by_id, chat::chat_sort_flag::ascending_order);
+
+    {
+        auto chat = message_store.open_chat(chat_id);
+        auto ed = chat.create();
+        ed.add_text("1");
+        ed.save();
+
+        // Populate window
+        REQUIRE(chat.message(0, sf));
+    }
+
+    {
+        // Handle is shared with the previous one
+        auto chat1 = message_store.open_chat(chat_id);
+        auto chat2 = message_store.open_chat(chat_id);
+
+        auto ed = chat1.create();
+        ed.add_text("2");
+        ed.save();
+
+        CHECK_EQ(chat2.count(), 2);
+        REQUIRE(chat2.message(1, sf));
+        CHECK_EQ(chat2.message(1, sf)->message_id, ed.message_id());
+
+        chat2.wipe();
+    }
+
+    // Wiped handle is not reused
+    auto chat = message_store.open_chat(chat_id);
+    REQUIRE(chat);
+    CHECK_EQ(chat.count(), 0);
+    CHECK_FALSE(chat.message(0, sf));
+
+    auto ed = chat.create();
+    ed.add_text("3");
+    ed.save();
+    CHECK_EQ(chat.count(), 1);
+    REQUIRE(chat.message(0, sf));
+
+    // Handle in use does not keep window of removed table
+    auto stale = message_store.open_chat(chat_id);
+    message_store.clear();
+    CHECK_FALSE(stale.message(0, sf));
+
+    // Removed chat is not found (and not created by lookup)
+    CHECK_FALSE(message_store.find_chat(chat_id));
+    auto res = db.exec(fmt::format("SELECT COUNT(1) FROM sqlite_master WHERE type = 'table' AND name = '{}'"
+        , chat::storage::sqlite3::chat_table_name_prefix() + to_string(chat_id)));
+    CHECK_EQ(res.has_more() ? res.get_or(0, int{0}) : -1, 0);
+
+    chat = message_store.open_chat(chat_id);
+    REQUIRE(chat);
+    CHECK_EQ(chat.count(), 0);
+
+    auto found = message_store.find_chat(chat_id);
+    REQUIRE(found);
+    CHECK_EQ(found.id(), chat_id);
+}
+
+TEST_CASE("bulk marking") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+    REQUIRE(chat);
+
+    auto now = pfs::current_utc_time_point();
+    std::vector<chat::message::id> incoming_ids;
+
+    // More than one chunk of identifiers
+    for (int i = 0; i < 40; i++) {
+        auto message_id = chat::message::id_generator{}.next();
+        chat.save_incoming(message_id, chat.id(), now, "[]");
+        incoming_ids.push_back(message_id);
+    }
+
+    CHECK_EQ(chat.mark_delivered(incoming_ids, now).size(), 40);
+
+    std::vector<chat::message::id> read_ids {incoming_ids.begin(), incoming_ids.begin() + 35};
+    read_ids.push_back(chat::message::id_generator{}.next()); // Unknown message is ignored
+
+    auto read_marked = chat.mark_read(read_ids, now);
+    CHECK_EQ(read_marked.size(), 35);
+    CHECK_EQ(chat.unread_message_count(), 5);
+
+    // Already read messages are not reported again
+    CHECK(chat.mark_read(read_ids, now).empty());
+
+    // Already read messages are not marked again
+    auto marked = chat.mark_read_up_to(incoming_ids[37], now, false);
+    CHECK_EQ(marked.size(), 3);
+    CHECK_EQ(chat.unread_message_count(), 2);
+
+    // There are no outgoing messages
+    CHECK(chat.mark_read_up_to(incoming_ids[39], now, true).empty());
+    CHECK(message_store.verify_counters());
+}
+
+TEST_CASE("content migration") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+    REQUIRE(chat);
+
+    auto ed = chat.create();
+    ed.add_text("Hello");
+    ed.save();
+
+    // Emulate content stored by previous version
+    chat::message::content c;
+    c.add_text("Hello");
+
+    debby::error err;
+    db.query(fmt::format("UPDATE \"{}{}\" SET content = '{}'"
+        , chat::storage::sqlite3::chat_table_name_prefix(), to_string(chat.id()), c.to_string()), & err);
+    REQUIRE_FALSE(err);
+
+    // JSON content is readable
+    chat = message_store.open_chat(chat.id());
+    REQUIRE(chat.message(ed.message_id()));
+    CHECK_EQ(chat.message(ed.message_id())->contents->at(0).text, "Hello");
+
+    CHECK_EQ(message_store.migrate_content(), 1);
+    CHECK_EQ(message_store.migrate_content(), 0);
+    CHECK_EQ(chat.message(ed.message_id())->contents->at(0).text, "Hello");
+
+    auto content_type = [& db, & chat] {
+        debby::error err;
+        auto res = db.exec(fmt::format("SELECT typeof(content) FROM \"{}{}\""
+            , chat::storage::sqlite3::chat_table_name_prefix(), to_string(chat.id())), & err);
+
+        REQUIRE_FALSE(err);
+        REQUIRE(res.has_more());
+        return res.get_or(0, std::string{});
+    };
+
+    CHECK_EQ(content_type(), "blob");
+
+    // Emulate binary content stored as text by previous version
+    std::string hex;
+
+    for (auto ch: c.to_binary())
+        hex += fmt::format("{:02X}", static_cast<std::uint8_t>(ch));
+
+    db.query(fmt::format("UPDATE \"{}{}\" SET content = CAST(X'{}' AS TEXT)"
+        , chat::storage::sqlite3::chat_table_name_prefix(), to_string(chat.id()), hex), & err);
+    REQUIRE_FALSE(err);
+    CHECK_EQ(content_type(), "text");
+
+    chat = message_store.open_chat(chat.id());
+    CHECK_EQ(chat.message(ed.message_id())->contents->at(0).text, "Hello");
+
+    CHECK_EQ(message_store.migrate_content(), 1);
+    CHECK_EQ(content_type(), "blob");
+    CHECK_EQ(chat.message(ed.message_id())->contents->at(0).text, "Hello");
+}
+
+TEST_CASE("message projection") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+    REQUIRE(chat);
+
+    auto ed = chat.create();
+    ed.add_text("Hello");
+    ed.save();
+
+    auto sf = chat::sort_flags(chat::chat_sort_flag::by_id, chat::chat_sort_flag::ascending_order);
+    int counter = 0;
+
+    chat.for_each([& counter, & ed] (chat::message::message_credentials const & m) {
+        CHECK_EQ(m.message_id, ed.message_id());
+        CHECK_FALSE(m.contents);
+        counter++;
+    }, sf, -1, chat::message_projection::headers);
+
+    CHECK_EQ(counter, 1);
+
+    chat.for_each([& counter] (chat::message::message_credentials const & m) {
+        REQUIRE(m.contents);
+        CHECK_EQ(m.contents->at(0).text, "Hello");
+        counter++;
+    }, sf, -1);
+
+    CHECK_EQ(counter, 2);
+
+    // Cached message is stripped too
+    REQUIRE(chat.message(0, sf));
+    auto m = chat.message(ed.message_id(), chat::message_projection::headers);
+    REQUIRE(m);
+    CHECK_FALSE(m->contents);
+
+    // Content is not decoded until accessed, decoding error is reported on access
+    chat::message::content bad {std::string("\0\x7f", 2)};
+    CHECK_THROWS_AS(bad.count(), chat::error);
+
+    // Invalid content is rejected on save
+    CHECK_THROWS_AS(chat.save_incoming(chat::message::id_generator{}.next(), my_id
+        , pfs::current_utc_time_point(), std::string("\0\x01\xff", 3)), chat::error);
+}
+
+TEST_CASE("message filter") {
+    auto db = debby::sqlite3::make(message_db_path);
+    auto my_id = chat::contact::id_generator{}.next();
+    auto message_store = message_store_t::make(my_id, db);
+    message_store.clear();
+
+    auto chat = message_store.open_chat(chat::contact::id_generator{}.next());
+    REQUIRE(chat);
+
+    auto alice = chat::contact::id_generator{}.next();
+    auto bob = chat::contact::id_generator{}.next();
+    auto now = pfs::current_utc_time_point();
+
+    chat::file::credentials fc;
+    fc.file_id = pfs::generate_uuid();
+    fc.name = "report.pdf";
+    fc.size = 1024;
+    fc.mime = mime::mime_enum::application__octet_stream;
+
+    std::vector<chat::message::id> ids;
+
+    // Alice: text (3 days ago), attachment (2 days ago); Bob: HTML (1 day ago)
+    for (int i = 0; i < 3; i++) {
+        chat::message::content content;
+
+        if (i == 0)
+            content.add_text("Hello");
+        else if (i == 1)
+            content.attach(fc);
+        else
+            content.add_html("<b>Hi</b>");
+
+        ids.push_back(chat::message::id_generator{}.next());
+        chat.save_incoming(ids.back(), i < 2 ? alice : bob
+            , now - std::chrono::hours{24 * (3 - i)}, content.to_binary());
+    }
+
+    auto sf = chat::sort_flags(chat::chat_sort_flag::by_creation_time, chat::chat_sort_flag::ascending_order);
+
+    auto fetch = [& chat, sf] (chat::message_filter const & filter) {
+        std::vector<chat::message::id> result;
+
+        chat.for_each([& result] (chat::message::message_credentials const & m) {
+            result.push_back(m.message_id);
+        }, filter, sf, -1);
+
+        return result;
+    };
+
+    CHECK_EQ(fetch(chat::message_filter{}), ids);
+
+    chat::message_filter by_author;
+    by_author.authors.push_back(alice);
+    CHECK_EQ(fetch(by_author), (std::vector<chat::message::id>{ids[0], ids[1]}));
+
+    chat::message_filter by_time;
+    by_time.since = now - std::chrono::hours{24 * 2};
+    by_time.until = now;
+    CHECK_EQ(fetch(by_time), (std::vector<chat::message::id>{ids[1], ids[2]}));
+
+    // "Messages from Alice last two days"
+    by_time.authors.push_back(alice);
+    CHECK_EQ(fetch(by_time), (std::vector<chat::message::id>{ids[1]}));
+
+    chat::message_filter with_attachment;
+    with_attachment.has_attachment = true;
+    CHECK_EQ(fetch(with_attachment), (std::vector<chat::message::id>{ids[1]}));
+
+    chat::message_filter by_kinds;
+    by_kinds.content_kinds = chat::message::content_kind::text | chat::message::content_kind::html;
+    CHECK_EQ(fetch(by_kinds), (std::vector<chat::message::id>{ids[0], ids[2]}));
+
+    // Keyset pagination with filter
+    std::vector<chat::message::id> page;
+    chat.for_each_after(ids[0], [& page] (chat::message::message_credentials const & m) {
+        page.push_back(m.message_id);
+    }, by_kinds, sf, 10);
+
+    CHECK_EQ(page, (std::vector<chat::message::id>{ids[2]}));
+
+    page.clear();
+    chat.for_each_before(ids[2], [& page] (chat::message::message_credentials const & m) {
+        page.push_back(m.message_id);
+    }, by_kinds, sf, 10);
+
+    CHECK_EQ(page, (std::vector<chat::message::id>{ids[0]}));
+}
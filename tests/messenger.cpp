@@ -5,6 +5,11 @@
 //
 // Changelog:
 //      2022.02.03 Initial version.
+//      2026.10.16 Added batch processing test.
+//                 Added multicast dispatching test.
+//                 Added batch test with a new chat.
+//                 Added packet format negotiation test.
+//                 Added batch rollback test.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
@@ -29,6 +34,10 @@ std::string HTML {"<html></html>"};
 ////////////////////////////////////////////////////////////////////////////////
 using Messenger = chat::messenger<chat::storage::sqlite3>;
 
+using CompactMessenger = chat::messenger<chat::storage::sqlite3, chat::storage::sqlite3
+    , chat::storage::sqlite3, chat::storage::sqlite3
+    , chat::compact_serializer<pfs::endian::network>>;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Step 2. Define makers for messenger components
 ////////////////////////////////////////////////////////////////////////////////
@@ -65,7 +74,8 @@ public:
         return _rootPath;
     }
 
-    Messenger make ()
+    template <typename M = Messenger>
+    M make ()
     {
         if (!fs::exists(_rootPath))
             fs::create_directory(_rootPath);
@@ -75,12 +85,12 @@ public:
         _activityManagerDb = debby::sqlite3::make(_activityManagerDbPath);
         _fileCacheDb = debby::sqlite3::make(_fileCacheDbPath);
 
-        auto contactManager  = Messenger::contact_manager_type::make(_me, _contactDb);
-        auto messageStore    = Messenger::message_store_type::make(_me.contact_id, _messageStoreDb);
-        auto activityManager = Messenger::activity_manager_type::make(_activityManagerDb);
-        auto fileCache       = Messenger::file_cache_type::make(_fileCacheDb);
+        auto contactManager  = M::contact_manager_type::make(_me, _contactDb);
+        auto messageStore    = M::message_store_type::make(_me.contact_id, _messageStoreDb);
+        auto activityManager = M::activity_manager_type::make(_activityManagerDb);
+        auto fileCache       = M::file_cache_type::make(_fileCacheDb);
 
-        return Messenger {
+        return M {
               std::move(contactManager)
             , std::move(messageStore)
             , std::move(activityManager)
@@ -348,7 +358,24 @@ TEST_CASE("messenger") {
 
         last_group_message_id = editor.message_id();
 
-        // messenger1.dispatch_message(chat, last_group_message_id);
+        // Data is dispatched once for all group members except the author
+        std::vector<chat::contact::id> addressees;
+        int multicast_count = 0;
+
+        messenger1.dispatch_multicast_data = [& addressees, & multicast_count] (
+                std::vector<chat::contact::id> const & ids, chat::shared_buffer data) {
+            addressees = ids;
+            multicast_count++;
+            CHECK_FALSE(data.empty());
+        };
+
+        messenger1.dispatch_message(chat, last_group_message_id);
+        messenger1.dispatch_multicast_data = nullptr;
+
+        CHECK_EQ(multicast_count, 1);
+        REQUIRE_EQ(addressees.size(), 2);
+        CHECK(std::find(addressees.begin(), addressees.end(), contactId2) != addressees.end());
+        CHECK(std::find(addressees.begin(), addressees.end(), contactId3) != addressees.end());
     }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -360,6 +387,105 @@ TEST_CASE("messenger") {
         CHECK_EQ(messenger2.unread_message_count(), 1);
     }
 
+////////////////////////////////////////////////////////////////////////////////
+// Step 8.2 Receive batch of messages
+////////////////////////////////////////////////////////////////////////////////
+    {
+        std::vector<std::vector<char>> queued;
+
+        for (int i = 0; i < 3; i++) {
+            auto chat = messenger1.open_chat(contactId2);
+            auto editor = chat.create();
+            editor.add_text(TEXT);
+            editor.save();
+
+            messenger1.dispatch_message(chat, editor.message_id());
+            queued.push_back(last_data_sent);
+        }
+
+        // Duplicate packet must not be stored twice
+        queued.push_back(queued.back());
+
+        std::vector<chat::incoming_packet> packets;
+
+        for (auto const & data: queued)
+            packets.push_back(chat::incoming_packet{contactId1, data.data(), data.size()});
+
+        messenger2.process_incoming_batch(packets);
+        CHECK_EQ(messenger2.unread_message_count(), 4);
+        CHECK_EQ(messenger2.open_chat(contactId1).count(), 4);
+    }
+
+////////////////////////////////////////////////////////////////////////////////
+// Step 8.3 Receive batch with the first message of the chat
+////////////////////////////////////////////////////////////////////////////////
+    {
+        chat::message::content content;
+        content.add_text(TEXT);
+
+        // Messenger2 has no chat with the contact3 yet
+        chat::protocol::regular_message m;
+        m.message_id = chat::message::id_generator{}.next();
+        m.author_id = contactId3;
+        m.chat_id = contactId3;
+        m.mod_time = pfs::current_utc_time_point();
+        m.content = content.to_binary();
+
+        std::vector<char> data;
+        Messenger::serializer_type::pack(data, m);
+
+        std::vector<chat::incoming_packet> packets {
+            chat::incoming_packet{contactId3, data.data(), data.size()}
+        };
+
+        messenger2.process_incoming_batch(packets);
+        CHECK_EQ(messenger2.unread_message_count(), 5);
+        CHECK_EQ(messenger2.open_chat(contactId3).count(), 1);
+    }
+
+////////////////////////////////////////////////////////////////////////////////
+// Step 8.4 Batch with bad content is rolled back
+////////////////////////////////////////////////////////////////////////////////
+    {
+        int sf = chat::sort_flags(chat::chat_sort_flag::by_id, chat::chat_sort_flag::ascending_order);
+
+        // Load chat window into the cache before the batch
+        auto cht = messenger2.open_chat(contactId3);
+        REQUIRE(cht.message(0, sf));
+        REQUIRE_FALSE(cht.message(1, sf));
+
+        chat::message::content content;
+        content.add_text(TEXT);
+
+        chat::protocol::regular_message good;
+        good.message_id = chat::message::id_generator{}.next();
+        good.author_id = contactId3;
+        good.chat_id = contactId3;
+        good.mod_time = pfs::current_utc_time_point();
+        good.content = content.to_binary();
+
+        // Truncated binary content
+        chat::protocol::regular_message bad = good;
+        bad.message_id = chat::message::id_generator{}.next();
+        bad.content = std::string("\0\x01\xff", 3);
+
+        std::vector<char> good_data;
+        std::vector<char> bad_data;
+        Messenger::serializer_type::pack(good_data, good);
+        Messenger::serializer_type::pack(bad_data, bad);
+
+        std::vector<chat::incoming_packet> packets {
+              chat::incoming_packet{contactId3, good_data.data(), good_data.size()}
+            , chat::incoming_packet{contactId3, bad_data.data(), bad_data.size()}
+        };
+
+        CHECK_THROWS_AS(messenger2.process_incoming_batch(packets), chat::error);
+        CHECK_EQ(messenger2.unread_message_count(), 5);
+        CHECK_EQ(cht.count(), 1);
+        CHECK_FALSE(cht.message(good.message_id));
+        CHECK_FALSE(cht.message(1, sf));
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
 // Step 9.1 Activity manager
 ////////////////////////////////////////////////////////////////////////////////
@@ -398,3 +524,95 @@ TEST_CASE("messenger") {
         CHECK_EQ(my_contact1.description, newDesc1);
     }
 }
+
+TEST_CASE("packet format negotiation") {
+    auto compactId1 = chat::contact::id_generator{}.next();
+    auto compactId2 = chat::contact::id_generator{}.next();
+    auto primalId = chat::contact::id_generator{}.next();
+
+    MessengerEnv compactEnv1 {
+          chat::contact::person {compactId1, "COMPACT_1"}
+        , fs::temp_directory_path() / fs::utf8_encode(to_string(compactId1))
+    };
+
+    MessengerEnv compactEnv2 {
+          chat::contact::person {compactId2, "COMPACT_2"}
+        , fs::temp_directory_path() / fs::utf8_encode(to_string(compactId2))
+    };
+
+    MessengerEnv primalEnv {
+          chat::contact::person {primalId, "PRIMAL"}
+        , fs::temp_directory_path() / fs::utf8_encode(to_string(primalId))
+    };
+
+    auto compact1 = compactEnv1.make<CompactMessenger>();
+    auto compact2 = compactEnv2.make<CompactMessenger>();
+    auto primal = primalEnv.make();
+
+    std::vector<char> last_data_sent;
+
+    auto send_data = [& last_data_sent] (chat::contact::id, std::vector<char> const & data) {
+        last_data_sent = data;
+        return true;
+    };
+
+    compact1.dispatch_data = send_data;
+    compact2.dispatch_data = send_data;
+    primal.dispatch_data = send_data;
+
+    compact1.clear_all();
+    compact2.clear_all();
+    primal.clear_all();
+
+    REQUIRE_NE(compact1.add(chat::contact::person{compact2.my_contact()}), chat::contact::id{});
+    REQUIRE_NE(compact1.add(chat::contact::person{primal.my_contact()}), chat::contact::id{});
+    REQUIRE_NE(compact2.add(chat::contact::person{compact1.my_contact()}), chat::contact::id{});
+    REQUIRE_NE(primal.add(chat::contact::person{compact1.my_contact()}), chat::contact::id{});
+
+    auto is_compact = [& last_data_sent] {
+        REQUIRE_FALSE(last_data_sent.empty());
+        return (static_cast<std::uint8_t>(last_data_sent[0]) & 0x80) != 0;
+    };
+
+    auto send_text = [& is_compact] (CompactMessenger & m, chat::contact::id addressee_id) {
+        auto chat = m.open_chat(addressee_id);
+        auto editor = chat.create();
+        editor.add_text(TEXT);
+        editor.save();
+        m.dispatch_message(chat, editor.message_id());
+        return is_compact();
+    };
+
+    // Formats are unknown: primal format is used
+    CHECK_EQ(compact1.peer_formats(compactId2), 0);
+    CHECK_FALSE(send_text(compact1, compactId2));
+    CHECK_FALSE(send_text(compact1, primalId));
+
+    primal.process_incoming_data(compactId1, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(primal.open_chat(compactId1).count(), 1);
+
+    // Contact credentials are sent in primal format while peer formats are unknown
+    compact1.dispatch_contact(primalId);
+    CHECK_FALSE(is_compact());
+
+    primal.process_incoming_data(compactId1, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(primal.peer_formats(compactId1), static_cast<std::uint8_t>(chat::protocol::packet_format::compact));
+
+    // Primal peer announces primal format only
+    primal.dispatch_contact(compactId1);
+    compact1.process_incoming_data(primalId, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(compact1.peer_formats(primalId), 0);
+    CHECK_FALSE(send_text(compact1, primalId));
+
+    primal.process_incoming_data(compactId1, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(primal.open_chat(compactId1).count(), 2);
+
+    // Compact peer announces compact format
+    compact2.dispatch_contact(compactId1);
+    compact1.process_incoming_data(compactId2, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(compact1.peer_formats(compactId2), static_cast<std::uint8_t>(chat::protocol::packet_format::compact));
+    CHECK(send_text(compact1, compactId2));
+
+    compact2.process_incoming_data(compactId1, last_data_sent.data(), last_data_sent.size());
+    CHECK_EQ(compact2.open_chat(compactId1).count(), 1);
+}
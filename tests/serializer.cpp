@@ -6,11 +6,28 @@
 // Changelog:
 //      2022.03.19 Initial version.
 //      2024.11.29 Refactored for V2.
+//      2026.10.16 Added bulk notifications test.
+//                 Added binary content encoding test.
+//                 Added HTML projection test.
+//                 Added zero-copy decoding test.
+//                 Added pooled buffer serialization test.
+//                 Added compact serializer test.
+//                 Added envelope test.
+//                 Added malformed bulk notification check.
+//                 Added check of `content::empty()` decoding error.
+//                 Added check of ignored HTML projection of version 2.
+//                 Added check of packet formats in contact credentials.
+//                 Added check of oversized audio WAV frames count.
 ////////////////////////////////////////////////////////////////////////////////
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "pfs/chat/protocol.hpp"
 #include "pfs/chat/primal_serializer.hpp"
+#include "pfs/chat/compact_serializer.hpp"
+#include "pfs/chat/crc32c.hpp"
+#include "pfs/chat/output_buffer_pool.hpp"
+#include <pfs/binary_ostream.hpp>
+#include <pfs/universal_id_pack.hpp>
 #include <fstream>
 
 namespace {
@@ -39,3 +56,434 @@ TEST_CASE("serializer") {
 
     CHECK_EQ(packet_type, chat::protocol::packet_enum::regular_message);
 }
+
+TEST_CASE("regular message view") {
+    using serializer_t = chat::primal_serializer<pfs::endian::network>;
+
+    chat::message::content c;
+    c.add_text(TEST_CONTENT);
+
+    chat::protocol::regular_message m;
+    m.message_id    = "01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid;
+    m.author_id     = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    m.chat_id       = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    m.mod_time      = pfs::current_utc_time_point();
+    m.content       = c.to_binary();
+
+    serializer_t::ostream_type out;
+    out << m;
+
+    chat::protocol::regular_message_view m1;
+    serializer_t::istream_type in {out.data(), out.size()};
+    chat::protocol::packet_enum packet_type;
+    in >> packet_type >> m1;
+
+    CHECK_EQ(packet_type, chat::protocol::packet_enum::regular_message);
+    CHECK_EQ(m1.message_id, m.message_id);
+    CHECK_EQ(m1.author_id, m.author_id);
+    CHECK_EQ(m1.chat_id, m.chat_id);
+    CHECK_EQ(m1.mod_time, m.mod_time);
+
+    // Content references the packet data
+    REQUIRE_EQ(m1.content.size(), m.content.size());
+    CHECK(m1.content.data() >= out.data());
+    CHECK(m1.content.data() + m1.content.size() <= out.data() + out.size());
+    CHECK_EQ(std::string(m1.content.data(), m1.content.size()), m.content);
+
+    auto c1 = chat::message::content::decode_view(m1.content);
+    REQUIRE_EQ(c1.count(), 1);
+    CHECK_EQ(c1.at(0).text, TEST_CONTENT);
+
+    // Truncated packet
+    chat::protocol::regular_message_view m2;
+    serializer_t::istream_type in2 {out.data(), out.size() - 1};
+    in2 >> packet_type;
+    CHECK_THROWS(in2 >> m2);
+}
+
+TEST_CASE("pooled buffer serialization") {
+    using serializer_t = chat::primal_serializer<pfs::endian::network>;
+
+    chat::protocol::bulk_read_notification m;
+    m.chat_id   = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    m.read_time = pfs::current_utc_time_point();
+    m.message_ids.push_back("01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid);
+    m.message_ids.push_back("01G2HFKWF1MMBBXWHF4VWJGGTN"_uuid);
+
+    serializer_t::ostream_type out;
+    out << m;
+    std::vector<char> expected(out.data(), out.data() + out.size());
+
+    chat::output_buffer_pool pool;
+    char const * data = nullptr;
+
+    {
+        auto lease = pool.acquire();
+        serializer_t::pack(lease.buffer(), m);
+        CHECK_EQ(lease.buffer(), expected);
+        CHECK_EQ(serializer_t::packed_size(m), expected.size());
+        data = lease.buffer().data();
+    }
+
+    REQUIRE_EQ(pool.free_count(), 1);
+
+    // Buffer is reused without reallocation
+    {
+        auto lease = pool.acquire();
+        CHECK_EQ(pool.free_count(), 0);
+        CHECK(lease.buffer().empty());
+        serializer_t::pack(lease.buffer(), m);
+        CHECK_EQ(lease.buffer().data(), data);
+        CHECK_EQ(lease.buffer(), expected);
+    }
+
+    // Detached buffer is not returned to the pool
+    {
+        auto lease = pool.acquire();
+        auto buffer = lease.take();
+        CHECK(buffer.capacity() >= expected.size());
+    }
+
+    CHECK_EQ(pool.free_count(), 0);
+}
+
+TEST_CASE("compact serializer") {
+    using primal_t = chat::primal_serializer<pfs::endian::network>;
+    using compact_t = chat::compact_serializer<pfs::endian::network>;
+
+    chat::protocol::regular_message m;
+    m.message_id = "01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid;
+    m.author_id  = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    m.chat_id    = m.author_id; // Personal chat
+    m.mod_time   = pfs::current_utc_time_point();
+    m.content    = TEST_CONTENT;
+
+    std::vector<char> primal_data;
+    std::vector<char> compact_data;
+    primal_t::pack(primal_data, m);
+    compact_t::pack(compact_data, m);
+
+    REQUIRE_FALSE(compact_data.empty());
+    CHECK_EQ(static_cast<std::uint8_t>(compact_data[0]), compact_t::header);
+    CHECK_LT(compact_data.size(), primal_data.size());
+
+    // Both formats are decoded by compact serializer
+    for (auto const * data: {& compact_data, & primal_data}) {
+        compact_t::istream_type in {data->data(), data->size()};
+        chat::protocol::packet_enum packet_type;
+        chat::protocol::regular_message_view m1;
+        compact_t::unpack(in, packet_type);
+        compact_t::unpack(in, m1);
+
+        CHECK_EQ(in.compact(), data == & compact_data);
+        CHECK_EQ(packet_type, chat::protocol::packet_enum::regular_message);
+        CHECK_EQ(m1.message_id, m.message_id);
+        CHECK_EQ(m1.author_id, m.author_id);
+        CHECK_EQ(m1.chat_id, m.chat_id);
+        CHECK_EQ(m1.mod_time.to_millis(), m.mod_time.to_millis());
+        CHECK_EQ(std::string(m1.content.data(), m1.content.size()), m.content);
+    }
+
+    // Repeated identifiers are referenced within the session
+    chat::protocol::bulk_delivery_notification d;
+    d.chat_id = m.chat_id;
+    d.delivered_time = m.mod_time;
+    d.message_ids.push_back(m.message_id);
+
+    compact_t::session out_session;
+    compact_t::session in_session;
+    std::vector<char> data1;
+    std::vector<char> data2;
+    compact_t::pack(data1, d, out_session);
+    compact_t::pack(data2, d, out_session);
+
+    CHECK_LT(data2.size(), data1.size());
+
+    for (auto const * data: {& data1, & data2}) {
+        compact_t::istream_type in {data->data(), data->size(), in_session};
+        chat::protocol::packet_enum packet_type;
+        chat::protocol::bulk_delivery_notification d1;
+        compact_t::unpack(in, packet_type);
+        compact_t::unpack(in, d1);
+
+        CHECK_EQ(packet_type, chat::protocol::packet_enum::bulk_delivery_notification);
+        CHECK_EQ(d1.chat_id, d.chat_id);
+        CHECK_EQ(d1.delivered_time.to_millis(), d.delivered_time.to_millis());
+        REQUIRE_EQ(d1.message_ids.size(), 1);
+        CHECK_EQ(d1.message_ids[0], d.message_ids[0]);
+    }
+
+    // Referenced identifier is unknown without session
+    {
+        compact_t::istream_type in {data2.data(), data2.size()};
+        chat::protocol::packet_enum packet_type;
+        chat::protocol::bulk_delivery_notification d1;
+        compact_t::unpack(in, packet_type);
+        CHECK_THROWS(compact_t::unpack(in, d1));
+    }
+
+    // Unsupported version
+    {
+        std::vector<char> bad_data {static_cast<char>(0x80 | 0x7F), 3};
+        compact_t::istream_type in {bad_data.data(), bad_data.size()};
+        chat::protocol::packet_enum packet_type;
+        CHECK_THROWS(compact_t::unpack(in, packet_type));
+    }
+
+    // Supported packet formats are announced by contact credentials
+    chat::protocol::contact_credentials cc;
+    cc.contact.contact_id = m.author_id;
+    cc.contact.creator_id = m.author_id;
+    cc.contact.alias = "PERSON";
+    cc.contact.type = chat::chat_enum::person;
+    cc.formats = static_cast<std::uint8_t>(compact_t::format);
+
+    std::vector<char> cc_primal_data;
+    std::vector<char> cc_compact_data;
+    primal_t::pack(cc_primal_data, cc);
+    compact_t::pack(cc_compact_data, cc);
+
+    // Packet of previous version has no formats
+    std::vector<char> cc_legacy_data {cc_primal_data.begin(), cc_primal_data.end() - 1};
+
+    for (auto const * data: {& cc_primal_data, & cc_compact_data, & cc_legacy_data}) {
+        compact_t::istream_type in {data->data(), data->size()};
+        chat::protocol::packet_enum packet_type;
+        chat::protocol::contact_credentials cc1;
+        cc1.formats = 0xFF;
+        compact_t::unpack(in, packet_type);
+        compact_t::unpack(in, cc1);
+
+        CHECK_EQ(packet_type, chat::protocol::packet_enum::contact_credentials);
+        CHECK_EQ(cc1.contact.contact_id, cc.contact.contact_id);
+        CHECK_EQ(cc1.contact.alias, cc.contact.alias);
+        CHECK_EQ(cc1.formats, data == & cc_legacy_data ? 0 : cc.formats);
+    }
+}
+
+TEST_CASE("envelope") {
+    using primal_t = chat::primal_serializer<pfs::endian::network>;
+    using compact_t = chat::compact_serializer<pfs::endian::network>;
+
+    CHECK_EQ(chat::crc32c("123456789", 9), 0xE3069283);
+
+    chat::protocol::delivery_notification d;
+    d.message_id = "01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid;
+    d.chat_id = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    d.delivered_time = pfs::current_utc_time_point();
+
+    chat::protocol::read_notification r;
+    r.message_id = d.message_id;
+    r.chat_id = d.chat_id;
+    r.read_time = d.delivered_time;
+
+    std::vector<char> data1;
+    std::vector<char> data2;
+    std::vector<char> unknown {static_cast<char>(0x50), 1, 2, 3}; // Packet of a future version
+    primal_t::pack(data1, d);
+    compact_t::pack(data2, r);
+
+    for (bool checksum: {false, true}) {
+        chat::protocol::envelope env;
+        env.checksum = checksum;
+        env.packets.emplace_back(data1.data(), data1.size());
+        env.packets.emplace_back(data2.data(), data2.size());
+        env.packets.emplace_back(unknown.data(), unknown.size());
+
+        std::vector<char> data;
+        compact_t::pack(data, env);
+
+        CHECK_EQ(data.size(), primal_t::packed_size(env));
+        CHECK_EQ(static_cast<chat::protocol::packet_enum>(data[0]), chat::protocol::packet_enum::envelope);
+
+        primal_t::envelope_decoder decoder {data.data(), data.size()};
+        REQUIRE_EQ(decoder.count(), 3);
+
+        std::vector<std::string> packets;
+        pfs::string_view packet;
+
+        while (decoder.next(packet)) {
+            packets.emplace_back(packet.data(), packet.size());
+
+            if (packets.size() < 3) {
+                compact_t::istream_type in {packet.data(), packet.size()};
+                chat::protocol::packet_enum packet_type;
+                compact_t::unpack(in, packet_type);
+                CHECK(chat::protocol::is_known(packet_type));
+            }
+        }
+
+        REQUIRE_EQ(packets.size(), 3);
+        CHECK_EQ(packets[0], std::string(data1.data(), data1.size()));
+        CHECK_EQ(packets[1], std::string(data2.data(), data2.size()));
+        CHECK_EQ(packets[2], std::string(unknown.data(), unknown.size()));
+
+        // Truncated envelope
+        CHECK_THROWS([& data] {
+            primal_t::envelope_decoder decoder {data.data(), data.size() - 5};
+            pfs::string_view packet;
+
+            while (decoder.next(packet))
+                ;
+        }());
+
+        if (checksum) {
+            // Corrupted envelope
+            data[10] ^= 0x01;
+            CHECK_THROWS_AS((primal_t::envelope_decoder{data.data(), data.size()}), chat::error);
+        }
+    }
+
+    // Unsupported version
+    std::vector<char> bad_data {static_cast<char>(chat::protocol::packet_enum::envelope), 2, 0, 0, 0, 0, 0};
+    CHECK_THROWS_AS((primal_t::envelope_decoder{bad_data.data(), bad_data.size()}), chat::error);
+}
+
+TEST_CASE("bulk notifications") {
+    using serializer_t = chat::primal_serializer<pfs::endian::network>;
+    auto time_point = pfs::current_utc_time_point();
+
+    chat::protocol::bulk_read_notification m;
+    m.chat_id   = "01FV1KFY7WWS3WSBV4BFYF7ZC9"_uuid;
+    m.read_time = time_point;
+    m.message_ids.push_back("01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid);
+    m.message_ids.push_back("01G2HFKWF1MMBBXWHF4VWJGGTN"_uuid);
+
+    serializer_t::ostream_type out;
+    out << m;
+
+    chat::protocol::bulk_read_notification m1;
+    serializer_t::istream_type in {out.data(), out.size()};
+    chat::protocol::packet_enum packet_type;
+    in >> packet_type >> m1;
+
+    CHECK_EQ(packet_type, chat::protocol::packet_enum::bulk_read_notification);
+    CHECK_EQ(m1.chat_id, m.chat_id);
+    CHECK_EQ(m1.read_time, m.read_time);
+    REQUIRE_EQ(m1.message_ids.size(), 2);
+    CHECK_EQ(m1.message_ids[0], m.message_ids[0]);
+    CHECK_EQ(m1.message_ids[1], m.message_ids[1]);
+
+    // Count of identifiers exceeds packet size
+    chat::protocol::bulk_read_notification m2;
+    serializer_t::istream_type in2 {out.data(), out.size() - 16};
+    in2 >> packet_type;
+    CHECK_THROWS_AS(in2 >> m2, chat::error);
+}
+
+TEST_CASE("content binary encoding") {
+    chat::message::content c;
+    c.add_text(TEST_CONTENT);
+    c.add_html("<html></html>");
+
+    chat::file::credentials fc;
+    fc.file_id = "01G2HFKWF1MMBBXWHF4VWJGGTN"_uuid;
+    fc.name = "audio.wav";
+    fc.size = 1024;
+    fc.mime = mime::mime_enum::audio__wav;
+
+    chat::message::audio_wav_credentials wav;
+    wav.num_channels = 2;
+    wav.duration = 1500;
+    wav.min_frame = std::make_pair(-1.f, -.5f);
+    wav.max_frame = std::make_pair(1.f, .5f);
+    wav.data.push_back(std::make_pair(.25f, -.25f));
+    wav.data.push_back(std::make_pair(.75f, -.75f));
+
+    c.add_audio_wav(wav, fc);
+
+    auto binary = c.to_binary();
+
+    REQUIRE(chat::message::content::is_binary(binary));
+    CHECK_LT(binary.size(), c.to_string().size());
+
+    chat::message::content c1 {binary};
+    chat::message::content c2 {c.to_string()};
+
+    for (auto const * x: {& c1, & c2}) {
+        REQUIRE_EQ(x->count(), 3);
+        CHECK_EQ(x->at(0).text, TEST_CONTENT);
+        CHECK_EQ(x->at(1).mime, mime::mime_enum::text__html);
+        CHECK_EQ(x->attachment(2).file_id, fc.file_id);
+        CHECK_EQ(x->attachment(2).name, fc.name);
+        CHECK_EQ(x->attachment(2).size, fc.size);
+
+        auto w = x->audio_wav(2);
+        CHECK_EQ(w.num_channels, 2);
+        CHECK_EQ(w.duration, 1500);
+        REQUIRE_EQ(w.data.size(), 2);
+        CHECK_EQ(w.data[1].second, -.75f);
+    }
+
+    CHECK_EQ(c1.to_binary(), binary);
+
+    // Truncated data, decoded lazily
+    chat::message::content truncated {binary.substr(0, binary.size() - 3)};
+    CHECK_THROWS_AS(truncated.decode(), chat::error);
+    CHECK_THROWS_AS(truncated.count(), chat::error);
+    CHECK_THROWS_AS(truncated.empty(), chat::error);
+
+    // Oversized audio WAV frames count (with negative file size) is rejected before allocation
+    pfs::binary_ostream<pfs::endian::network> out;
+    out << std::uint8_t{0} << std::uint8_t{1} << std::uint32_t{1}
+        << std::uint8_t{(1 << 0) | (1 << 1)} << std::int32_t{0} << std::string{"audio.wav"}
+        << "01FV1KFY7WCBKDQZ5B4T5ZJMSA"_uuid << std::int32_t{-1}
+        << std::uint8_t{2} << std::uint32_t{1000}
+        << 0.f << 0.f << 1.f << 1.f
+        << std::uint32_t{0x7FFFFFFF} << 0.f << 0.f;
+
+    chat::message::content oversized {std::string(out.data(), out.size())};
+    CHECK_THROWS_AS(oversized.decode(), chat::error);
+}
+
+TEST_CASE("HTML projection") {
+    std::string html {"<p>Привет, <b>мир</b>!</p>"};
+
+    chat::message::content c;
+    c.add_text("<b>not HTML</b>");
+    c.add_html(html);
+    c.add_html("No tags");
+
+    CHECK_EQ(c.plain_text(0), std::string{"<b>not HTML</b>"});
+    CHECK_EQ(c.plain_text(1), std::string{"Привет, мир!"});
+    CHECK_EQ(c.plain_text(2), std::string{"No tags"});
+    CHECK(c.plain_text(3).empty());
+
+    // Calculated while decoding binary and JSON
+    chat::message::content c1 {c.to_binary()};
+    chat::message::content c2 {c.to_string()};
+
+    for (auto const * x: {& c, & c1, & c2}) {
+        REQUIRE_EQ(x->plain_text(1), std::string{"Привет, мир!"});
+
+        // "мир" starts at code point 8 of the plain text (code unit 14)
+        auto first = x->source_position(1, 14, 8);
+        CHECK_EQ(first.first, html.find("мир"));
+        CHECK_EQ(first.second, 14);
+
+        // "!" follows closing tag
+        auto last = x->source_position(1, 20, 11);
+        CHECK_EQ(last.first, html.find('!'));
+        CHECK_EQ(last.second, 21);
+
+        // Identity mapping for text without tags
+        CHECK_EQ(x->source_position(2, 3, 3), std::make_pair(std::size_t{3}, std::size_t{3}));
+    }
+
+    // Projection is not encoded
+    CHECK_EQ(c1.to_binary().find("Привет, мир!"), std::string::npos);
+
+    // Projection encoded by version 2 (e.g. received from peer) is ignored
+    pfs::binary_ostream<pfs::endian::network> out;
+    out << std::uint8_t{0} << std::uint8_t{2} << std::uint32_t{1}
+        << std::uint8_t{1 << 2} << static_cast<std::int32_t>(mime::mime_enum::text__html) << html
+        << std::string{"Forged"} << std::uint32_t{1}
+        << std::uint32_t{0} << std::uint32_t{0} << std::uint32_t{0} << std::uint32_t{0};
+
+    chat::message::content c3 {std::string(out.data(), out.size())};
+    REQUIRE_EQ(c3.count(), 1);
+    CHECK_EQ(c3.at(0).text, html);
+    CHECK_EQ(c3.plain_text(0), std::string{"Привет, мир!"});
+    CHECK_EQ(c3.source_position(0, 14, 8).first, html.find("мир"));
+    CHECK_EQ(static_cast<std::uint8_t>(c3.to_binary()[1]), chat::message::content::binary_version);
+}